@@ -0,0 +1,158 @@
+#include "batch.h"
+#include "cache.h"
+#include "pipeline.h"
+
+#include <buffer_pool.h>
+#include <thread_pool.h>
+
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <string>
+
+using namespace std;
+
+ManifestLine ParseManifestLine(const string& line, ConvertJob& job) {
+    istringstream line_in(line);
+    string in_file, out_file;
+
+    line_in >> ws;
+    if (line_in.eof() || line_in.peek() == '#') {
+        return ManifestLine::SKIP;
+    }
+
+    if (!(line_in >> quoted(in_file) >> quoted(out_file))) {
+        return ManifestLine::INVALID;
+    }
+
+    // после двух путей в строке ничего быть не должно
+    line_in >> ws;
+    if (!line_in.eof()) {
+        return ManifestLine::INVALID;
+    }
+
+    job = {in_file, out_file};
+    return ManifestLine::JOB;
+}
+
+optional<vector<ConvertJob>> ReadManifest(istream& in) {
+    vector<ConvertJob> jobs;
+    string line;
+
+    while (getline(in, line)) {
+        ConvertJob job;
+        switch (ParseManifestLine(line, job)) {
+            case ManifestLine::JOB:
+                jobs.push_back(move(job));
+                break;
+            case ManifestLine::INVALID:
+                return nullopt;
+            case ManifestLine::SKIP:
+                break;
+        }
+    }
+
+    return jobs;
+}
+
+vector<ConvertJob> CollectDirectoryJobs(const img_lib::Path& in_dir,
+                                        const img_lib::Path& out_dir,
+                                        const string& out_ext) {
+    namespace fs = std::filesystem;
+    vector<ConvertJob> jobs;
+
+    // Каталоги без прав на чтение пропускаются, а другая ошибка обхода его
+    // завершает: задания по найденным файлам всё равно выполняются
+    error_code ec;
+    for (auto it = fs::recursive_directory_iterator(in_dir, fs::directory_options::skip_permission_denied, ec);
+         !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+        const fs::directory_entry& entry = *it;
+        error_code entry_ec;
+        // файлы с неподходящим расширением тоже берём, если их выдаёт сигнатура
+        if (!entry.is_regular_file(entry_ec) || !img_lib::DetectFormatInterface(entry.path())) {
+            continue;
+        }
+
+        const img_lib::Path relative = fs::relative(entry.path(), in_dir, entry_ec);
+        if (entry_ec) {
+            continue;
+        }
+        img_lib::Path out_path = out_dir / relative;
+        out_path.replace_extension(out_ext);
+
+        // каталоги создаём заранее в основном потоке, чтобы рабочие
+        // потоки не соревновались за create_directories. Если каталог
+        // создать не удалось, задание остаётся и завершится ошибкой записи
+        fs::create_directories(out_path.parent_path(), entry_ec);
+        jobs.push_back({entry.path(), move(out_path)});
+    }
+
+    return jobs;
+}
+
+vector<ConvertStatus> ConvertJobs(const vector<ConvertJob>& jobs, const BatchOptions& batch,
+                                  const ConvertOptions& options, ostream& err) {
+    vector<ConvertStatus> results(jobs.size(), ConvertStatus::OK);
+    mutex report_mutex;
+
+    auto on_done = [&](size_t i, ConvertStatus status) {
+        results[i] = status;
+
+        if (status != ConvertStatus::OK) {
+            const ConvertJob& job = jobs[i];
+            lock_guard lock(report_mutex);
+            err << job.in_path.string() << " -> "sv << job.out_path.string() << ": "sv
+                << GetStatusMessage(status) << endl;
+        }
+    };
+
+    if (batch.pipeline) {
+        RunPipeline(jobs, {batch.io_threads, batch.jobs, batch.cache}, options, on_done);
+    } else {
+        // буферы полос и строк освобождаются после каждого файла и сразу
+        // достаются следующему, вместо того чтобы каждый раз идти к системе
+        img_lib::RecyclingBufferPool buffer_pool;
+
+        img_lib::ThreadPool pool(batch.jobs);
+        for (size_t i = 0; i < jobs.size(); ++i) {
+            pool.Submit([&, i] {
+                img_lib::ScopedBufferPool pool_scope(buffer_pool);
+                const ConvertJob& job = jobs[i];
+                ConvertStatus status;
+                try {
+                    status = ConvertImageCached(job.in_path, job.out_path, options, batch.cache);
+                } catch (const exception&) {
+                    // например, bad_alloc на слишком большом изображении
+                    status = ConvertStatus::LOADING_FAILED;
+                }
+                on_done(i, status);
+            });
+        }
+        pool.Wait();
+    }
+
+    return results;
+}
+
+ConvertStatus RunBatch(const vector<ConvertJob>& jobs, const BatchOptions& batch,
+                       const ConvertOptions& options, ostream& out, ostream& err) {
+    const vector<ConvertStatus> results = ConvertJobs(jobs, batch, options, err);
+
+    size_t converted = 0;
+    ConvertStatus first_failure = ConvertStatus::OK;
+    for (ConvertStatus status : results) {
+        if (status == ConvertStatus::OK) {
+            ++converted;
+        } else if (first_failure == ConvertStatus::OK) {
+            first_failure = status;
+        }
+    }
+
+    if (first_failure == ConvertStatus::OK) {
+        out << "Successfully converted "sv << converted << " files"sv << endl;
+    } else {
+        out << "Converted "sv << converted << " of "sv << jobs.size() << " files"sv << endl;
+    }
+
+    return first_failure;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "converter.h"
+
+#include <istream>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Пара "входной файл - выходной файл" для пакетной конвертации
+struct ConvertJob {
+    img_lib::Path in_path;
+    img_lib::Path out_path;
+};
+
+enum class ManifestLine {
+    JOB,      // строка задания
+    SKIP,     // пустая строка или комментарий
+    INVALID,
+};
+
+// Разбирает одну строку манифеста, при JOB записывает задание в job
+ManifestLine ParseManifestLine(const std::string& line, ConvertJob& job);
+
+// Читает манифест: каждая непустая строка содержит два пути,
+// входной и выходной. Пути с пробелами заключаются в кавычки,
+// строки, начинающиеся с '#', считаются комментариями.
+// Возвращает nullopt, если какая-то строка записана некорректно
+std::optional<std::vector<ConvertJob>> ReadManifest(std::istream& in);
+
+// Собирает задания по дереву каталогов: каждому файлу известного формата
+// из in_dir сопоставляется файл в out_dir с тем же относительным путём
+// и расширением out_ext. Недостающие каталоги в out_dir создаются; если
+// это не удалось, задание всё равно возвращается и завершится ошибкой записи.
+// Ошибки обхода in_dir не выбрасываются: нечитаемые каталоги пропускаются
+std::vector<ConvertJob> CollectDirectoryJobs(const img_lib::Path& in_dir,
+                                             const img_lib::Path& out_dir,
+                                             const std::string& out_ext);
+
+class ConversionCache;
+
+struct BatchOptions {
+    size_t jobs = 0;          // потоки конвертации, 0 - по числу ядер
+    bool pipeline = false;    // конвейер стадий вместо независимых заданий, см. RunPipeline
+    size_t io_threads = 2;    // потоки чтения и записи конвейера
+    ConversionCache* cache = nullptr;  // кэш результатов, nullptr - без кэша
+};
+
+// Конвертирует все файлы: по умолчанию каждый файл целиком конвертируется
+// одним потоком пула через ConvertImage, с pipeline - конвейером RunPipeline.
+// Ошибка одного файла не прерывает обработку остальных: о ней сообщается
+// в err. Возвращает статусы заданий в порядке jobs
+std::vector<ConvertStatus> ConvertJobs(const std::vector<ConvertJob>& jobs, const BatchOptions& batch,
+                                       const ConvertOptions& options, std::ostream& err);
+
+// ConvertJobs с итогом в out. Результат - статус первого неудачного задания
+ConvertStatus RunBatch(const std::vector<ConvertJob>& jobs, const BatchOptions& batch,
+                       const ConvertOptions& options, std::ostream& out, std::ostream& err);
@@ -0,0 +1,384 @@
+// Сквозной замер imgconv на своём наборе файлов: задания пакетного режима
+// прогоняются через тот же путь конвертации (ConvertImage, а с --cache -
+// через кэш) на --jobs потоках, и для каждого файла замеряется время.
+// Отчёт - JSON с задержкой на изображение (p50, p99), изображениями и
+// мегабайтами в секунду и пиковой памятью. С --baseline отчёт сравнивается
+// с сохранённым, и программа завершается кодом 3, если какая-то метрика
+// стала хуже больше чем на --threshold процентов.
+//
+//   imgconv_perf --json base.json --batch-dir corpus out .jpg --jobs 4
+//   imgconv_perf --baseline base.json --repeat 3 --batch-dir corpus out .jpg --jobs 4
+
+#include "../cache.h"
+#include "../command_line.h"
+
+#include <buffer_pool.h>
+#include <thread_pool.h>
+#include <trace.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+namespace fs = std::filesystem;
+
+// коды возврата
+constexpr int EXIT_USAGE = 1;
+constexpr int EXIT_CONVERSION_FAILED = 2;
+constexpr int EXIT_REGRESSION = 3;
+
+struct PerfOptions {
+    int repeat = 1;          // замеряемых проходов по набору
+    int warmup = 1;          // незамеряемых проходов до них: прогрев кэша ОС и пулов
+    string json_file;        // пусто - отчёт в stdout
+    string baseline_file;
+    double threshold = 10;   // допустимое ухудшение метрики, в процентах
+};
+
+struct PerfReport {
+    size_t images = 0;
+    size_t failed = 0;
+    size_t jobs = 0;
+    double wall_seconds = 0;
+    double images_per_second = 0;
+    double input_mb_per_second = 0;
+    double output_mb_per_second = 0;
+    double latency_p50_ms = 0;
+    double latency_p99_ms = 0;
+    double latency_mean_ms = 0;
+    double latency_max_ms = 0;
+    uint64_t peak_rss_bytes = 0;
+};
+
+// Сравниваемая метрика: имя в JSON, значение и направление улучшения
+struct Metric {
+    string_view name;
+    double value;
+    bool higher_is_better;
+};
+
+vector<Metric> GetMetrics(const PerfReport& report) {
+    return {
+        {"images_per_second"sv, report.images_per_second, true},
+        {"input_mb_per_second"sv, report.input_mb_per_second, true},
+        {"latency_p50_ms"sv, report.latency_p50_ms, false},
+        {"latency_p99_ms"sv, report.latency_p99_ms, false},
+        {"peak_rss_bytes"sv, double(report.peak_rss_bytes), false},
+    };
+}
+
+void PrintPerfUsage(const char* exe) {
+    cerr << "Usage: "sv << exe << " [perf options] --batch <manifest_file> [imgconv options]"sv << endl;
+    cerr << "       "sv << exe << " [perf options] --batch-dir <in_dir> <out_dir> <out_ext> [imgconv options]"sv << endl;
+    cerr << "Perf options:"sv << endl;
+    cerr << "  --repeat N          measured passes over the corpus (default 1)"sv << endl;
+    cerr << "  --warmup N          unmeasured passes before them (default 1)"sv << endl;
+    cerr << "  --json FILE         write the JSON report to FILE instead of stdout"sv << endl;
+    cerr << "  --baseline FILE     compare with an earlier report, exit 3 on regressions"sv << endl;
+    cerr << "  --threshold PCT     allowed regression of a metric in percent (default 10)"sv << endl;
+    cerr << "imgconv options are the same as for imgconv, except --pipeline and --incremental"sv << endl;
+    cerr << "Exit codes: 1 - bad arguments or files, 2 - some conversions failed, 3 - regression"sv << endl;
+}
+
+// Разбирает параметры замера до режима imgconv; first - индекс режима.
+// nullopt - если параметр неизвестен или значение некорректно
+optional<PerfOptions> ParsePerfOptions(int argc, const char** argv, int& first) {
+    PerfOptions options;
+    int i = 1;
+    for (; i < argc; ++i) {
+        const string_view name = argv[i];
+        if (name == "--batch"sv || name == "--batch-dir"sv) {
+            break;
+        }
+        if (i + 1 == argc) {
+            return nullopt;
+        }
+        const char* value = argv[++i];
+        char* end = nullptr;
+
+        if (name == "--repeat"sv || name == "--warmup"sv) {
+            const long count = strtol(value, &end, 10);
+            if (*end != '\0' || count < (name == "--repeat"sv ? 1 : 0) || count > 1000000) {
+                return nullopt;
+            }
+            (name == "--repeat"sv ? options.repeat : options.warmup) = int(count);
+        } else if (name == "--threshold"sv) {
+            options.threshold = strtod(value, &end);
+            if (*end != '\0' || !(options.threshold >= 0)) {
+                return nullopt;
+            }
+        } else if (name == "--json"sv) {
+            options.json_file = value;
+        } else if (name == "--baseline"sv) {
+            options.baseline_file = value;
+        } else {
+            return nullopt;
+        }
+    }
+    if (i == argc) {
+        return nullopt;
+    }
+    first = i;
+    return options;
+}
+
+optional<vector<ConvertJob>> CollectJobs(const CommandLine& cmd) {
+    if (cmd.mode == RunMode::BATCH) {
+        ifstream manifest_in(cmd.args[0]);
+        return manifest_in ? ReadManifest(manifest_in) : nullopt;
+    }
+
+    string out_ext = cmd.args[2];
+    if (!out_ext.empty() && out_ext.front() != '.') {
+        out_ext.insert(out_ext.begin(), '.');
+    }
+    error_code ec;
+    if (!fs::is_directory(cmd.args[0], ec)) {
+        return nullopt;
+    }
+    return CollectDirectoryJobs(cmd.args[0], cmd.args[1], out_ext);
+}
+
+// Время одного файла и объём его входа и выхода
+struct JobSample {
+    double seconds = 0;
+    uintmax_t in_bytes = 0;
+    uintmax_t out_bytes = 0;
+    bool ok = false;
+};
+
+// Один проход по всем заданиям на общем пуле, как в RunBatch
+vector<JobSample> RunPass(const vector<ConvertJob>& jobs, const CommandLine& cmd, ConversionCache* cache,
+                          img_lib::ThreadPool& pool, img_lib::RecyclingBufferPool& buffer_pool) {
+    vector<JobSample> samples(jobs.size());
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        pool.Submit([&, i] {
+            img_lib::ScopedBufferPool pool_scope(buffer_pool);
+            const ConvertJob& job = jobs[i];
+            JobSample& sample = samples[i];
+            error_code ec;
+            sample.in_bytes = fs::file_size(job.in_path, ec);
+
+            const auto start = chrono::steady_clock::now();
+            ConvertStatus status;
+            try {
+                status = ConvertImageCached(job.in_path, job.out_path, cmd.convert, cache);
+            } catch (const exception&) {
+                status = ConvertStatus::LOADING_FAILED;
+            }
+            sample.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+            sample.ok = status == ConvertStatus::OK;
+            if (sample.ok) {
+                sample.out_bytes = fs::file_size(job.out_path, ec);
+            }
+        });
+    }
+    pool.Wait();
+    return samples;
+}
+
+// значение по нижнему рангу: доля p выборки не больше него
+double Percentile(const vector<double>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    const size_t rank = size_t(ceil(p * double(sorted.size())));
+    return sorted[min(sorted.size(), max<size_t>(rank, 1)) - 1];
+}
+
+PerfReport MakeReport(const vector<JobSample>& samples, double wall_seconds, size_t jobs) {
+    PerfReport report;
+    report.jobs = jobs;
+    report.wall_seconds = wall_seconds;
+
+    vector<double> latencies;
+    uintmax_t in_bytes = 0;
+    uintmax_t out_bytes = 0;
+    for (const JobSample& sample : samples) {
+        if (!sample.ok) {
+            ++report.failed;
+            continue;
+        }
+        latencies.push_back(sample.seconds * 1000);
+        in_bytes += sample.in_bytes;
+        out_bytes += sample.out_bytes;
+    }
+    report.images = latencies.size();
+    sort(latencies.begin(), latencies.end());
+
+    if (wall_seconds > 0) {
+        report.images_per_second = double(report.images) / wall_seconds;
+        report.input_mb_per_second = double(in_bytes) / (1 << 20) / wall_seconds;
+        report.output_mb_per_second = double(out_bytes) / (1 << 20) / wall_seconds;
+    }
+    report.latency_p50_ms = Percentile(latencies, 0.5);
+    report.latency_p99_ms = Percentile(latencies, 0.99);
+    if (!latencies.empty()) {
+        double total = 0;
+        for (double latency : latencies) {
+            total += latency;
+        }
+        report.latency_mean_ms = total / double(latencies.size());
+        report.latency_max_ms = latencies.back();
+    }
+    report.peak_rss_bytes = img_lib::GetPeakRSS();
+    return report;
+}
+
+void WriteReport(ostream& out, const PerfReport& report) {
+    out << fixed << setprecision(3);
+    out << "{\n";
+    out << "  \"images\": " << report.images << ",\n";
+    out << "  \"failed\": " << report.failed << ",\n";
+    out << "  \"jobs\": " << report.jobs << ",\n";
+    out << "  \"wall_seconds\": " << report.wall_seconds << ",\n";
+    out << "  \"images_per_second\": " << report.images_per_second << ",\n";
+    out << "  \"input_mb_per_second\": " << report.input_mb_per_second << ",\n";
+    out << "  \"output_mb_per_second\": " << report.output_mb_per_second << ",\n";
+    out << "  \"latency_p50_ms\": " << report.latency_p50_ms << ",\n";
+    out << "  \"latency_p99_ms\": " << report.latency_p99_ms << ",\n";
+    out << "  \"latency_mean_ms\": " << report.latency_mean_ms << ",\n";
+    out << "  \"latency_max_ms\": " << report.latency_max_ms << ",\n";
+    out << "  \"peak_rss_bytes\": " << report.peak_rss_bytes << "\n";
+    out << "}\n";
+}
+
+// Число по ключу из отчёта, записанного WriteReport. Полный разбор JSON
+// не нужен: ключи уникальны, а значения - числа
+optional<double> FindNumber(const string& json, string_view key) {
+    const string quoted_key = '"' + string(key) + '"';
+    size_t pos = json.find(quoted_key);
+    if (pos == string::npos) {
+        return nullopt;
+    }
+    pos = json.find_first_not_of(" \t\r\n"sv, pos + quoted_key.size());
+    if (pos == string::npos || json[pos] != ':') {
+        return nullopt;
+    }
+    const char* begin = json.c_str() + pos + 1;
+    char* end = nullptr;
+    const double value = strtod(begin, &end);
+    if (end == begin) {
+        return nullopt;
+    }
+    return value;
+}
+
+// Печатает сравнение в err; true - если ни одна метрика не ухудшилась сверх порога
+optional<bool> CompareWithBaseline(const PerfReport& report, const PerfOptions& options, ostream& err) {
+    ifstream in(options.baseline_file);
+    if (!in) {
+        return nullopt;
+    }
+    ostringstream content;
+    content << in.rdbuf();
+    const string baseline = content.str();
+
+    bool ok = true;
+    err << left << setw(24) << "Metric"sv << right << setw(16) << "Baseline"sv << setw(16) << "Current"sv
+        << setw(10) << "Change"sv << endl;
+    for (const Metric& metric : GetMetrics(report)) {
+        const auto base = FindNumber(baseline, metric.name);
+        if (!base) {
+            return nullopt;
+        }
+        // изменение в процентах, положительное - ухудшение
+        const double change = *base == 0 ? 0 : (metric.value - *base) / *base * 100;
+        const double worse = metric.higher_is_better ? -change : change;
+        const bool regression = worse > options.threshold;
+        ok = ok && !regression;
+
+        err << left << setw(24) << metric.name << right << fixed << setprecision(3) << setw(16) << *base
+            << setw(16) << metric.value << setw(9) << setprecision(1) << showpos << change << noshowpos << '%'
+            << (regression ? "  REGRESSION"sv : ""sv) << endl;
+    }
+    return ok;
+}
+
+}  // namespace
+
+int main(int argc, const char** argv) {
+    int first = 0;
+    const auto perf = ParsePerfOptions(argc, argv, first);
+
+    // остаток разбирается так же, как аргументы imgconv
+    vector<const char*> imgconv_argv = {argv[0]};
+    if (perf) {
+        imgconv_argv.insert(imgconv_argv.end(), argv + first, argv + argc);
+    }
+    const auto cmd = perf ? ParseCommandLine(int(imgconv_argv.size()), imgconv_argv.data()) : nullopt;
+    // конвейер и инкрементальный режим не дают времени отдельного файла
+    if (!cmd || cmd->batch.pipeline || !cmd->incremental.state_file.empty()) {
+        PrintPerfUsage(argv[0]);
+        return EXIT_USAGE;
+    }
+
+    const auto jobs = CollectJobs(*cmd);
+    if (!jobs || jobs->empty()) {
+        cerr << "No jobs to replay"sv << endl;
+        return EXIT_USAGE;
+    }
+
+    unique_ptr<ConversionCache> cache;
+    if (!cmd->cache.dir.empty()) {
+        cache = ConversionCache::Open(cmd->cache);
+        if (!cache) {
+            cerr << "Failed to open the cache directory"sv << endl;
+            return EXIT_USAGE;
+        }
+    }
+
+    img_lib::RecyclingBufferPool buffer_pool;
+    img_lib::ThreadPool pool(cmd->batch.jobs);
+
+    for (int pass = 0; pass < perf->warmup; ++pass) {
+        RunPass(*jobs, *cmd, cache.get(), pool, buffer_pool);
+    }
+
+    vector<JobSample> samples;
+    const auto start = chrono::steady_clock::now();
+    for (int pass = 0; pass < perf->repeat; ++pass) {
+        const vector<JobSample> pass_samples = RunPass(*jobs, *cmd, cache.get(), pool, buffer_pool);
+        samples.insert(samples.end(), pass_samples.begin(), pass_samples.end());
+    }
+    const double wall_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    const PerfReport report = MakeReport(samples, wall_seconds, pool.GetThreadCount());
+    if (perf->json_file.empty()) {
+        WriteReport(cout, report);
+    } else {
+        ofstream json_out(perf->json_file);
+        WriteReport(json_out, report);
+        if (!json_out) {
+            cerr << "Failed to write the report file"sv << endl;
+            return EXIT_USAGE;
+        }
+    }
+
+    if (!perf->baseline_file.empty()) {
+        const auto ok = CompareWithBaseline(report, *perf, cerr);
+        if (!ok) {
+            cerr << "Failed to read the baseline report"sv << endl;
+            return EXIT_USAGE;
+        }
+        if (!*ok) {
+            return EXIT_REGRESSION;
+        }
+    }
+    return report.failed > 0 ? EXIT_CONVERSION_FAILED : 0;
+}
@@ -0,0 +1,165 @@
+// Замеры скорости кодеков ImgLib на синтетических изображениях.
+// Файлы-образцы не нужны: изображения генерируются при запуске,
+// промежуточные файлы пишутся во временный каталог и удаляются в конце.
+//
+//   imglib_bench --benchmark_filter=Load/jpg
+//   imglib_bench --benchmark_format=json > result.json
+
+#include "../converter.h"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+namespace fs = std::filesystem;
+
+const vector<string> EXTENSIONS = {".bmp", ".ppm", ".jpg"};
+
+// ширина и высота: миниатюра, Full HD и 12 Мп кадр фотоаппарата
+const vector<vector<int64_t>> RESOLUTIONS = {{256, 256}, {1920, 1080}, {4000, 3000}};
+
+fs::path GetBenchDir() {
+    static const fs::path dir = fs::temp_directory_path() / "imglib_bench";
+    return dir;
+}
+
+fs::path GetSamplePath(const string& name, int width, int height, const string& ext) {
+    return GetBenchDir() / (name + '_' + to_string(width) + 'x' + to_string(height) + ext);
+}
+
+// Плавный градиент с шумом: однотонная картинка сжималась бы JPEG
+// нереалистично хорошо, а чистый шум - нереалистично плохо
+img_lib::Image MakeSyntheticImage(int width, int height) {
+    img_lib::Image image(width, height, img_lib::PixelFormat::RGBA32, img_lib::FOR_OVERWRITE);
+    uint32_t state = 12345;
+
+    for (int y = 0; y < height; ++y) {
+        img_lib::Color* line = image.GetLine(y);
+        for (int x = 0; x < width; ++x) {
+            state = state * 1664525u + 1013904223u;
+            const int noise = int(state >> 28) - 8;
+            auto channel = [noise](int value) {
+                return std::byte(std::clamp(value + noise, 0, 255));
+            };
+            line[x] = {channel(x * 255 / width), channel(y * 255 / height),
+                       channel((x + y) * 255 / (width + height)), std::byte{255}};
+        }
+    }
+    return image;
+}
+
+// Файл-образец создаётся один раз на разрешение и формат
+fs::path PrepareSample(int width, int height, const string& ext) {
+    const fs::path path = GetSamplePath("sample", width, height, ext);
+    if (!fs::exists(path)) {
+        const img_lib::Image image = MakeSyntheticImage(width, height);
+        img_lib::GetFormatInterfaceByExtension(path)->SaveImage(path, image, {});
+    }
+    return path;
+}
+
+// Скорость в пикселях (M/s - мегапиксели в секунду) и в байтах файла.
+// Для конвертации байты считаются по входному файлу
+void SetThroughput(benchmark::State& state, int width, int height, uintmax_t file_size) {
+    const double iterations = double(state.iterations());
+    state.counters["pixels_per_second"] = benchmark::Counter(double(width) * height * iterations,
+                                                             benchmark::Counter::kIsRate);
+    state.SetBytesProcessed(int64_t(file_size * state.iterations()));
+}
+
+void BM_Load(benchmark::State& state, string ext) {
+    const int width = int(state.range(0));
+    const int height = int(state.range(1));
+    const fs::path path = PrepareSample(width, height, ext);
+    const img_lib::ImageFormatInterface* format = img_lib::GetFormatInterfaceByExtension(path);
+
+    for (auto _ : state) {
+        img_lib::Image image = format->LoadImage(path, {});
+        if (!image) {
+            state.SkipWithError("loading failed");
+            return;
+        }
+        benchmark::DoNotOptimize(image.GetRowData(0));
+    }
+    SetThroughput(state, width, height, fs::file_size(path));
+}
+
+void BM_Save(benchmark::State& state, string ext) {
+    const int width = int(state.range(0));
+    const int height = int(state.range(1));
+    const img_lib::Image image = MakeSyntheticImage(width, height);
+    const fs::path path = GetSamplePath("save", width, height, ext);
+    const img_lib::ImageFormatInterface* format = img_lib::GetFormatInterfaceByExtension(path);
+
+    for (auto _ : state) {
+        if (!format->SaveImage(path, image, {})) {
+            state.SkipWithError("saving failed");
+            return;
+        }
+    }
+    SetThroughput(state, width, height, fs::file_size(path));
+}
+
+// Потоковая конвертация тем же путём, что и в imgconv
+void BM_Convert(benchmark::State& state, string in_ext, string out_ext) {
+    const int width = int(state.range(0));
+    const int height = int(state.range(1));
+    const fs::path in_path = PrepareSample(width, height, in_ext);
+    const fs::path out_path = GetSamplePath("convert", width, height, out_ext);
+
+    for (auto _ : state) {
+        if (ConvertImage(in_path, out_path) != ConvertStatus::OK) {
+            state.SkipWithError("conversion failed");
+            return;
+        }
+    }
+    SetThroughput(state, width, height, fs::file_size(in_path));
+}
+
+void ApplyResolutions(benchmark::internal::Benchmark* bench) {
+    bench->ArgNames({"w", "h"})->Unit(benchmark::kMillisecond);
+    for (const auto& resolution : RESOLUTIONS) {
+        bench->Args(resolution);
+    }
+}
+
+void RegisterBenchmarks() {
+    for (const string& ext : EXTENSIONS) {
+        const string name = ext.substr(1);
+        ApplyResolutions(benchmark::RegisterBenchmark(("Load/" + name).c_str(), BM_Load, ext));
+        ApplyResolutions(benchmark::RegisterBenchmark(("Save/" + name).c_str(), BM_Save, ext));
+    }
+
+    for (const string& in_ext : EXTENSIONS) {
+        for (const string& out_ext : EXTENSIONS) {
+            const string name = "Convert/" + in_ext.substr(1) + "_to_" + out_ext.substr(1);
+            ApplyResolutions(benchmark::RegisterBenchmark(name.c_str(), BM_Convert, in_ext, out_ext));
+        }
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+
+    fs::create_directories(GetBenchDir());
+    RegisterBenchmarks();
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+
+    error_code ec;
+    fs::remove_all(GetBenchDir(), ec);
+}
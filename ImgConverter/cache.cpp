@@ -0,0 +1,226 @@
+#include "cache.h"
+
+#include <hash.h>
+#include <mapped_file.h>
+#include <trace.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <tuple>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+namespace fs = filesystem;
+
+// меняется, если меняется смысл ключа или содержимое записей
+constexpr uint64_t CACHE_VERSION = 1;
+
+constexpr size_t KEY_SIZE = 32;  // два хеша по 16 шестнадцатеричных цифр
+
+bool IsKey(const string& name) {
+    return name.size() == KEY_SIZE
+        && all_of(name.begin(), name.end(), [](char c) {
+               return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f');
+           });
+}
+
+void AppendHex(string& out, uint64_t value) {
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(value));
+    out += hex;
+}
+
+// копия или жёсткая ссылка; при неудаче недописанный to удаляется
+bool CopyOrLink(const fs::path& from, const fs::path& to, bool hardlink) {
+    error_code ec;
+    if (hardlink) {
+        fs::create_hard_link(from, to, ec);
+        if (!ec) {
+            return true;
+        }
+        // например, каталоги на разных файловых системах
+    }
+    fs::copy_file(from, to, fs::copy_options::overwrite_existing, ec);
+    if (ec) {
+        fs::remove(to, ec);
+        return false;
+    }
+    return true;
+}
+
+}  // namespace
+
+unique_ptr<ConversionCache> ConversionCache::Open(const CacheOptions& options) {
+    error_code ec;
+    fs::create_directories(options.dir, ec);
+    if (!fs::is_directory(options.dir, ec)) {
+        return nullptr;
+    }
+
+    unique_ptr<ConversionCache> cache(new ConversionCache(options));
+
+    vector<tuple<fs::file_time_type, string, uintmax_t>> found;
+    const auto stale_before = fs::file_time_type::clock::now() - chrono::hours(1);
+    for (auto it = fs::directory_iterator(options.dir, ec); !ec && it != fs::directory_iterator(); it.increment(ec)) {
+        error_code entry_ec;
+        if (!it->is_regular_file(entry_ec)) {
+            continue;
+        }
+        const string name = it->path().filename().string();
+        const auto mtime = it->last_write_time(entry_ec);
+        if (IsKey(name)) {
+            found.emplace_back(mtime, name, it->file_size(entry_ec));
+        } else if (name.size() > KEY_SIZE && IsKey(name.substr(0, KEY_SIZE)) && !entry_ec && mtime < stale_before) {
+            // временный файл записи, прерванной час назад и раньше
+            fs::remove(it->path(), entry_ec);
+        }
+    }
+    if (ec) {
+        return nullptr;
+    }
+
+    sort(found.begin(), found.end());
+    lock_guard lock(cache->mutex_);
+    for (const auto& [mtime, name, size] : found) {
+        cache->RecordLocked(name, size);
+    }
+    cache->EvictLocked();
+    return cache;
+}
+
+ConversionCache::ConversionCache(const CacheOptions& options)
+    : options_(options)
+    , instance_id_((uint64_t(random_device{}()) << 32) | random_device{}()) {
+}
+
+optional<string> ConversionCache::MakeKey(img_lib::ByteView input, const img_lib::Path& out_path,
+                                          const ConvertOptions& options) {
+    const img_lib::ImageFormatInterface* out_format = img_lib::GetFormatInterfaceByExtension(out_path);
+    if (!out_format) {
+        return nullopt;
+    }
+
+    IMGLIB_TRACE_SCOPE("cache.hash");
+    const string description = to_string(CACHE_VERSION) + ' ' + DescribeConvertOptions(out_format->GetFormat(), options);
+
+    string key;
+    AppendHex(key, img_lib::HashBytes(input));
+    AppendHex(key, img_lib::HashBytes(img_lib::ByteView(description.data(), description.size())));
+    return key;
+}
+
+fs::path ConversionCache::GetEntryPath(const string& key) const {
+    return options_.dir / key;
+}
+
+bool ConversionCache::Fetch(const string& key, const img_lib::Path& out_path) {
+    IMGLIB_TRACE_SCOPE("cache.fetch");
+    // Запись ищется на диске, а не в списке: её мог добавить другой процесс
+    // или вытеснить другой поток, и тогда это просто промах
+    const fs::path entry = GetEntryPath(key);
+    error_code ec;
+    if (!fs::is_regular_file(entry, ec)) {
+        return false;
+    }
+
+    // копия переименовывается поверх выхода, а не пишется в него: выход
+    // может быть жёсткой ссылкой на другую запись или самим входом
+    const fs::path temp = MakeTempOutputPath(out_path);
+    if (!CopyOrLink(entry, temp, options_.hardlink) || !ReplaceWithTemp(temp, out_path)) {
+        return false;
+    }
+
+    fs::last_write_time(entry, fs::file_time_type::clock::now(), ec);
+    const uintmax_t size = fs::file_size(entry, ec);
+
+    lock_guard lock(mutex_);
+    RecordLocked(key, ec ? 0 : size);
+    EvictLocked();
+    return true;
+}
+
+void ConversionCache::Store(const string& key, const img_lib::Path& out_path) {
+    IMGLIB_TRACE_SCOPE("cache.store");
+    string temp_name = key + '.';
+    {
+        lock_guard lock(mutex_);
+        AppendHex(temp_name, instance_id_ + next_temp_++);
+    }
+
+    const fs::path temp = options_.dir / temp_name;
+    if (!CopyOrLink(out_path, temp, options_.hardlink)) {
+        return;
+    }
+
+    error_code ec;
+    const uintmax_t size = fs::file_size(temp, ec);
+    fs::rename(temp, GetEntryPath(key), ec);
+    if (ec) {
+        fs::remove(temp, ec);
+        return;
+    }
+    if (options_.hardlink) {
+        // время изменения у ссылок общее, и запись не должна казаться старой
+        fs::last_write_time(out_path, fs::file_time_type::clock::now(), ec);
+    }
+
+    lock_guard lock(mutex_);
+    RecordLocked(key, size);
+    EvictLocked();
+}
+
+void ConversionCache::RecordLocked(const string& key, uintmax_t size) {
+    const auto it = entries_.find(key);
+    if (it != entries_.end()) {
+        total_size_ -= it->second.size;
+        lru_.erase(it->second.lru_pos);
+    }
+    lru_.push_back(key);
+    entries_[key] = {size, prev(lru_.end())};
+    total_size_ += size;
+}
+
+void ConversionCache::EvictLocked() {
+    while (total_size_ > options_.max_bytes && !lru_.empty()) {
+        const string& key = lru_.front();
+        error_code ec;
+        fs::remove(GetEntryPath(key), ec);
+
+        const auto it = entries_.find(key);
+        total_size_ -= it->second.size;
+        entries_.erase(it);
+        lru_.pop_front();
+    }
+}
+
+ConvertStatus ConvertImageCached(const img_lib::Path& in_path, const img_lib::Path& out_path,
+                                 const ConvertOptions& options, ConversionCache* cache) {
+    if (!cache) {
+        return ConvertImage(in_path, out_path, options);
+    }
+
+    // каналы и другие необычные файлы конвертируются мимо кэша
+    const img_lib::MappedFile input = img_lib::MappedFile::Open(in_path);
+    const auto key = input ? ConversionCache::MakeKey({input.GetData(), input.GetSize()}, out_path, options)
+                           : nullopt;
+    if (!key) {
+        return ConvertImage(in_path, out_path, options);
+    }
+
+    if (cache->Fetch(*key, out_path)) {
+        return ConvertStatus::OK;
+    }
+
+    // выход может быть жёсткой ссылкой на запись кэша от прошлого запуска,
+    // но ConvertImage заменяет его новым файлом и не пишет через ссылку
+    const ConvertStatus status = ConvertImage(in_path, out_path, options);
+    if (status == ConvertStatus::OK) {
+        cache->Store(*key, out_path);
+    }
+    return status;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "converter.h"
+
+#include <memory_buffer.h>
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+struct CacheOptions {
+    img_lib::Path dir;                           // пусто - кэш отключён
+    uintmax_t max_bytes = uintmax_t(1) << 30;    // после записи старые результаты удаляются до этого размера
+    bool hardlink = false;                       // выдавать результаты жёсткими ссылками вместо копий
+};
+
+// Кэш результатов конвертации на диске с адресацией по содержимому:
+// один и тот же входной файл под разными именами конвертируется один раз.
+// Ключ - хеш XXH64 байтов входного файла вместе с форматом выхода
+// и параметрами, от которых зависит результат. Каждый результат хранится
+// отдельным файлом, давность использования - время его изменения, поэтому
+// порядок вытеснения сохраняется между запусками. Методы можно вызывать
+// из нескольких потоков, а один каталог - делить между процессами:
+// записи появляются атомарным переименованием
+class ConversionCache {
+public:
+    // nullptr - если каталог не удалось создать или прочитать
+    static std::unique_ptr<ConversionCache> Open(const CacheOptions& options);
+
+    // nullopt - если формат выхода неизвестен
+    static std::optional<std::string> MakeKey(img_lib::ByteView input, const img_lib::Path& out_path,
+                                              const ConvertOptions& options);
+
+    // Копирует (или связывает) результат с ключом key в out_path.
+    // false - если его нет в кэше или не удалось записать out_path
+    bool Fetch(const std::string& key, const img_lib::Path& out_path);
+
+    // Сохраняет out_path как результат с ключом key и вытесняет
+    // давно не использованные результаты сверх max_bytes. Ошибки кэша
+    // не считаются ошибками конвертации и молча пропускаются
+    void Store(const std::string& key, const img_lib::Path& out_path);
+
+private:
+    explicit ConversionCache(const CacheOptions& options);
+
+    struct Entry {
+        uintmax_t size = 0;
+        std::list<std::string>::iterator lru_pos;
+    };
+
+    img_lib::Path GetEntryPath(const std::string& key) const;
+    // вызываются под mutex_: первая добавляет запись или делает её самой недавней
+    void RecordLocked(const std::string& key, uintmax_t size);
+    void EvictLocked();
+
+    CacheOptions options_;
+    uint64_t instance_id_;  // различает временные файлы разных процессов
+
+    std::mutex mutex_;
+    std::list<std::string> lru_;  // от давно использованных к недавним
+    std::unordered_map<std::string, Entry> entries_;
+    uintmax_t total_size_ = 0;
+    uint64_t next_temp_ = 0;
+};
+
+// ConvertImage через кэш: при попадании результат берётся из кэша,
+// иначе конвертируется и сохраняется в него. Входной файл хешируется
+// через отображение в память, и декодер затем читает его страницы
+// уже из кэша ОС. cache == nullptr - обычный ConvertImage
+ConvertStatus ConvertImageCached(const img_lib::Path& in_path, const img_lib::Path& out_path,
+                                 const ConvertOptions& options, ConversionCache* cache);
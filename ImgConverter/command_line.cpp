@@ -0,0 +1,455 @@
+#include "command_line.h"
+
+#include <iostream>
+#include <string_view>
+
+using namespace std;
+
+namespace {
+
+// целое число не меньше min_value, записанное целиком
+bool ParseInt(string_view text, int min_value, int& value) {
+    try {
+        size_t pos = 0;
+        const int parsed = stoi(string(text), &pos);
+        if (pos != text.size() || parsed < min_value) {
+            return false;
+        }
+        value = parsed;
+    } catch (const exception&) {
+        return false;
+    }
+    return true;
+}
+
+bool ParsePositiveInt(string_view text, int& value) {
+    return ParseInt(text, 1, value);
+}
+
+bool ParseDCTMethod(string_view text, img_lib::JPEGDCTMethod& method) {
+    if (text == "islow"sv) {
+        method = img_lib::JPEGDCTMethod::ISLOW;
+    } else if (text == "ifast"sv) {
+        method = img_lib::JPEGDCTMethod::IFAST;
+    } else if (text == "float"sv) {
+        method = img_lib::JPEGDCTMethod::FLOAT;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Масштаб записывается как "1/N"
+bool ParseScale(string_view text, int& denom) {
+    if (text.substr(0, 2) != "1/"sv) {
+        return false;
+    }
+    if (!ParsePositiveInt(text.substr(2), denom)) {
+        return false;
+    }
+    return denom == 1 || denom == 2 || denom == 4 || denom == 8;
+}
+
+// Размер записывается как "WxH", одна из сторон может быть нулевой
+bool ParseResize(string_view text, img_lib::Size& size) {
+    const size_t x = text.find('x');
+    if (x == string_view::npos) {
+        return false;
+    }
+    if (!ParseInt(text.substr(0, x), 0, size.width) || !ParseInt(text.substr(x + 1), 0, size.height)) {
+        return false;
+    }
+    return size.width > 0 || size.height > 0;
+}
+
+// Область записывается как "WxH+X+Y"
+bool ParseCrop(string_view text, img_lib::Rect& rect) {
+    const size_t x_pos = text.find('+');
+    if (x_pos == string_view::npos) {
+        return false;
+    }
+    const size_t y_pos = text.find('+', x_pos + 1);
+    if (y_pos == string_view::npos) {
+        return false;
+    }
+
+    img_lib::Size size;
+    if (!ParseResize(text.substr(0, x_pos), size) || size.width == 0 || size.height == 0) {
+        return false;
+    }
+    rect.width = size.width;
+    rect.height = size.height;
+    return ParseInt(text.substr(x_pos + 1, y_pos - x_pos - 1), 0, rect.x)
+        && ParseInt(text.substr(y_pos + 1), 0, rect.y);
+}
+
+// "h" - слева направо, "v" - сверху вниз, "hv" - оба
+bool ParseFlip(string_view text, img_lib::ImageOps& ops) {
+    if (text.empty() || text.size() > 2) {
+        return false;
+    }
+    for (char axis : text) {
+        if (axis == 'h') {
+            ops.flip_horizontal = true;
+        } else if (axis == 'v') {
+            ops.flip_vertical = true;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ParseResizeFilter(string_view text, img_lib::ResizeFilter& filter) {
+    if (text == "box"sv) {
+        filter = img_lib::ResizeFilter::BOX;
+    } else if (text == "bilinear"sv) {
+        filter = img_lib::ResizeFilter::BILINEAR;
+    } else if (text == "lanczos3"sv) {
+        filter = img_lib::ResizeFilter::LANCZOS3;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Операция выхода FAN_OUT: "resize=WxH", "filter=F", "crop=WxH+X+Y" или "flip=h|v|hv"
+bool ParseOutputOp(string_view op, img_lib::ImageOps& ops) {
+    const size_t eq = op.find('=');
+    if (eq == string_view::npos) {
+        return false;
+    }
+    const string_view name = op.substr(0, eq);
+    const string_view value = op.substr(eq + 1);
+
+    if (name == "resize"sv) {
+        img_lib::Size size;
+        if (!ParseResize(value, size)) {
+            return false;
+        }
+        ops.resize = size;
+        return true;
+    }
+    if (name == "filter"sv) {
+        return ParseResizeFilter(value, ops.resize_filter);
+    }
+    if (name == "crop"sv) {
+        img_lib::Rect rect;
+        if (!ParseCrop(value, rect)) {
+            return false;
+        }
+        ops.crop = rect;
+        return true;
+    }
+    if (name == "flip"sv) {
+        return ParseFlip(value, ops);
+    }
+    return false;
+}
+
+// Выход FAN_OUT: путь и операции через '@' после имени файла,
+// например "thumb.ppm@resize=160x0@flip=h"
+optional<FanOutput> ParseOutput(string_view text, const img_lib::ImageOps& defaults) {
+    // '@' ищется только в имени файла, в каталогах он допустим
+    const size_t name_start = text.find_last_of("/\\"sv);
+    size_t at = text.find('@', name_start == string_view::npos ? 0 : name_start);
+
+    FanOutput output{img_lib::Path(string(text.substr(0, at))), defaults};
+    if (output.path.empty()) {
+        return nullopt;
+    }
+
+    while (at != string_view::npos) {
+        const size_t next = text.find('@', at + 1);
+        if (!ParseOutputOp(text.substr(at + 1, next == string_view::npos ? string_view::npos : next - at - 1),
+                           output.ops)) {
+            return nullopt;
+        }
+        at = next;
+    }
+    return output;
+}
+
+// режимы, в которых конвертация идёт через кэш результатов
+bool IsCacheMode(RunMode mode) {
+    return mode != RunMode::INFO && mode != RunMode::FAN_OUT;
+}
+
+// Разбирает параметр с индексом i, при необходимости забирая его значение.
+// Возвращает false, если параметр неизвестен или значение некорректно
+bool ParseOption(int argc, const char** argv, int& i, CommandLine& cmd) {
+    const string_view name = argv[i];
+
+    // параметр без значения
+    if (name == "--jpeg-fast-upsampling"sv) {
+        cmd.convert.codec.jpeg_load.fancy_upsampling = false;
+        return true;
+    }
+    if (name == "--pipeline"sv) {
+        if (cmd.mode != RunMode::BATCH && cmd.mode != RunMode::BATCH_DIR) {
+            return false;
+        }
+        cmd.batch.pipeline = true;
+        return true;
+    }
+    if (name == "--delete-orphans"sv) {
+        cmd.incremental.delete_orphans = true;
+        return true;
+    }
+    if (name == "--stats"sv) {
+        cmd.stats = true;
+        return true;
+    }
+    if (name == "--cache-hardlink"sv) {
+        cmd.cache.hardlink = true;
+        return IsCacheMode(cmd.mode);
+    }
+    if (name == "--drop-page-cache"sv) {
+        cmd.convert.codec.file_write.drop_page_cache = true;
+        return true;
+    }
+
+    if (i + 1 == argc) {
+        return false;
+    }
+    const string_view value = argv[++i];
+
+    if (name == "--jobs"sv) {
+        int jobs = 0;
+        if (cmd.mode == RunMode::SINGLE || !ParsePositiveInt(value, jobs)) {
+            return false;
+        }
+        cmd.batch.jobs = static_cast<size_t>(jobs);
+        return true;
+    }
+
+    if (name == "--io-threads"sv) {
+        int io_threads = 0;
+        if (cmd.mode == RunMode::SINGLE || !ParsePositiveInt(value, io_threads)) {
+            return false;
+        }
+        cmd.batch.io_threads = static_cast<size_t>(io_threads);
+        return true;
+    }
+
+    if (name == "--jpeg-quality"sv) {
+        int quality = 0;
+        if (!ParsePositiveInt(value, quality) || quality > 100) {
+            return false;
+        }
+        cmd.convert.codec.jpeg_save.quality = quality;
+        return true;
+    }
+
+    if (name == "--jpeg-dct"sv) {
+        img_lib::JPEGDCTMethod method;
+        if (!ParseDCTMethod(value, method)) {
+            return false;
+        }
+        cmd.convert.codec.jpeg_save.dct_method = method;
+        cmd.convert.codec.jpeg_load.dct_method = method;
+        return true;
+    }
+
+    if (name == "--jpeg-threads"sv) {
+        // 0 - по числу ядер
+        if (!ParseInt(value, 0, cmd.convert.codec.jpeg_save.threads)) {
+            return false;
+        }
+        cmd.convert.codec.jpeg_load.threads = cmd.convert.codec.jpeg_save.threads;
+        return true;
+    }
+
+    if (name == "--jpeg-max-memory"sv) {
+        // размер в МиБ
+        int mib = 0;
+        if (!ParsePositiveInt(value, mib)) {
+            return false;
+        }
+        cmd.convert.codec.jpeg_load.max_memory = size_t(mib) << 20;
+        return true;
+    }
+
+    if (name == "--jpeg-scale"sv) {
+        return ParseScale(value, cmd.convert.codec.jpeg_load.scale_denom);
+    }
+
+    if (name == "--resize"sv) {
+        img_lib::Size size;
+        if (!ParseResize(value, size)) {
+            return false;
+        }
+        cmd.convert.ops.resize = size;
+        return true;
+    }
+
+    if (name == "--crop"sv) {
+        img_lib::Rect rect;
+        if (!ParseCrop(value, rect)) {
+            return false;
+        }
+        cmd.convert.ops.crop = rect;
+        return true;
+    }
+
+    if (name == "--flip"sv) {
+        return ParseFlip(value, cmd.convert.ops);
+    }
+
+    if (name == "--resize-filter"sv) {
+        return ParseResizeFilter(value, cmd.convert.ops.resize_filter);
+    }
+
+    if (name == "--raster-threads"sv) {
+        // 0 - по числу ядер
+        return ParseInt(value, 0, cmd.convert.codec.raster.threads);
+    }
+
+    if (name == "--incremental"sv) {
+        if (cmd.mode != RunMode::BATCH && cmd.mode != RunMode::BATCH_DIR) {
+            return false;
+        }
+        cmd.incremental.state_file = string(value);
+        return true;
+    }
+
+    if (name == "--cache"sv) {
+        cmd.cache.dir = string(value);
+        return IsCacheMode(cmd.mode);
+    }
+
+    if (name == "--cache-size"sv) {
+        // размер в МиБ
+        int mib = 0;
+        if (!ParsePositiveInt(value, mib) || !IsCacheMode(cmd.mode)) {
+            return false;
+        }
+        cmd.cache.max_bytes = uintmax_t(mib) << 20;
+        return true;
+    }
+
+    if (name == "--trace"sv) {
+        cmd.trace_file = value;
+        return true;
+    }
+
+    if (name == "--write-buffer"sv) {
+        // размер в КиБ, не больше 1 ГиБ
+        int kib = 0;
+        if (!ParsePositiveInt(value, kib) || kib > (1 << 20)) {
+            return false;
+        }
+        cmd.convert.codec.file_write.buffer_size = size_t(kib) << 10;
+        return true;
+    }
+
+    return false;
+}
+
+bool IsValidPositionalCount(RunMode mode, size_t count) {
+    switch (mode) {
+        case RunMode::BATCH:
+            return count == 1;
+        case RunMode::BATCH_DIR:
+            return count == 3;
+        case RunMode::INFO:
+            return count >= 1;
+        case RunMode::FAN_OUT:
+            return count >= 2;
+        case RunMode::SERVE:
+            return count == 0;
+        case RunMode::SINGLE:
+        default:
+            return count == 2;
+    }
+}
+
+}  // namespace
+
+optional<CommandLine> ParseCommandLine(int argc, const char** argv) {
+    CommandLine cmd;
+    int first = 1;
+
+    if (argc > 1 && argv[1] == "--batch"sv) {
+        cmd.mode = RunMode::BATCH;
+        first = 2;
+    } else if (argc > 1 && argv[1] == "--batch-dir"sv) {
+        cmd.mode = RunMode::BATCH_DIR;
+        first = 2;
+    } else if (argc > 1 && argv[1] == "--info"sv) {
+        cmd.mode = RunMode::INFO;
+        first = 2;
+    } else if (argc > 1 && argv[1] == "--fan-out"sv) {
+        cmd.mode = RunMode::FAN_OUT;
+        first = 2;
+    } else if (argc > 1 && argv[1] == "--serve"sv) {
+        cmd.mode = RunMode::SERVE;
+        first = 2;
+    }
+
+    for (int i = first; i < argc; ++i) {
+        const string_view arg = argv[i];
+        if (arg.size() > 2 && arg.substr(0, 2) == "--"sv) {
+            if (!ParseOption(argc, argv, i, cmd)) {
+                return nullopt;
+            }
+        } else {
+            cmd.args.emplace_back(arg);
+        }
+    }
+
+    if (!IsValidPositionalCount(cmd.mode, cmd.args.size())) {
+        return nullopt;
+    }
+    if (cmd.incremental.delete_orphans && cmd.incremental.state_file.empty()) {
+        return nullopt;
+    }
+
+    // операции выходов дополняют общие, которые могли идти и после них
+    if (cmd.mode == RunMode::FAN_OUT) {
+        for (size_t i = 1; i < cmd.args.size(); ++i) {
+            auto output = ParseOutput(cmd.args[i], cmd.convert.ops);
+            if (!output) {
+                return nullopt;
+            }
+            cmd.outputs.push_back(move(*output));
+        }
+    }
+    return cmd;
+}
+
+void PrintUsage(const char* exe) {
+    cerr << "Usage: "sv << exe << " <in_file> <out_file> [options]"sv << endl;
+    cerr << "       "sv << exe << " --batch <manifest_file> [batch options] [options]"sv << endl;
+    cerr << "       "sv << exe << " --batch-dir <in_dir> <out_dir> <out_ext> [batch options] [options]"sv << endl;
+    cerr << "       "sv << exe << " --info <file>..."sv << endl;
+    cerr << "       "sv << exe << " --fan-out <in_file> <out_file>[@op]... [--jobs N] [options]"sv << endl;
+    cerr << "       "sv << exe << " --serve [--jobs N] [options]   (jobs as manifest lines on stdin)"sv << endl;
+    cerr << "Fan-out ops, applied to one output on top of the options below:"sv << endl;
+    cerr << "  @resize=WxH @filter=F @crop=WxH+X+Y @flip=h|v|hv"sv << endl;
+    cerr << "Batch options:"sv << endl;
+    cerr << "  --jobs N                convert on N threads (default - all cores)"sv << endl;
+    cerr << "  --pipeline              overlap reading, decoding, encoding and writing of different files"sv << endl;
+    cerr << "  --io-threads N          reading and writing threads of the pipeline (default 2)"sv << endl;
+    cerr << "  --incremental FILE      skip pairs unchanged since the run that wrote the state FILE"sv << endl;
+    cerr << "  --delete-orphans        with --incremental, remove outputs whose inputs are gone"sv << endl;
+    cerr << "Options:"sv << endl;
+    cerr << "  --jpeg-quality N        JPEG quality for saving, 1..100 (default 75)"sv << endl;
+    cerr << "  --jpeg-dct M            DCT method: islow, ifast or float (default islow)"sv << endl;
+    cerr << "  --jpeg-threads N        encode and decode JPEG on N threads, 0 - all cores"sv << endl;
+    cerr << "  --jpeg-fast-upsampling  faster but blockier chroma upsampling when loading JPEG"sv << endl;
+    cerr << "  --jpeg-scale 1/N        decode JPEG scaled down by N = 1, 2, 4 or 8"sv << endl;
+    cerr << "  --jpeg-max-memory N     fail JPEG decodes that need more than N MiB instead of exhausting memory"sv << endl;
+    cerr << "  --crop WxH+X+Y          keep only the W by H area with the top left corner at X, Y"sv << endl;
+    cerr << "  --flip h|v|hv           mirror left to right, top to bottom or both"sv << endl;
+    cerr << "  --resize WxH            scale to W by H pixels, 0 for one side keeps the aspect ratio"sv << endl;
+    cerr << "  --resize-filter F       box, bilinear or lanczos3 (default lanczos3)"sv << endl;
+    cerr << "  --raster-threads N      convert PPM and BMP rows on N threads, 0 - all cores (default 1)"sv << endl;
+    cerr << "  --write-buffer N        PPM and BMP write buffer in KiB (default 1024)"sv << endl;
+    cerr << "  --drop-page-cache       evict written PPM and BMP files from the page cache"sv << endl;
+    cerr << "  --cache DIR             reuse outputs of identical inputs and options stored in DIR"sv << endl;
+    cerr << "  --cache-size N          keep at most N MiB in the cache, dropping least recently used (default 1024)"sv << endl;
+    cerr << "  --cache-hardlink        hardlink outputs to cache entries instead of copying"sv << endl;
+    cerr << "  --stats                 print per-stage time, bytes read and written and peak memory"sv << endl;
+    cerr << "  --trace FILE            write a Chrome trace event JSON file for Perfetto"sv << endl;
+}
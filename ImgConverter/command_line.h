@@ -0,0 +1,42 @@
+#pragma once
+
+#include "batch.h"
+#include "cache.h"
+#include "converter.h"
+#include "fan_out.h"
+#include "incremental.h"
+
+#include <format_interface.h>
+
+#include <optional>
+#include <string>
+#include <vector>
+
+enum class RunMode {
+    SINGLE,     // <in_file> <out_file>
+    BATCH,      // --batch <manifest_file>
+    BATCH_DIR,  // --batch-dir <in_dir> <out_dir> <out_ext>
+    INFO,       // --info <file>...
+    FAN_OUT,    // --fan-out <in_file> <out_file>[@op...]...
+    SERVE,      // --serve, задания читаются из stdin
+};
+
+// Разобранные аргументы imgconv. Необязательные параметры
+// можно указывать в любом месте после режима
+struct CommandLine {
+    RunMode mode = RunMode::SINGLE;
+    std::vector<std::string> args;  // позиционные аргументы режима
+    BatchOptions batch;             // только для пакетных режимов, FAN_OUT и SERVE
+    std::vector<FanOutput> outputs; // выходы FAN_OUT, операции каждого - поверх convert.ops
+    ConvertOptions convert;
+    CacheOptions cache;             // кэш результатов, кроме INFO и FAN_OUT
+    IncrementalOptions incremental; // только для пакетных режимов, пустой state_file - выключено
+    bool stats = false;             // вывести в stderr время стадий и объём ввода-вывода
+    std::string trace_file;         // куда записать трассу Chrome trace event, пусто - не писать
+};
+
+// nullopt - если аргументы не подходят ни к одному режиму
+// или значение какого-то параметра некорректно
+std::optional<CommandLine> ParseCommandLine(int argc, const char** argv);
+
+void PrintUsage(const char* exe);
@@ -0,0 +1,199 @@
+#include "converter.h"
+
+#include <direct_transcode.h>
+#include <trace.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <filesystem>
+#include <random>
+#include <sstream>
+#include <thread>
+
+using namespace std;
+
+string_view GetStatusMessage(ConvertStatus status) {
+    switch (status) {
+        case ConvertStatus::OK:
+            return "Successfully converted"sv;
+        case ConvertStatus::UNKNOWN_INPUT_FORMAT:
+            return "Unknown format of the input file"sv;
+        case ConvertStatus::UNKNOWN_OUTPUT_FORMAT:
+            return "Unknown format of the output file"sv;
+        case ConvertStatus::LOADING_FAILED:
+            return "Loading failed"sv;
+        case ConvertStatus::SAVING_FAILED:
+            return "Saving failed"sv;
+    }
+    return {};
+}
+
+namespace {
+
+// Переводит результат записи во временный файл temp в статус. При построчной
+// записи ошибка может случиться на середине файла, поэтому уже закрытый
+// temp удаляется, а out_path остаётся прежним
+ConvertStatus FinishConversion(img_lib::TranscodeResult result, const img_lib::Path& temp,
+                               const img_lib::Path& out_path) {
+    if (result == img_lib::TranscodeResult::OK) {
+        return ReplaceWithTemp(temp, out_path) ? ConvertStatus::OK : ConvertStatus::SAVING_FAILED;
+    }
+
+    error_code ec;
+    filesystem::remove(temp, ec);
+
+    return result == img_lib::TranscodeResult::READ_FAILED
+        ? ConvertStatus::LOADING_FAILED
+        : ConvertStatus::SAVING_FAILED;
+}
+
+// Загружает кадр целиком, обрабатывает и сохраняет
+ConvertStatus ConvertWholeImage(const img_lib::ImageFormatInterface& in_format, const img_lib::Path& in_path,
+                                const img_lib::ImageFormatInterface& out_format, const img_lib::Path& temp,
+                                const img_lib::Path& out_path, const ConvertOptions& options) {
+    img_lib::Image image = in_format.LoadImage(in_path, GetLoadOptions(options));
+    if (!image) {
+        return ConvertStatus::LOADING_FAILED;
+    }
+
+    image = ProcessImage(move(image), options);
+    if (!image) {
+        // обрезка не поместилась в кадр
+        return ConvertStatus::LOADING_FAILED;
+    }
+    const bool saved = out_format.SaveImage(temp, image, options.codec);
+    return FinishConversion(saved ? img_lib::TranscodeResult::OK : img_lib::TranscodeResult::WRITE_FAILED,
+                            temp, out_path);
+}
+
+}  // namespace
+
+optional<img_lib::Size> GetDecodeMinSize(const img_lib::ImageOps& ops) {
+    // обрезка задана в координатах полного кадра
+    if (!ops.resize || ops.crop) {
+        return nullopt;
+    }
+    // нулевая сторона вычисляется по пропорциям, и декодер её не ограничивает
+    return ops.resize;
+}
+
+img_lib::CodecOptions GetLoadOptions(const img_lib::CodecOptions& codec, optional<img_lib::Size> min_size) {
+    img_lib::CodecOptions result = codec;
+    if (min_size) {
+        result.jpeg_load.min_size = *min_size;
+    }
+    return result;
+}
+
+img_lib::CodecOptions GetLoadOptions(const ConvertOptions& options) {
+    return GetLoadOptions(options.codec, GetDecodeMinSize(options.ops));
+}
+
+img_lib::Image ProcessImage(img_lib::Image image, const ConvertOptions& options) {
+    const img_lib::ImageOps& ops = options.ops;
+    if (ops.IsEmpty() || !image) {
+        return image;
+    }
+
+    if (!ops.crop && !ops.flip_horizontal && !ops.flip_vertical) {
+        const img_lib::Size size = img_lib::GetResizeTarget({image.GetWidth(), image.GetHeight()}, *ops.resize);
+        if (size.width == image.GetWidth() && size.height == image.GetHeight()) {
+            // например, JPEG уже декодирован ровно до нужного размера
+            return image;
+        }
+    }
+    return img_lib::ApplyImageOps(image, ops, options.codec.raster);
+}
+
+// Число потоков кодирования JPEG меняет расстановку маркеров перезапуска,
+// а потоки декодирования и растровых операций на результат не влияют
+string DescribeConvertOptions(img_lib::FileFormat out_format, const ConvertOptions& options) {
+    const img_lib::JPEGSaveOptions& save = options.codec.jpeg_save;
+    const img_lib::JPEGLoadOptions& load = options.codec.jpeg_load;
+    const img_lib::ImageOps& ops = options.ops;
+
+    const int save_threads = save.threads > 0 ? save.threads : int(max(1u, thread::hardware_concurrency()));
+
+    ostringstream out;
+    out << img_lib::GetFileFormatName(out_format);
+    if (out_format == img_lib::FileFormat::JPEG) {
+        out << " q" << save.quality << " d" << int(save.dct_method) << " t" << save_threads;
+    }
+    out << " ld" << int(load.dct_method) << " u" << load.fancy_upsampling << " s" << load.scale_denom
+        << " m" << load.min_size.width << 'x' << load.min_size.height;
+    if (ops.crop) {
+        out << " c" << ops.crop->width << 'x' << ops.crop->height << '+' << ops.crop->x << '+' << ops.crop->y;
+    }
+    out << " f" << ops.flip_horizontal << ops.flip_vertical;
+    if (ops.resize) {
+        out << " r" << ops.resize->width << 'x' << ops.resize->height << ' ' << int(ops.resize_filter);
+    }
+    return out.str();
+}
+
+img_lib::Path MakeTempOutputPath(const img_lib::Path& out_path) {
+    // случайная часть различает процессы, счётчик - вызовы внутри процесса
+    static const uint64_t instance_id = (uint64_t(random_device{}()) << 32) | random_device{}();
+    static atomic<uint64_t> next_temp{0};
+
+    char suffix[24];
+    snprintf(suffix, sizeof(suffix), ".%016llx.tmp", static_cast<unsigned long long>(instance_id + next_temp++));
+    img_lib::Path temp = out_path;
+    temp += suffix;
+    return temp;
+}
+
+bool ReplaceWithTemp(const img_lib::Path& temp, const img_lib::Path& out_path) {
+    error_code ec;
+    filesystem::rename(temp, out_path, ec);
+    if (ec) {
+        filesystem::remove(temp, ec);
+        return false;
+    }
+    return true;
+}
+
+ConvertStatus ConvertImage(const img_lib::Path& in_path, const img_lib::Path& out_path,
+                           const ConvertOptions& options) {
+    IMGLIB_TRACE_SCOPE("convert");
+    // по содержимому, чтобы файл с неверным расширением не попал не в тот декодер
+    const img_lib::ImageFormatInterface* in_format = img_lib::DetectFormatInterface(in_path);
+    if (!in_format) {
+        return ConvertStatus::UNKNOWN_INPUT_FORMAT;
+    }
+
+    const img_lib::ImageFormatInterface* out_format = img_lib::GetFormatInterfaceByExtension(out_path);
+    if (!out_format) {
+        return ConvertStatus::UNKNOWN_OUTPUT_FORMAT;
+    }
+
+    const img_lib::Path temp = MakeTempOutputPath(out_path);
+    if (!options.ops.IsEmpty()) {
+        return ConvertWholeImage(*in_format, in_path, *out_format, temp, out_path, options);
+    }
+
+    const img_lib::CodecOptions& codec = options.codec;
+
+    // пары форматов с одинаковыми пикселями конвертируются напрямую, без кадра и полос
+    if (const auto transcoder = img_lib::FindDirectTranscoder(in_format->GetFormat(), out_format->GetFormat())) {
+        if (const auto result = transcoder(in_path, temp, codec.file_write, codec.raster)) {
+            return FinishConversion(*result, temp, out_path);
+        }
+    }
+
+    auto reader = in_format->OpenReader(in_path, codec);
+    if (!reader) {
+        return ConvertStatus::LOADING_FAILED;
+    }
+
+    auto writer = out_format->CreateWriter(temp, reader->GetSize(), codec);
+    if (!writer) {
+        return ConvertStatus::SAVING_FAILED;
+    }
+
+    const img_lib::TranscodeResult result = img_lib::TranscodeStream(*reader, *writer);
+    // выходной файл должен быть закрыт до переименования или удаления
+    writer.reset();
+    return FinishConversion(result, temp, out_path);
+}
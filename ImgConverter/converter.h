@@ -0,0 +1,63 @@
+#pragma once
+
+#include <format_interface.h>
+#include <img_lib.h>
+#include <image_ops.h>
+
+#include <optional>
+#include <string>
+#include <string_view>
+
+// Результат конвертации одного файла. Значения совпадают с кодами
+// возврата imgconv, поэтому их можно сразу возвращать из main()
+enum class ConvertStatus {
+    OK = 0,
+    UNKNOWN_INPUT_FORMAT = 2,
+    UNKNOWN_OUTPUT_FORMAT = 3,
+    LOADING_FAILED = 4,
+    SAVING_FAILED = 5,
+};
+
+std::string_view GetStatusMessage(ConvertStatus status);
+
+// Параметры конвертации: кодеков и обработки кадра между загрузкой и сохранением
+struct ConvertOptions {
+    img_lib::CodecOptions codec;
+    img_lib::ImageOps ops;
+};
+
+// Наименьший размер кадра, которого хватает для ops (нулевая сторона
+// не ограничивает): до него JPEG можно уменьшить прямо при декодировании.
+// nullopt - кадр нужен целиком, например, для обрезки или без изменения размера
+std::optional<img_lib::Size> GetDecodeMinSize(const img_lib::ImageOps& ops);
+
+// Параметры загрузки: JPEG сразу декодируется уменьшенным в 2, 4 или 8 раз,
+// насколько позволяет min_size
+img_lib::CodecOptions GetLoadOptions(const img_lib::CodecOptions& codec, std::optional<img_lib::Size> min_size);
+img_lib::CodecOptions GetLoadOptions(const ConvertOptions& options);
+
+// Обрабатывает загруженный кадр; без операций возвращает его как есть
+img_lib::Image ProcessImage(img_lib::Image image, const ConvertOptions& options);
+
+// Строка из формата выхода и всех параметров, от которых зависят байты
+// результата: одинаковые строки дают одинаковый выходной файл из одного входа
+std::string DescribeConvertOptions(img_lib::FileFormat out_format, const ConvertOptions& options);
+
+// Имя временного файла в каталоге out_path, уникальное для процесса и вызова.
+// Результат пишется в него и переименовывается поверх out_path только после
+// успешной записи. Поэтому вход, совпадающий с выходом, читается до конца,
+// прежний выход остаётся целым при ошибке, а жёсткая ссылка на запись
+// кэша заменяется, а не перезаписывается
+img_lib::Path MakeTempOutputPath(const img_lib::Path& out_path);
+
+// Переименовывает записанный temp в out_path; при неудаче temp удаляется
+bool ReplaceWithTemp(const img_lib::Path& temp, const img_lib::Path& out_path);
+
+// Конвертирует файл построчно через ImageReader/ImageWriter,
+// не загружая изображение в память целиком, а для пар форматов с прямым
+// преобразованием (см. FindDirectTranscoder) - минуя и полосы. С операциями
+// над кадром он загружается целиком. Формат входного файла определяется
+// по содержимому, выходного - по расширению. Выход пишется через
+// MakeTempOutputPath, так что in_path может совпадать с out_path
+ConvertStatus ConvertImage(const img_lib::Path& in_path, const img_lib::Path& out_path,
+                           const ConvertOptions& options = {});
@@ -0,0 +1,151 @@
+#include "fan_out.h"
+
+#include <thread_pool.h>
+#include <trace.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string_view>
+
+using namespace std;
+
+namespace {
+
+// Размер, до которого можно уменьшить кадр при декодировании так,
+// чтобы его хватило всем выходам
+optional<img_lib::Size> GetCommonDecodeMinSize(const vector<FanOutput>& outputs) {
+    img_lib::Size result = {0, 0};
+    for (const FanOutput& output : outputs) {
+        const auto min_size = GetDecodeMinSize(output.ops);
+        if (!min_size) {
+            return nullopt;
+        }
+        result.width = max(result.width, min_size->width);
+        result.height = max(result.height, min_size->height);
+    }
+    return result;
+}
+
+// выходы с одинаковыми операциями, по индексам в outputs
+vector<vector<size_t>> GroupByOps(const vector<FanOutput>& outputs) {
+    vector<vector<size_t>> groups;
+    for (size_t i = 0; i < outputs.size(); ++i) {
+        auto group = find_if(groups.begin(), groups.end(), [&](const vector<size_t>& g) {
+            return outputs[g.front()].ops == outputs[i].ops;
+        });
+        if (group == groups.end()) {
+            groups.push_back({i});
+        } else {
+            group->push_back(i);
+        }
+    }
+    return groups;
+}
+
+}  // namespace
+
+ConvertStatus ConvertFanOut(const img_lib::Path& in_path, const vector<FanOutput>& outputs,
+                            const img_lib::CodecOptions& codec, size_t jobs, ostream& err) {
+    IMGLIB_TRACE_SCOPE("fan_out");
+    vector<ConvertStatus> results(outputs.size(), ConvertStatus::OK);
+    vector<const img_lib::ImageFormatInterface*> out_formats(outputs.size());
+
+    // неизвестное расширение выхода видно до декодирования
+    for (size_t i = 0; i < outputs.size(); ++i) {
+        out_formats[i] = img_lib::GetFormatInterfaceByExtension(outputs[i].path);
+        if (!out_formats[i]) {
+            results[i] = ConvertStatus::UNKNOWN_OUTPUT_FORMAT;
+        }
+    }
+
+    const img_lib::ImageFormatInterface* in_format = img_lib::DetectFormatInterface(in_path);
+    if (!in_format) {
+        err << in_path.string() << ": "sv << GetStatusMessage(ConvertStatus::UNKNOWN_INPUT_FORMAT) << endl;
+        return ConvertStatus::UNKNOWN_INPUT_FORMAT;
+    }
+
+    const img_lib::Image image = in_format->LoadImage(in_path, GetLoadOptions(codec, GetCommonDecodeMinSize(outputs)));
+    if (!image) {
+        err << in_path.string() << ": "sv << GetStatusMessage(ConvertStatus::LOADING_FAILED) << endl;
+        return ConvertStatus::LOADING_FAILED;
+    }
+
+    {
+        img_lib::ThreadPool pool(min(jobs > 0 ? jobs : size_t(thread::hardware_concurrency()), outputs.size()));
+
+        // Исключения не выходят из задач пула: иначе bad_alloc на одном
+        // большом выходе завершил бы всю программу, а не только этот выход
+        auto save = [&](size_t i, const img_lib::ImageView& view) {
+            // через временный файл, как и в ConvertImage: при ошибке прежний выход цел
+            const img_lib::Path temp = MakeTempOutputPath(outputs[i].path);
+            bool saved = false;
+            try {
+                saved = out_formats[i]->SaveImage(temp, view, codec);
+            } catch (const exception&) {
+                // например, bad_alloc на буферах кодека
+            }
+            if (!saved) {
+                error_code ec;
+                filesystem::remove(temp, ec);
+            }
+            if (!saved || !ReplaceWithTemp(temp, outputs[i].path)) {
+                results[i] = ConvertStatus::SAVING_FAILED;
+            }
+        };
+
+        for (const vector<size_t>& group : GroupByOps(outputs)) {
+            pool.Submit([&, group] {
+                const img_lib::ImageOps& ops = outputs[group.front()].ops;
+                // без операций выходы сохраняют сам декодированный кадр
+                shared_ptr<const img_lib::Image> processed;
+                if (!ops.IsEmpty()) {
+                    try {
+                        processed = make_shared<img_lib::Image>(img_lib::ApplyImageOps(image, ops, codec.raster));
+                    } catch (const exception&) {
+                        // например, bad_alloc на обработанном кадре
+                        processed.reset();
+                    }
+                    if (!processed || !*processed) {
+                        for (size_t i : group) {
+                            results[i] = ConvertStatus::LOADING_FAILED;  // обрезка не поместилась в кадр или не хватило памяти
+                        }
+                        return;
+                    }
+                }
+                const img_lib::ImageView view = processed ? img_lib::ImageView(*processed) : image;
+
+                // остальные выходы группы кодируются на свободных потоках, первый - здесь
+                for (size_t k = 1; k < group.size(); ++k) {
+                    if (out_formats[group[k]]) {
+                        try {
+                            pool.Submit([&save, processed, view, i = group[k]] {
+                                save(i, view);
+                            });
+                        } catch (const exception&) {
+                            // задачу не удалось поставить в очередь - выход кодируется здесь
+                            save(group[k], view);
+                        }
+                    }
+                }
+                if (out_formats[group.front()]) {
+                    save(group.front(), view);
+                }
+            });
+        }
+        pool.Wait();
+    }
+
+    ConvertStatus first_failure = ConvertStatus::OK;
+    for (size_t i = 0; i < outputs.size(); ++i) {
+        if (results[i] != ConvertStatus::OK) {
+            err << outputs[i].path.string() << ": "sv << GetStatusMessage(results[i]) << endl;
+            if (first_failure == ConvertStatus::OK) {
+                first_failure = results[i];
+            }
+        }
+    }
+    return first_failure;
+}
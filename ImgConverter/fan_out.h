@@ -0,0 +1,22 @@
+#pragma once
+
+#include "converter.h"
+
+#include <cstddef>
+#include <ostream>
+#include <vector>
+
+// Один выход конвертации с разветвлением: файл и операции над кадром
+// перед его сохранением
+struct FanOutput {
+    img_lib::Path path;
+    img_lib::ImageOps ops;
+};
+
+// Декодирует in_path один раз и сохраняет кадр во все outputs, каждый
+// со своими операциями. Выходы с одинаковыми операциями сохраняют один
+// и тот же обработанный кадр, обработка и кодирование разных выходов идут
+// одновременно на jobs потоках (0 - по числу ядер). Ошибки выходов
+// сообщаются в err, результатом становится статус первого неудачного выхода
+ConvertStatus ConvertFanOut(const img_lib::Path& in_path, const std::vector<FanOutput>& outputs,
+                            const img_lib::CodecOptions& codec, size_t jobs, std::ostream& err);
@@ -0,0 +1,302 @@
+#include "incremental.h"
+
+#include <hash.h>
+#include <mapped_file.h>
+#include <thread_pool.h>
+#include <trace.h>
+
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+
+using namespace std;
+
+namespace {
+
+namespace fs = filesystem;
+
+constexpr string_view STATE_HEADER = "# imgconv incremental state 2"sv;
+// в первой версии не было времени изменения выхода
+constexpr string_view STATE_HEADER_V1 = "# imgconv incremental state 1"sv;
+
+// Размер и время изменения файла на момент проверки
+struct FileInfo {
+    uintmax_t size = 0;
+    int64_t mtime = 0;
+};
+
+optional<FileInfo> GetFileInfo(const fs::path& file) {
+    error_code ec;
+    const uintmax_t size = fs::file_size(file, ec);
+    if (ec) {
+        return nullopt;
+    }
+    const auto mtime = fs::last_write_time(file, ec);
+    if (ec) {
+        return nullopt;
+    }
+    return FileInfo{size, static_cast<int64_t>(mtime.time_since_epoch().count())};
+}
+
+// nullopt - если файл не удалось отобразить, например, это не обычный файл
+optional<uint64_t> HashFile(const fs::path& file) {
+    IMGLIB_TRACE_SCOPE("incremental.hash");
+    const img_lib::MappedFile mapped = img_lib::MappedFile::Open(file);
+    if (!mapped) {
+        return nullopt;
+    }
+    return img_lib::HashBytes({mapped.GetData(), mapped.GetSize()});
+}
+
+// Проверка задания: актуально ли оно и что о нём записать после конвертации
+struct JobCheck {
+    bool up_to_date = false;
+    optional<IncrementalRecord> record;  // nullopt - вход не прочитать, задание в состояние не попадёт
+};
+
+JobCheck CheckJob(const ConvertJob& job, const IncrementalRecord* previous, uint64_t options_hash) {
+    JobCheck check;
+    const auto info = GetFileInfo(job.in_path);
+    if (!info) {
+        return check;
+    }
+
+    IncrementalRecord record{job.in_path, job.out_path, info->size, info->mtime, 0, options_hash, 0, 0};
+
+    const bool same_job = previous && previous->in_path == job.in_path
+        && previous->options_hash == options_hash && previous->in_size == info->size;
+    if (same_job) {
+        // выход, перезаписанный чем-то того же размера, выдаёт время изменения
+        const auto out_info = GetFileInfo(job.out_path);
+        const bool output_intact = out_info && out_info->size == previous->out_size
+            && out_info->mtime == previous->out_mtime;
+
+        // время изменения совпало - содержимое не читается вовсе
+        if (output_intact && previous->in_mtime == info->mtime) {
+            check.up_to_date = true;
+            check.record = *previous;
+            return check;
+        }
+
+        const auto hash = HashFile(job.in_path);
+        if (!hash) {
+            return check;
+        }
+        record.in_hash = *hash;
+        // файл перезаписали тем же содержимым
+        check.up_to_date = output_intact && *hash == previous->in_hash;
+        if (check.up_to_date) {
+            record.out_size = out_info->size;
+            record.out_mtime = out_info->mtime;
+        }
+        check.record = record;
+        return check;
+    }
+
+    const auto hash = HashFile(job.in_path);
+    if (hash) {
+        record.in_hash = *hash;
+        check.record = record;
+    }
+    return check;
+}
+
+}  // namespace
+
+optional<IncrementalState> IncrementalState::Load(const img_lib::Path& file) {
+    IncrementalState state;
+    error_code ec;
+    if (!fs::exists(file, ec)) {
+        return ec ? nullopt : optional(state);
+    }
+
+    ifstream in(file);
+    string line;
+    if (!in || !getline(in, line) || (line != STATE_HEADER && line != STATE_HEADER_V1)) {
+        return nullopt;
+    }
+    const bool has_out_mtime = line == STATE_HEADER;
+
+    while (getline(in, line)) {
+        if (line.empty()) {
+            continue;
+        }
+        istringstream line_in(line);
+        string in_path, out_path;
+        IncrementalRecord record;
+        line_in >> quoted(in_path) >> quoted(out_path) >> record.in_size >> record.in_mtime
+            >> hex >> record.in_hash >> record.options_hash >> dec >> record.out_size;
+        if (has_out_mtime) {
+            line_in >> record.out_mtime;
+        } else {
+            // время выхода неизвестно: такой выход один раз конвертируется заново
+            record.out_mtime = numeric_limits<int64_t>::min();
+        }
+        if (!line_in) {
+            return nullopt;
+        }
+        record.in_path = in_path;
+        record.out_path = out_path;
+        state.Set(move(record));
+    }
+    if (in.bad()) {
+        return nullopt;
+    }
+    return state;
+}
+
+bool IncrementalState::Save(const img_lib::Path& file) const {
+    fs::path temp = file;
+    temp += ".tmp";
+    {
+        ofstream out(temp);
+        out << STATE_HEADER << '\n';
+        for (const auto& [key, record] : records_) {
+            out << quoted(record.in_path.string()) << ' ' << quoted(record.out_path.string()) << ' '
+                << record.in_size << ' ' << record.in_mtime << ' '
+                << hex << record.in_hash << ' ' << record.options_hash << dec << ' ' << record.out_size << ' '
+                << record.out_mtime << '\n';
+        }
+        if (!out.flush()) {
+            return false;
+        }
+    }
+
+    error_code ec;
+    fs::rename(temp, file, ec);
+    if (ec) {
+        fs::remove(temp, ec);
+        return false;
+    }
+    return true;
+}
+
+const IncrementalRecord* IncrementalState::Find(const img_lib::Path& out_path) const {
+    const auto it = records_.find(out_path.generic_string());
+    return it == records_.end() ? nullptr : &it->second;
+}
+
+void IncrementalState::Set(IncrementalRecord record) {
+    string key = record.out_path.generic_string();
+    records_[move(key)] = move(record);
+}
+
+void IncrementalState::Remove(const img_lib::Path& out_path) {
+    records_.erase(out_path.generic_string());
+}
+
+ConvertStatus RunIncremental(const vector<ConvertJob>& jobs, const IncrementalOptions& incremental,
+                             const BatchOptions& batch, const ConvertOptions& options,
+                             ostream& out, ostream& err) {
+    auto state = IncrementalState::Load(incremental.state_file);
+    if (!state) {
+        err << "Failed to read the incremental state file"sv << endl;
+        return ConvertStatus::LOADING_FAILED;
+    }
+
+    // проверки независимы, а хеширование изменённых файлов стоит
+    // прохода по ним, поэтому они идут на потоках пакетного режима
+    vector<JobCheck> checks(jobs.size());
+    {
+        IMGLIB_TRACE_SCOPE("incremental.check");
+        img_lib::ThreadPool pool(batch.jobs);
+        for (size_t i = 0; i < jobs.size(); ++i) {
+            pool.Submit([&, i] {
+                const ConvertJob& job = jobs[i];
+                const img_lib::ImageFormatInterface* out_format = img_lib::GetFormatInterfaceByExtension(job.out_path);
+                // с неизвестным форматом выхода задание завершится ошибкой в ConvertJobs
+                if (out_format) {
+                    const string description = DescribeConvertOptions(out_format->GetFormat(), options);
+                    const uint64_t options_hash = img_lib::HashBytes({description.data(), description.size()});
+                    checks[i] = CheckJob(job, state->Find(job.out_path), options_hash);
+                }
+            });
+        }
+        pool.Wait();
+    }
+
+    vector<ConvertJob> stale_jobs;
+    vector<size_t> stale_indices;
+    IncrementalState next;
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        if (checks[i].up_to_date) {
+            next.Set(*checks[i].record);
+        } else {
+            stale_jobs.push_back(jobs[i]);
+            stale_indices.push_back(i);
+        }
+    }
+
+    // Осиротевшие выходы: их входы удалены. Запись без задания в этом запуске,
+    // чей вход на месте, принадлежит другому набору пар (например, другому
+    // --batch-dir с тем же файлом состояния) и переносится как есть
+    size_t orphans = 0;
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        state->Remove(jobs[i].out_path);
+    }
+    for (const auto& [key, record] : state->GetRecords()) {
+        error_code ec;
+        // при ошибке проверки вход считается существующим: удалять выход наугад нельзя
+        if (fs::exists(record.in_path, ec) || ec) {
+            next.Set(record);
+            continue;
+        }
+        if (!fs::exists(record.out_path, ec)) {
+            continue;
+        }
+        ++orphans;
+        if (incremental.delete_orphans) {
+            fs::remove(record.out_path, ec);
+            err << "Removed orphaned output "sv << record.out_path.string() << endl;
+        } else {
+            // запись остаётся, чтобы выход можно было удалить следующим запуском
+            err << "Orphaned output "sv << record.out_path.string() << " (input "sv << record.in_path.string()
+                << ')' << endl;
+            next.Set(record);
+        }
+    }
+
+    const vector<ConvertStatus> results = ConvertJobs(stale_jobs, batch, options, err);
+
+    size_t converted = 0;
+    ConvertStatus first_failure = ConvertStatus::OK;
+    for (size_t k = 0; k < stale_jobs.size(); ++k) {
+        const JobCheck& check = checks[stale_indices[k]];
+        if (results[k] != ConvertStatus::OK) {
+            if (first_failure == ConvertStatus::OK) {
+                first_failure = results[k];
+            }
+            continue;
+        }
+        ++converted;
+        if (check.record) {
+            IncrementalRecord record = *check.record;
+            if (const auto out_info = GetFileInfo(record.out_path)) {
+                record.out_size = out_info->size;
+                record.out_mtime = out_info->mtime;
+                next.Set(move(record));
+            }
+        }
+    }
+
+    if (!next.Save(incremental.state_file)) {
+        err << "Failed to write the incremental state file"sv << endl;
+        if (first_failure == ConvertStatus::OK) {
+            first_failure = ConvertStatus::SAVING_FAILED;
+        }
+    }
+
+    out << "Converted "sv << converted;
+    if (converted != stale_jobs.size()) {
+        out << " of "sv << stale_jobs.size();
+    }
+    out << " files, "sv << jobs.size() - stale_jobs.size() << " up to date"sv;
+    if (orphans > 0) {
+        out << ", "sv << orphans << (incremental.delete_orphans ? " orphaned outputs removed"sv
+                                                                 : " orphaned outputs"sv);
+    }
+    out << endl;
+    return first_failure;
+}
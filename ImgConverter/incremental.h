@@ -0,0 +1,65 @@
+#pragma once
+
+#include "batch.h"
+#include "converter.h"
+
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Что было известно о задании после его последней успешной конвертации
+struct IncrementalRecord {
+    img_lib::Path in_path;
+    img_lib::Path out_path;
+    uintmax_t in_size = 0;
+    int64_t in_mtime = 0;       // время изменения входа в единицах file_time_type
+    uint64_t in_hash = 0;       // XXH64 содержимого входа
+    uint64_t options_hash = 0;  // XXH64 от DescribeConvertOptions
+    uintmax_t out_size = 0;
+    int64_t out_mtime = 0;      // время изменения выхода сразу после конвертации
+};
+
+// Файл состояния инкрементальной конвертации: по записи на выходной файл
+class IncrementalState {
+public:
+    // Пустое состояние, если файла ещё нет.
+    // nullopt - если файл есть, но прочитать или разобрать его не удалось
+    static std::optional<IncrementalState> Load(const img_lib::Path& file);
+
+    // Записывает состояние через временный файл и переименование,
+    // чтобы прерванный запуск не оставил испорченного состояния
+    bool Save(const img_lib::Path& file) const;
+
+    const IncrementalRecord* Find(const img_lib::Path& out_path) const;
+    void Set(IncrementalRecord record);
+    void Remove(const img_lib::Path& out_path);
+
+    const std::unordered_map<std::string, IncrementalRecord>& GetRecords() const {
+        return records_;
+    }
+
+private:
+    // ключ - out_path.generic_string()
+    std::unordered_map<std::string, IncrementalRecord> records_;
+};
+
+struct IncrementalOptions {
+    img_lib::Path state_file;
+    bool delete_orphans = false;  // удалять выходы, чьих входов больше нет, а не только сообщать о них
+};
+
+// Пакетная конвертация, которая, как make, пропускает актуальные задания:
+// у выхода те же размер и время изменения, а вход и параметры те же, что при прошлой
+// конвертации. Вход считается прежним, если у него те же размер и время
+// изменения, а если изменилось только время - то же содержимое (хеш).
+// Выходы из состояния, которых нет среди jobs и чьих входов больше нет,
+// считаются осиротевшими: о них сообщается в err, а с delete_orphans они
+// удаляются. Остальные записи без заданий (например, другого каталога с тем же
+// файлом состояния) сохраняются без изменений. Неудачные задания в состояние не попадают и при следующем
+// запуске выполняются снова. Результат - статус первого неудачного задания
+ConvertStatus RunIncremental(const std::vector<ConvertJob>& jobs, const IncrementalOptions& incremental,
+                             const BatchOptions& batch, const ConvertOptions& options,
+                             std::ostream& out, std::ostream& err);
@@ -1,128 +1,184 @@
-#include <img_lib.h>
-#include <jpeg_image.h>
-#include <ppm_image.h>
-#include "bmp_image.h"
+#include "converter.h"
+#include "batch.h"
+#include "cache.h"
+#include "command_line.h"
+#include "fan_out.h"
+#include "incremental.h"
+#include "server.h"
 
+#include <trace.h>
+
+#include <chrono>
 #include <filesystem>
+#include <fstream>
+#include <iomanip>
 #include <string_view>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
 
 using namespace std;
 
-enum Format {
-    JPEG,
-    PPM,
-    UNKNOWN,
-    BMP, 
-};
-
+// Печатает размеры и формат каждого файла, читая только заголовки
+ConvertStatus PrintInfo(const vector<string>& files) {
+    ConvertStatus first_failure = ConvertStatus::OK;
+
+    for (const string& file : files) {
+        const img_lib::Path path = file;
+        ConvertStatus status = ConvertStatus::OK;
+        optional<img_lib::ImageInfo> info;
+
+        if (const img_lib::ImageFormatInterface* format = img_lib::DetectFormatInterface(path)) {
+            info = format->Probe(path);
+            if (!info) {
+                status = ConvertStatus::LOADING_FAILED;
+            }
+        } else {
+            status = ConvertStatus::UNKNOWN_INPUT_FORMAT;
+        }
+
+        if (info) {
+            cout << file << ": "sv << img_lib::GetFileFormatName(info->format) << ' '
+                 << info->size.width << 'x' << info->size.height << ", "sv
+                 << info->channels << " channels, "sv << info->bits_per_channel << " bits per channel"sv << endl;
+        } else {
+            cerr << file << ": "sv << GetStatusMessage(status) << endl;
+            if (first_failure == ConvertStatus::OK) {
+                first_failure = status;
+            }
+        }
+    }
 
-class ImageFormatInterface {
-public:
-    virtual bool SaveImage(const img_lib::Path& file, const img_lib::Image& image) const = 0;
-    virtual img_lib::Image LoadImage(const img_lib::Path& file) const = 0;
-};
+    return first_failure;
+}
 
-class ImagePPM : public ImageFormatInterface {
-public:
-    bool SaveImage(const img_lib::Path& file, const img_lib::Image& image) const override {
-        return img_lib::SavePPM(file, image);
-    }
-    
-    img_lib::Image LoadImage(const img_lib::Path& file) const override {
-        return img_lib::LoadPPM(file);
+// Время стадий, объём ввода-вывода и пиковая память после работы, в stderr
+void PrintStats() {
+    if (!img_lib::IsTracingCompiled()) {
+        cerr << "Stage timing is not available: ImgLib is built with IMGLIB_TRACING=OFF"sv << endl;
+    } else {
+        const img_lib::TraceStats stats = img_lib::GetTraceStats();
+        cerr << left << setw(24) << "Stage"sv << right << setw(10) << "Calls"sv << setw(14) << "Total ms"sv << endl;
+        for (const img_lib::TraceStageStats& stage : stats.stages) {
+            cerr << left << setw(24) << stage.name << right << setw(10) << stage.calls
+                 << setw(14) << fixed << setprecision(3)
+                 << chrono::duration<double, milli>(stage.total).count() << endl;
+        }
+        cerr << "Bytes read:    "sv << stats.bytes_read << endl;
+        cerr << "Bytes written: "sv << stats.bytes_written << endl;
     }
-};
+    cerr << "Peak RSS:      "sv << img_lib::GetPeakRSS() / 1024 << " KiB"sv << endl;
+}
 
-class ImageJPEG : public ImageFormatInterface {
-public:
-    bool SaveImage(const img_lib::Path& file, const img_lib::Image& image) const override {
-        return img_lib::SaveJPEG(file, image);
-    }
-    
-    img_lib::Image LoadImage(const img_lib::Path& file) const override {
-        return img_lib::LoadJPEG(file);
+int Run(const CommandLine& cmd) {
+    IMGLIB_TRACE_SCOPE("imgconv");
+
+    if (cmd.mode == RunMode::INFO) {
+        return static_cast<int>(PrintInfo(cmd.args));
     }
-};
 
-class ImageBMP : public ImageFormatInterface {
-public:
-    bool SaveImage(const img_lib::Path& file, const img_lib::Image& image) const override {
-        return img_lib::SaveBMP(file, image);
+    BatchOptions batch = cmd.batch;
+    unique_ptr<ConversionCache> cache;
+    if (!cmd.cache.dir.empty()) {
+        cache = ConversionCache::Open(cmd.cache);
+        if (!cache) {
+            cerr << "Failed to open the cache directory"sv << endl;
+            return 1;
+        }
+        batch.cache = cache.get();
     }
 
-    img_lib::Image LoadImage(const img_lib::Path& file) const override {
-        return img_lib::LoadBMP(file);
+    // пакетные режимы с --incremental пропускают актуальные задания
+    auto run_jobs = [&](const vector<ConvertJob>& jobs) {
+        if (!cmd.incremental.state_file.empty()) {
+            return RunIncremental(jobs, cmd.incremental, batch, cmd.convert, cout, cerr);
+        }
+        return RunBatch(jobs, batch, cmd.convert, cout, cerr);
+    };
+
+    if (cmd.mode == RunMode::BATCH) {
+        ifstream manifest_in(cmd.args[0]);
+        auto manifest = manifest_in ? ReadManifest(manifest_in) : nullopt;
+        if (!manifest) {
+            cerr << "Failed to read the manifest file"sv << endl;
+            return 1;
+        }
+
+        return static_cast<int>(run_jobs(*manifest));
     }
-};
 
-Format GetFormatByExtension(const img_lib::Path& input_file) {
-    const string ext = input_file.extension().string();
-    if (ext == ".jpg"sv || ext == ".jpeg"sv) {
-        return Format::JPEG;
+    if (cmd.mode == RunMode::BATCH_DIR) {
+        const img_lib::Path in_dir = cmd.args[0];
+        const img_lib::Path out_dir = cmd.args[1];
+        string out_ext = cmd.args[2];
+        if (!out_ext.empty() && out_ext.front() != '.') {
+            out_ext.insert(out_ext.begin(), '.');
+        }
+
+        if (!img_lib::GetFormatInterfaceByExtension(img_lib::Path("out") += out_ext)) {
+            cerr << GetStatusMessage(ConvertStatus::UNKNOWN_OUTPUT_FORMAT) << endl;
+            return static_cast<int>(ConvertStatus::UNKNOWN_OUTPUT_FORMAT);
+        }
+
+        error_code ec;
+        if (!filesystem::is_directory(in_dir, ec)) {
+            cerr << "Input directory not found"sv << endl;
+            return 1;
+        }
+
+        return static_cast<int>(run_jobs(CollectDirectoryJobs(in_dir, out_dir, out_ext)));
     }
 
-    if (ext == ".ppm"sv) {
-        return Format::PPM;
+    if (cmd.mode == RunMode::SERVE) {
+        RunServer(cin, cout, batch, cmd.convert);
+        return 0;
     }
 
-    if (ext == ".bmp"sv) {
-        return Format::BMP;
+    if (cmd.mode == RunMode::FAN_OUT) {
+        const ConvertStatus status = ConvertFanOut(cmd.args[0], cmd.outputs, cmd.convert.codec, cmd.batch.jobs, cerr);
+        if (status == ConvertStatus::OK) {
+            cout << GetStatusMessage(status) << endl;
+        }
+        return static_cast<int>(status);
     }
 
-    return Format::UNKNOWN;
-}
+    img_lib::Path in_path = cmd.args[0];
+    img_lib::Path out_path = cmd.args[1];
 
-ImageFormatInterface* GetFormatInterface(const img_lib::Path& path){
-    Format format = GetFormatByExtension(path);
-    static ImagePPM ppmInterface;
-    static ImageJPEG jpegInterface;
-    static ImageBMP bmpInterface;
-    
-    switch (format) {
-        case Format::JPEG:
-            return &jpegInterface;
-        case Format::PPM:
-            return &ppmInterface;
-        case Format::BMP:
-            return &bmpInterface;
-        default:
-            return nullptr;
+    const ConvertStatus status = ConvertImageCached(in_path, out_path, cmd.convert, batch.cache);
+    if (status != ConvertStatus::OK) {
+        cerr << GetStatusMessage(status) << endl;
+        return static_cast<int>(status);
     }
-}
 
+    cout << GetStatusMessage(status) << endl;
+    return 0;
+}
 
 int main(int argc, const char** argv) {
-    if (argc != 3) {
-        cerr << "Usage: "sv << argv[0] << " <in_file> <out_file>"sv << endl;
+    const auto cmd = ParseCommandLine(argc, argv);
+    if (!cmd) {
+        PrintUsage(argv[0]);
         return 1;
     }
 
-    img_lib::Path in_path = argv[1];
-    img_lib::Path out_path = argv[2];
-
-    ImageFormatInterface* in_format = GetFormatInterface(in_path);
-    if (!in_format) {
-        cerr << "Unknown format of the input file"sv << endl;
-        return 2;
-    }
-    
-    ImageFormatInterface* out_format = GetFormatInterface(out_path);
-    if (!out_format) {
-        cerr << "Unknown format of the output file"sv << endl;
-        return 3;
+    if (cmd->stats || !cmd->trace_file.empty()) {
+        img_lib::EnableTracing(!cmd->trace_file.empty());
     }
 
-    img_lib::Image image = in_format->LoadImage(in_path);
-    if (!image) {
-        cerr << "Loading failed"sv << endl;
-        return 4;
-    }
+    const int result = Run(*cmd);
 
-    if (!out_format->SaveImage(out_path, image)) {
-        cerr << "Saving failed"sv << endl;
-        return 5;
+    if (cmd->stats) {
+        PrintStats();
     }
-
-    cout << "Successfully converted"sv << endl;
-}
\ No newline at end of file
+    if (!cmd->trace_file.empty()) {
+        ofstream trace_out(cmd->trace_file);
+        img_lib::WriteChromeTrace(trace_out);
+        if (!trace_out) {
+            cerr << "Failed to write the trace file"sv << endl;
+        }
+    }
+    return result;
+}
@@ -0,0 +1,220 @@
+#include "pipeline.h"
+#include "cache.h"
+
+#include <bounded_queue.h>
+#include <buffer_pool.h>
+#include <memory_buffer.h>
+#include <output_file.h>
+#include <trace.h>
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+
+using namespace std;
+
+namespace {
+
+// Данные задания, которые передаются от стадии к стадии
+struct PipelineItem {
+    size_t index = 0;
+    const img_lib::ImageFormatInterface* in_format = nullptr;
+    const img_lib::ImageFormatInterface* out_format = nullptr;
+    // файл в памяти: прочитанный до декодирования, закодированный после кодирования
+    img_lib::ByteBuffer data;
+    img_lib::Image image;
+    std::optional<std::string> cache_key;  // ключ, под которым результат сохранится в кэш
+    bool done = false;                     // задание выполнено досрочно: результат взят из кэша
+};
+
+using PipelineQueue = img_lib::BoundedQueue<PipelineItem>;
+
+// Читает файл целиком, nullopt - при ошибке чтения
+optional<img_lib::ByteBuffer> ReadFile(const img_lib::Path& file) {
+    ifstream in(file, ios::binary);
+    if (!in) {
+        return nullopt;
+    }
+
+    img_lib::ByteBuffer data;
+    // Размер известен заранее только у обычных файлов. Лишний байт нужен,
+    // чтобы первое же чтение дошло до конца файла и цикл не удваивал буфер
+    error_code ec;
+    const auto file_size = filesystem::file_size(file, ec);
+    data.resize(ec ? size_t(64) << 10 : size_t(file_size) + 1);
+
+    size_t size = 0;
+    while (in.read(reinterpret_cast<char*>(data.data() + size), data.size() - size)) {
+        size = data.size();
+        // файл вырос после file_size или его размер неизвестен
+        data.resize(data.size() * 2);
+    }
+    if (in.bad()) {
+        return nullopt;
+    }
+    data.resize(size + size_t(in.gcount()));
+    IMGLIB_TRACE_BYTES(BYTES_READ, data.size());
+    return data;
+}
+
+bool WriteFile(const img_lib::Path& file, const img_lib::ByteBuffer& data,
+               const img_lib::FileWriteOptions& options) {
+    auto buf = img_lib::OpenFileForWrite(file, options);
+    if (!buf) {
+        return false;
+    }
+    const auto size = streamsize(data.size());
+    return buf->sputn(reinterpret_cast<const char*>(data.data()), size) == size && buf->pubsync() == 0;
+}
+
+// Запускает count потоков стадии: они берут задания из in, пока очередь
+// не закроется и не опустеет. Если process вернул OK, задание уходит в out,
+// а у последней стадии (out == nullptr) или с флагом done считается выполненным; любой другой
+// статус завершает задание. Исключение в process (например, bad_alloc)
+// завершает его статусом failure. Последний завершившийся поток закрывает out
+template <typename Process>
+void StartStage(vector<thread>& threads, size_t count, PipelineQueue& in, PipelineQueue* out,
+                img_lib::BufferPool& pool, ConvertStatus failure, const JobDoneCallback& on_done,
+                Process process) {
+    auto running = make_shared<atomic<size_t>>(count);
+
+    for (size_t i = 0; i < count; ++i) {
+        threads.emplace_back([&in, out, &pool, failure, &on_done, process, running] {
+            img_lib::ScopedBufferPool pool_scope(pool);
+
+            while (auto item = in.Pop()) {
+                ConvertStatus status;
+                try {
+                    status = process(*item);
+                } catch (const exception&) {
+                    status = failure;
+                }
+
+                if (status == ConvertStatus::OK && out && !item->done) {
+                    out->Push(move(*item));
+                } else {
+                    on_done(item->index, status);
+                }
+            }
+
+            if (--*running == 0 && out) {
+                out->Close();
+            }
+        });
+    }
+}
+
+}  // namespace
+
+void RunPipeline(const vector<ConvertJob>& jobs, const PipelineOptions& pipeline,
+                 const ConvertOptions& options, const JobDoneCallback& on_done) {
+    const size_t io_threads = max<size_t>(pipeline.io_threads, 1);
+    const size_t cpu_threads = pipeline.cpu_threads > 0
+        ? pipeline.cpu_threads
+        : max(1u, thread::hardware_concurrency());
+
+    // кадры выделяются в потоке декодирования, а освобождаются в потоке кодирования:
+    // общий пул возвращает их память следующим файлам
+    img_lib::RecyclingBufferPool buffer_pool;
+
+    // очереди заданий на входе каждой стадии; кроме первой, каждая
+    // вмещает по одному ожидающему файлу на поток своей стадии
+    PipelineQueue to_read(max<size_t>(jobs.size(), 1));
+    PipelineQueue to_decode(cpu_threads);
+    PipelineQueue to_encode(cpu_threads);
+    PipelineQueue to_write(io_threads);
+
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        PipelineItem item;
+        item.index = i;
+        to_read.Push(move(item));
+    }
+    to_read.Close();
+
+    const img_lib::CodecOptions load_options = GetLoadOptions(options);
+    vector<thread> threads;
+
+    StartStage(threads, io_threads, to_read, &to_decode, buffer_pool, ConvertStatus::LOADING_FAILED, on_done,
+               [&](PipelineItem& item) {
+        IMGLIB_TRACE_SCOPE("pipeline.read");
+        const ConvertJob& job = jobs[item.index];
+        auto data = ReadFile(job.in_path);
+
+        // форматы определяются так же, как в ConvertImage, но сигнатура
+        // берётся из уже прочитанных данных
+        item.in_format = img_lib::DetectFormatInterface(job.in_path, data ? img_lib::ByteView(*data)
+                                                                          : img_lib::ByteView());
+        if (!item.in_format) {
+            return ConvertStatus::UNKNOWN_INPUT_FORMAT;
+        }
+        item.out_format = img_lib::GetFormatInterfaceByExtension(job.out_path);
+        if (!item.out_format) {
+            return ConvertStatus::UNKNOWN_OUTPUT_FORMAT;
+        }
+        if (!data) {
+            return ConvertStatus::LOADING_FAILED;
+        }
+
+        if (pipeline.cache) {
+            // файл уже в памяти, и хеш обходится в один проход по нему
+            item.cache_key = ConversionCache::MakeKey(*data, job.out_path, options);
+            if (item.cache_key && pipeline.cache->Fetch(*item.cache_key, job.out_path)) {
+                item.done = true;
+                return ConvertStatus::OK;
+            }
+        }
+
+        item.data = move(*data);
+        return ConvertStatus::OK;
+    });
+
+    StartStage(threads, cpu_threads, to_decode, &to_encode, buffer_pool, ConvertStatus::LOADING_FAILED, on_done,
+               [&](PipelineItem& item) {
+        IMGLIB_TRACE_SCOPE("pipeline.decode");
+        item.image = item.in_format->LoadImage(item.data, load_options);
+        // прочитанный файл больше не нужен, незачем держать его до записи
+        img_lib::ByteBuffer().swap(item.data);
+        if (item.image) {
+            item.image = ProcessImage(move(item.image), options);
+        }
+        return item.image ? ConvertStatus::OK : ConvertStatus::LOADING_FAILED;
+    });
+
+    StartStage(threads, cpu_threads, to_encode, &to_write, buffer_pool, ConvertStatus::SAVING_FAILED, on_done,
+               [&](PipelineItem& item) {
+        IMGLIB_TRACE_SCOPE("pipeline.encode");
+        const bool saved = item.out_format->SaveImage(item.data, item.image, options.codec);
+        item.image = {};
+        return saved ? ConvertStatus::OK : ConvertStatus::SAVING_FAILED;
+    });
+
+    StartStage(threads, io_threads, to_write, nullptr, buffer_pool, ConvertStatus::SAVING_FAILED, on_done,
+               [&](PipelineItem& item) {
+        IMGLIB_TRACE_SCOPE("pipeline.write");
+        const img_lib::Path& out_path = jobs[item.index].out_path;
+        // как и в ConvertImage, через временный файл: прежний выход (возможно,
+        // жёсткая ссылка на запись кэша) заменяется только записанным целиком
+        const img_lib::Path temp = MakeTempOutputPath(out_path);
+        if (!WriteFile(temp, item.data, options.codec.file_write)) {
+            error_code ec;
+            filesystem::remove(temp, ec);
+            return ConvertStatus::SAVING_FAILED;
+        }
+        if (!ReplaceWithTemp(temp, out_path)) {
+            return ConvertStatus::SAVING_FAILED;
+        }
+        if (item.cache_key) {
+            pipeline.cache->Store(*item.cache_key, out_path);
+        }
+        return ConvertStatus::OK;
+    });
+
+    for (thread& t : threads) {
+        t.join();
+    }
+}
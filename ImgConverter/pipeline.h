@@ -0,0 +1,29 @@
+#pragma once
+
+#include "batch.h"
+#include "converter.h"
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+// Потоки стадий конвейера
+struct PipelineOptions {
+    size_t io_threads = 2;   // чтение и запись файлов, на каждую стадию
+    size_t cpu_threads = 0;  // декодирование и кодирование, на каждую стадию; 0 - по числу ядер
+    ConversionCache* cache = nullptr;  // кэш результатов, nullptr - без кэша
+};
+
+// вызывается из рабочих потоков по завершении каждого задания, в любом порядке
+using JobDoneCallback = std::function<void(size_t job_index, ConvertStatus status)>;
+
+// Конвертирует задания конвейером из четырёх стадий: чтение файла в память,
+// декодирование с обработкой кадра (ProcessImage), кодирование в память и запись. Разные файлы проходят
+// стадии одновременно, поэтому диск и процессор заняты параллельно,
+// а не по очереди. Между стадиями стоят очереди ограниченной длины,
+// так что в памяти находится не больше нескольких файлов на поток.
+// В отличие от ConvertImage изображение загружается в память целиком.
+// С кэшем ключ считается по уже прочитанному файлу, и при попадании
+// задание завершается сразу после стадии чтения
+void RunPipeline(const std::vector<ConvertJob>& jobs, const PipelineOptions& pipeline,
+                 const ConvertOptions& options, const JobDoneCallback& on_done);
@@ -0,0 +1,69 @@
+#include "server.h"
+#include "cache.h"
+
+#include <buffer_pool.h>
+#include <thread_pool.h>
+#include <trace.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+
+using namespace std;
+
+void RunServer(istream& in, ostream& out, const BatchOptions& batch, const ConvertOptions& options) {
+    img_lib::RecyclingBufferPool buffer_pool;
+    img_lib::ThreadPool pool(batch.jobs);
+
+    // заданий в работе не больше двух на поток: очередь не растёт,
+    // даже если задания приходят быстрее, чем конвертируются
+    const size_t max_pending = 2 * pool.GetThreadCount();
+    size_t pending = 0;
+    mutex state_mutex;
+    condition_variable slot_free;
+
+    auto reply = [&](int code, const string& line) {
+        lock_guard lock(state_mutex);
+        out << code << ' ' << line << endl;
+    };
+
+    string line;
+    while (getline(in, line)) {
+        ConvertJob job;
+        const ManifestLine kind = ParseManifestLine(line, job);
+        if (kind == ManifestLine::SKIP) {
+            continue;
+        }
+        if (kind == ManifestLine::INVALID) {
+            reply(1, line);
+            continue;
+        }
+
+        {
+            unique_lock lock(state_mutex);
+            slot_free.wait(lock, [&] { return pending < max_pending; });
+            ++pending;
+        }
+
+        pool.Submit([&, job = move(job), line] {
+            ConvertStatus status;
+            {
+                IMGLIB_TRACE_SCOPE("serve.job");
+                img_lib::ScopedBufferPool pool_scope(buffer_pool);
+                try {
+                    status = ConvertImageCached(job.in_path, job.out_path, options, batch.cache);
+                } catch (const exception&) {
+                    // например, bad_alloc на слишком большом изображении
+                    status = ConvertStatus::LOADING_FAILED;
+                }
+            }
+            reply(static_cast<int>(status), line);
+
+            lock_guard lock(state_mutex);
+            --pending;
+            slot_free.notify_one();
+        });
+    }
+
+    pool.Wait();
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "batch.h"
+#include "converter.h"
+
+#include <istream>
+#include <ostream>
+
+// Долгоживущий режим: читает задания из in по одному в строке, в формате
+// манифеста (см. ReadManifest), и конвертирует их на batch.jobs потоках,
+// пока in не закончится. Процесс и его потоки живут между заданиями,
+// поэтому объекты libjpeg, статические объекты форматов и буферы пикселей
+// создаются один раз, а не на каждый файл.
+// На каждую строку задания в out пишется ответ "<код> <строка задания>",
+// где код - код возврата imgconv (0 - успешно, 1 - строку не удалось
+// разобрать). Ответы идут в порядке завершения заданий, а не в порядке строк
+void RunServer(std::istream& in, std::ostream& out, const BatchOptions& batch, const ConvertOptions& options);
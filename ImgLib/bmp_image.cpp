@@ -1,7 +1,15 @@
 #include "bmp_image.h"
+#include "mapped_file.h"
+#include "pixel_convert.h"
+#include "buffer_pool.h"
+#include "memory_buffer.h"
 #include "pack_defines.h"
+#include "trace.h"
 
+#include <algorithm>
 #include <array>
+#include <climits>
+#include <cstring>
 #include <fstream>
 #include <string_view>
 
@@ -34,101 +42,442 @@ PACKED_STRUCT_BEGIN BitmapInfoHeader {
 }
 PACKED_STRUCT_END
 
+// Маски каналов BI_BITFIELDS лежат с 54-го байта файла: в заголовках V4 и V5
+// они входят в информационный заголовок, а после 40-байтового идут отдельно
+PACKED_STRUCT_BEGIN BitmapChannelMasks {
+    uint32_t red = 0;
+    uint32_t green = 0;
+    uint32_t blue = 0;
+}
+PACKED_STRUCT_END
+
+// biCompression: без сжатия и с масками каналов
+static const uint32_t BMP_BI_RGB = 0;
+static const uint32_t BMP_BI_BITFIELDS = 3;
+
+// biSize заголовков BITMAPINFOHEADER, BITMAPV4HEADER и BITMAPV5HEADER
+static const uint32_t BMP_INFO_HEADER_SIZE = 40;
+static const uint32_t BMP_V4_HEADER_SIZE = 108;
+static const uint32_t BMP_V5_HEADER_SIZE = 124;
+
 // Вычисление длины строки в байтах с учетом выравнивания до 4 байт (BMP-требование)
-static int GetBMPStride(int w) { // w - ширина изображения
-    static const int size_of_pixel = 3; // размер пикселя в байтах
-    static const int padding = 4; // величина выравнивания 
-    return padding * ((w * size_of_pixel + 3) / 4); // каждый пиксель 3 байта (BGR), +3 округляет вверх до кратного 4
+int GetBMPStride(int w, int bytes_per_pixel) { // w - ширина изображения
+    static const int padding = 4; // величина выравнивания
+    return padding * ((w * bytes_per_pixel + 3) / 4); // +3 округляет вверх до кратного 4
 }
 
-// Сохраняет изображение в формате BMP (24 бита, без сжатия)
-bool SaveBMP(const Path& file, const Image& image) {
-    const int width = image.GetWidth();
-    const int height = image.GetHeight();
-    const int stride = GetBMPStride(width); // ширина строки в байтах с выравниванием
-    const uint32_t image_size = stride * height;
+namespace {
+
+// Расположение пикселей, разобранное из заголовков
+struct BMPLayout {
+    Size size = {0, 0};
+    PixelFormat format = PixelFormat::BGR24;  // BGRA32 у 32-битных файлов
+    int stride = 0;
+    bool top_down = false;                    // отрицательная biHeight: строки идут сверху вниз
+    uint32_t data_offset = 0;
+};
+
+}  // namespace
+
+// маски каналов нужно прочитать только для BI_BITFIELDS
+static bool HasChannelMasks(const BitmapInfoHeader& info_header) {
+    return info_header.biCompression == BMP_BI_BITFIELDS;
+}
+
+// Проверяет заголовки и находит строки пикселей. Поддерживаются 24 и 32 бита
+// без сжатия, а также 32 бита с масками, если они задают тот же порядок B, G, R
+// и строки копируются без разбора масок. Четвёртый байт 32-битного пикселя
+// не читается как прозрачность. nullopt - неподдерживаемый вариант BMP
+static optional<BMPLayout> GetBMPLayout(const BitmapFileHeader& file_header, const BitmapInfoHeader& info_header,
+                                        const BitmapChannelMasks& masks) {
+    if (file_header.bfType != 0x4D42 || info_header.biPlanes != 1) {
+        return nullopt;
+    }
+    if (info_header.biSize != BMP_INFO_HEADER_SIZE && info_header.biSize != BMP_V4_HEADER_SIZE
+        && info_header.biSize != BMP_V5_HEADER_SIZE) {
+        return nullopt;
+    }
 
+    BMPLayout layout;
+    if (info_header.biBitCount == 24 && info_header.biCompression == BMP_BI_RGB) {
+        layout.format = PixelFormat::BGR24;
+    } else if (info_header.biBitCount == 32 && info_header.biCompression == BMP_BI_RGB) {
+        layout.format = PixelFormat::BGRA32;
+    } else if (info_header.biBitCount == 32 && HasChannelMasks(info_header)
+               && masks.red == 0x00FF0000 && masks.green == 0x0000FF00 && masks.blue == 0x000000FF) {
+        layout.format = PixelFormat::BGRA32;
+    } else {
+        return nullopt;
+    }
+
+    // маски после 40-байтового заголовка занимают место до пикселей
+    const uint32_t headers_size = sizeof(file_header) + info_header.biSize
+        + (info_header.biSize == BMP_INFO_HEADER_SIZE && HasChannelMasks(info_header) ? sizeof(masks) : 0);
+    const int bytes_per_pixel = GetBytesPerPixel(layout.format);
+    if (file_header.bfOffBits < headers_size || info_header.biWidth <= 0
+        || info_header.biWidth > (INT_MAX - 3) / bytes_per_pixel
+        || info_header.biHeight == 0 || info_header.biHeight == INT_MIN) {
+        return nullopt;
+    }
+
+    layout.top_down = info_header.biHeight < 0;
+    layout.size = {info_header.biWidth, layout.top_down ? -info_header.biHeight : info_header.biHeight};
+    layout.stride = GetBMPStride(layout.size.width, bytes_per_pixel);
+    layout.data_offset = file_header.bfOffBits;
+    return layout;
+}
+
+// Разбирает заголовки прямо из отображения или буфера и находит пиксельную область.
+// Обычно верхняя строка изображения хранится в файле последней, отсюда
+// отрицательный шаг; у файлов с отрицательной высотой шаг положительный
+static optional<MappedPixels> ParseMappedBMP(ByteView file) {
+    IMGLIB_TRACE_SCOPE("bmp.header");
     BitmapFileHeader file_header;
     BitmapInfoHeader info_header;
+    BitmapChannelMasks masks;
+    if (file.GetSize() < sizeof(file_header) + sizeof(info_header)) {
+        return nullopt;
+    }
 
-    file_header.bfSize = sizeof(file_header) + sizeof(info_header) + image_size; // общий размер файла
-    info_header.biWidth = width;
-    info_header.biHeight = height;
-    info_header.biSizeImage = image_size;
+    // memcpy вместо reinterpret_cast: отображение не обязано быть выровненным под поля
+    memcpy(&file_header, file.GetData(), sizeof(file_header));
+    memcpy(&info_header, file.GetData() + sizeof(file_header), sizeof(info_header));
+    if (HasChannelMasks(info_header)) {
+        if (file.GetSize() < sizeof(file_header) + sizeof(info_header) + sizeof(masks)) {
+            return nullopt;
+        }
+        memcpy(&masks, file.GetData() + sizeof(file_header) + sizeof(info_header), sizeof(masks));
+    }
 
-    ofstream out(file, ios::binary); // открываем файл для записи в бинарном режиме
+    const auto layout = GetBMPLayout(file_header, info_header, masks);
+    if (!layout) {
+        return nullopt;
+    }
 
-    out.write(reinterpret_cast<const char*>(&file_header), sizeof(file_header)); // запись заголовка файла
-    out.write(reinterpret_cast<const char*>(&info_header), sizeof(info_header)); // запись инфо-заголовка
+    const size_t image_size = size_t(layout->stride) * layout->size.height;
+    if (file.GetSize() < layout->data_offset + image_size) {
+        return nullopt; // файл обрезан
+    }
+
+    const std::byte* data = file.GetData() + layout->data_offset;
+    MappedPixels pixels;
+    pixels.top_row = layout->top_down ? data : data + image_size - layout->stride;
+    pixels.stride = layout->top_down ? layout->stride : -layout->stride;
+    pixels.size = layout->size;
+    pixels.format = layout->format;
+    return pixels;
+}
 
-    vector<uint8_t> row(stride, 0);  // временный буфер для строки с выравниванием
+// максимальное число строк, которое читается или пишется за одну операцию
+static const int BMP_CHUNK_ROWS = 64;
 
-    for (int y = height - 1; y >= 0; --y) { // BMP хранит строки снизу вверх
-        const auto* line = image.GetLine(y);
-        for (int x = 0; x < width; ++x) {
-            row[3 * x + 0] = static_cast<uint8_t>(line[x].b); // BMP: порядок BGR
-            row[3 * x + 1] = static_cast<uint8_t>(line[x].g);
-            row[3 * x + 2] = static_cast<uint8_t>(line[x].r);
+// Запись куска кончается переходом к следующему, а переход сбрасывает
+// буфер файла, поэтому при записи кусок берётся не меньше мегабайта
+static const int BMP_WRITE_CHUNK_BYTES = 1 << 20;
+
+namespace {
+
+// Обычно BMP хранит строки снизу вверх, а ImageReader выдаёт их сверху вниз.
+// Строки полосы [y, y + k) лежат в файле непрерывным блоком в обратном
+// порядке, поэтому полоса читается кусками: переход к началу куска,
+// одно чтение и разворот строк при копировании в полосу.
+// Файлы с отрицательной высотой читаются подряд, без переходов,
+// поэтому их можно читать и из канала
+class BMPReader : public ImageReader {
+public:
+    explicit BMPReader(const Path& file)
+        : in_(file, ios::binary) {
+    }
+
+    bool Open() {
+        IMGLIB_TRACE_SCOPE("bmp.header");
+        if (!in_) return false; // не удалось открыть
+
+        BitmapFileHeader file_header;
+        BitmapInfoHeader info_header;
+        BitmapChannelMasks masks;
+
+        in_.read(reinterpret_cast<char*>(&file_header), sizeof(file_header)); // читаем заголовки
+        if (!in_) {
+            // Произошла ошибка при чтении заголовка
+            return false;
         }
-        out.write(reinterpret_cast<const char*>(row.data()), stride); // запись строки
+
+        in_.read(reinterpret_cast<char*>(&info_header), sizeof(info_header));
+        if (!in_) {
+            // Произошла ошибка при чтении заголовка
+            return false;
+        }
+
+        streamoff headers_read = sizeof(file_header) + sizeof(info_header);
+        if (HasChannelMasks(info_header)) {
+            in_.read(reinterpret_cast<char*>(&masks), sizeof(masks));
+            if (!in_) {
+                return false;
+            }
+            headers_read += sizeof(masks);
+        }
+
+        const auto layout = GetBMPLayout(file_header, info_header, masks);
+        if (!layout) {
+            return false; // неподдерживаемый формат
+        }
+        layout_ = *layout;
+
+        if (layout_.top_down) {
+            // остаток заголовков и палитру пропускаем чтением, а не переходом
+            const streamoff skip = streamoff(layout_.data_offset) - headers_read;
+            in_.ignore(skip);
+            if (in_.gcount() != skip) return false;
+        }
+        return true;
     }
 
-    return out.good();
-}
+    Size GetSize() const override {
+        return layout_.size;
+    }
+
+    PixelFormat GetPixelFormat() const override {
+        return layout_.format;
+    }
+
+    int ReadRows(Image& band) override {
+        IMGLIB_TRACE_SCOPE("bmp.read");
+        const Size size = layout_.size;
+        const int stride = layout_.stride;
+        const int count = min(band.GetHeight(), size.height - rows_read_);
+
+        // строки файла сверху вниз в формате полосы и без промежутков
+        // читаются прямо в неё
+        if (layout_.top_down && band.GetFormat() == layout_.format && band.GetStride() == stride) {
+            const streamsize bytes = streamsize(count) * stride;
+            in_.read(reinterpret_cast<char*>(band.GetRowData(0)), bytes);
+            IMGLIB_TRACE_BYTES(BYTES_READ, uint64_t(in_.gcount()));
+            if (in_.gcount() != bytes) return 0; // ошибка чтения
+            rows_read_ += count;
+            return count;
+        }
 
-// Загружает BMP-файл и возвращает изображение Image
-Image LoadBMP(const Path& file) {
-    ifstream in(file, ios::binary); // открываем файл в бинарном режиме
-    if (!in) return {}; // не удалось открыть — возвращаем пустой объект
+        for (int done = 0; done < count;) {
+            const int k = min(BMP_CHUNK_ROWS, count - done);
+            const int y = rows_read_ + done; // верхняя строка куска в изображении
+
+            if (!layout_.top_down) {
+                // нижняя строка куска (y + k - 1) идёт в файле первой
+                in_.seekg(streamoff(layout_.data_offset) + streamoff(size.height - y - k) * stride, ios::beg);
+            }
+            chunk_.Resize(size_t(k) * stride);
+            in_.read(reinterpret_cast<char*>(chunk_.GetData()), chunk_.GetSize());
+            IMGLIB_TRACE_BYTES(BYTES_READ, uint64_t(in_.gcount()));
+            if (in_.gcount() != streamsize(chunk_.GetSize())) return 0; // ошибка чтения
+
+            IMGLIB_TRACE_SCOPE("bmp.swizzle");
+            // BMP: порядок каналов B, G, R
+            if (layout_.top_down) {
+                ConvertRows(chunk_.GetData(), stride, layout_.format,
+                            band.GetRowData(done), band.GetStride(), band.GetFormat(), size.width, k);
+            } else {
+                ConvertRows(chunk_.GetData() + size_t(k - 1) * stride, -ptrdiff_t(stride), layout_.format,
+                            band.GetRowData(done), band.GetStride(), band.GetFormat(), size.width, k);
+            }
+            done += k;
+        }
+
+        rows_read_ += count;
+        return count;
+    }
+
+private:
+    ifstream in_;
+    BMPLayout layout_;
+    int rows_read_ = 0;
+    PooledBuffer chunk_;
+};
+
+// Запись идёт в том же порядке, что и чтение в BMPReader: заголовки
+// известны заранее по размеру, а каждый кусок полосы записывается
+// на своё место в файле через seekp. Поэтому писать можно только
+// в файл с произвольным доступом (не в канал) или в буфер в памяти
+class BMPWriter : public ImageWriter {
+public:
+    BMPWriter(unique_ptr<streambuf> buf, Size size, const RasterOptions& raster)
+        : buf_(move(buf))
+        , out_(buf_.get())
+        , size_(size)
+        , stride_(GetBMPStride(size.width)) // ширина строки в байтах с выравниванием
+        , raster_(raster)
+        , chunk_rows_(max(BMP_CHUNK_ROWS, GetParallelChunkRows(stride_, BMP_WRITE_CHUNK_BYTES, raster))) {
+        WriteBMPHeaders(out_, size_);
+    }
+
+    bool IsOpen() const {
+        return out_.good();
+    }
+
+    bool WriteRows(const ImageView& band, int count) override {
+        IMGLIB_TRACE_SCOPE("bmp.write");
+        if (count > size_.height - rows_written_) {
+            return false;
+        }
+
+        for (int done = 0; done < count;) {
+            const int k = min(chunk_rows_, count - done);
+            const int y = rows_written_ + done;
+
+            chunk_.Resize(size_t(k) * stride_);
+            {
+                IMGLIB_TRACE_SCOPE("bmp.swizzle");
+                // строки куска делятся между потоками, запись остаётся одной
+                ParallelForRows(k, stride_, raster_, [&](int begin, int end) {
+                    // строки куска пишутся в файл снизу вверх, BMP: порядок BGR
+                    ConvertRows(band.GetRowData(done + begin), band.GetStride(), band.GetFormat(),
+                                chunk_.GetData() + size_t(k - 1 - begin) * stride_, -ptrdiff_t(stride_),
+                                PixelFormat::BGR24, size_.width, end - begin);
+                    // байты выравнивания строк заполняем нулями
+                    const int padding = stride_ - size_.width * 3;
+                    for (int i = begin; i < end && padding > 0; ++i) {
+                        memset(chunk_.GetData() + size_t(k - 1 - i) * stride_ + size_.width * 3, 0, padding);
+                    }
+                });
+            }
+
+            out_.seekp(data_offset_ + streamoff(size_.height - y - k) * stride_, ios::beg);
+            out_.write(reinterpret_cast<const char*>(chunk_.GetData()), chunk_.GetSize()); // запись куска строк
+            done += k;
+        }
+
+        rows_written_ += count;
+        return out_.good();
+    }
+
+    bool Finish() override {
+        IMGLIB_TRACE_SCOPE("bmp.flush");
+        out_.flush();
+        return out_.good() && rows_written_ == size_.height;
+    }
+
+private:
+    unique_ptr<streambuf> buf_;
+    ostream out_;
+    Size size_;
+    int stride_;
+    RasterOptions raster_;
+    int chunk_rows_;
+    streamoff data_offset_ = BitmapFileHeader{}.bfOffBits;
+    int rows_written_ = 0;
+    PooledBuffer chunk_;
+};
+
+}  // namespace
+
+void WriteBMPHeaders(ostream& out, Size size) {
+    const uint32_t image_size = GetBMPStride(size.width) * size.height;
 
     BitmapFileHeader file_header;
     BitmapInfoHeader info_header;
 
-    in.read(reinterpret_cast<char*>(&file_header), sizeof(file_header)); // читаем заголовки
-    if (!in) {
-        // Произошла ошибка при чтении заголовка
-        return {};
+    file_header.bfSize = sizeof(file_header) + sizeof(info_header) + image_size; // общий размер файла
+    info_header.biWidth = size.width;
+    info_header.biHeight = size.height;
+    info_header.biSizeImage = image_size;
+
+    out.write(reinterpret_cast<const char*>(&file_header), sizeof(file_header)); // запись заголовка файла
+    out.write(reinterpret_cast<const char*>(&info_header), sizeof(info_header)); // запись инфо-заголовка
+}
+
+optional<ImageInfo> ProbeBMP(const Path& file) {
+    BMPReader reader(file);
+    if (!reader.Open()) {
+        return nullopt;
     }
+    // и в 24-битных, и в 32-битных файлах три канала цвета по 8 бит
+    return ImageInfo{FileFormat::BMP, reader.GetSize(), 3, 8};
+}
 
-    in.read(reinterpret_cast<char*>(&info_header), sizeof(info_header));
-    if (!in) {
-        // Произошла ошибка при чтении заголовка
-        return {};
+optional<MappedImage> MapBMP(const Path& file) {
+    MappedFile mapped = MappedFile::Open(file);
+    if (!mapped) {
+        return nullopt;
     }
 
-    // проверка соответствия формату BMP 24-bit
-    if (file_header.bfType != 0x4D42 ||
-        file_header.bfOffBits != 54 ||
-        info_header.biSize != 40 ||
-        info_header.biPlanes != 1 ||
-        info_header.biBitCount != 24 ||
-        info_header.biCompression != 0 ||
-        info_header.biWidth <= 0 || info_header.biHeight <= 0) {
-        return {}; // неподдерживаемый формат
+    auto pixels = ParseMappedBMP({mapped.GetData(), mapped.GetSize()});
+    if (!pixels) {
+        return nullopt;
     }
+    return MappedImage{move(mapped), *pixels};
+}
 
-    const int width = info_header.biWidth;
-    const int height = info_header.biHeight;
-    const int stride = GetBMPStride(width);
+unique_ptr<ImageReader> OpenBMPReader(const Path& file, const RasterOptions& raster) {
+    // основной путь - чтение через отображение файла в память
+    if (MappedFile mapped = MappedFile::Open(file)) {
+        auto pixels = ParseMappedBMP({mapped.GetData(), mapped.GetSize()});
+        if (!pixels) {
+            return nullptr;
+        }
+        return MakeMappedReader({move(mapped), *pixels}, raster);
+    }
 
-    Image image(stride / 3, height, Color::Black());
-    vector<uint8_t> row(stride);
+    // файл не удалось отобразить (например, это канал) - читаем потоком
+    auto reader = make_unique<BMPReader>(file);
+    if (!reader->Open()) {
+        return nullptr;
+    }
+    return reader;
+}
 
-    in.seekg(file_header.bfOffBits, ios::beg); // переходим к началу пикселей
+unique_ptr<ImageReader> OpenBMPReader(ByteView data, const RasterOptions& raster) {
+    auto pixels = ParseMappedBMP(data);
+    if (!pixels) {
+        return nullptr;
+    }
+    // пиксели остаются в памяти вызывающего, отображённого файла нет
+    return MakeMappedReader({MappedFile(), *pixels}, raster);
+}
 
-    for (int y = height - 1; y >= 0; --y) { // BMP: строки снизу вверх
-        in.read(reinterpret_cast<char*>(row.data()), stride);
-        if (in.gcount() != stride) return {}; // ошибка чтения
+static unique_ptr<ImageWriter> CreateBMPWriter(unique_ptr<streambuf> buf, Size size,
+                                             const RasterOptions& raster) {
+    auto writer = make_unique<BMPWriter>(move(buf), size, raster);
+    if (!writer->IsOpen()) {
+        return nullptr;
+    }
+    return writer;
+}
 
-        auto* line = image.GetLine(y);
-        for (int x = 0; x < width; ++x) {
-            line[x].b = static_cast<std::byte>(row[3 * x + 0]); // порядок: B
-            line[x].g = static_cast<std::byte>(row[3 * x + 1]); // порядок: G
-            line[x].r = static_cast<std::byte>(row[3 * x + 2]); // порядок: R
-        }
+unique_ptr<ImageWriter> CreateBMPWriter(const Path& file, Size size, const FileWriteOptions& options,
+                                      const RasterOptions& raster) {
+    auto buf = OpenFileForWrite(file, options);
+    if (!buf) {
+        return nullptr;
     }
+    return CreateBMPWriter(move(buf), size, raster);
+}
+
+unique_ptr<ImageWriter> CreateBMPWriter(ByteBuffer& out, Size size, const RasterOptions& raster) {
+    return CreateBMPWriter(make_unique<ByteBufferStreamBuf>(out), size, raster);
+}
+
+// Сохраняет изображение в формате BMP (24 бита, без сжатия)
+bool SaveBMP(const Path& file, const ImageView& image, const FileWriteOptions& options,
+             const RasterOptions& raster) {
+    IMGLIB_TRACE_SCOPE("bmp.save");
+    return WriteWholeImage(CreateBMPWriter(file, {image.GetWidth(), image.GetHeight()}, options, raster), image);
+}
+
+bool SaveBMP(ByteBuffer& out, const ImageView& image, const RasterOptions& raster) {
+    IMGLIB_TRACE_SCOPE("bmp.save");
+    return WriteWholeImage(CreateBMPWriter(out, {image.GetWidth(), image.GetHeight()}, raster), image);
+}
+
+// Загружает BMP-файл и возвращает изображение Image,
+// пустое - если файл не удалось прочитать или формат не поддерживается
+Image LoadBMP(const Path& file, const RasterOptions& raster) {
+    IMGLIB_TRACE_SCOPE("bmp.load");
+    return ReadWholeImage(OpenBMPReader(file, raster));
+}
 
-    return image; // успех
+Image LoadBMP(ByteView data, const RasterOptions& raster) {
+    IMGLIB_TRACE_SCOPE("bmp.load");
+    return ReadWholeImage(OpenBMPReader(data, raster));
 }
 
 
@@ -1,12 +1,51 @@
 #pragma once
 #include "img_lib.h"
+#include "image_info.h"
+#include "image_stream.h"
+#include "mapped_file.h"
+#include "memory_buffer.h"
+#include "output_file.h"
+#include "parallel_rows.h"
 
 #include <filesystem>
+#include <memory>
+#include <optional>
+#include <ostream>
 
 namespace img_lib {
 using Path = std::filesystem::path;
 
-bool SaveBMP(const Path& file, const Image& image);
-Image LoadBMP(const Path& file);
+// raster задаёт, на сколько потоков делить перестановку каналов и строк
+bool SaveBMP(const Path& file, const ImageView& image, const FileWriteOptions& options = {},
+             const RasterOptions& raster = {});
+Image LoadBMP(const Path& file, const RasterOptions& raster = {});
+
+// построчное чтение и запись без полного кадра, nullptr - если файл
+// не удалось открыть или его заголовок не поддерживается
+std::unique_ptr<ImageReader> OpenBMPReader(const Path& file, const RasterOptions& raster = {});
+std::unique_ptr<ImageWriter> CreateBMPWriter(const Path& file, Size size,
+                                             const FileWriteOptions& options = {},
+                                             const RasterOptions& raster = {});
+
+// То же для файла в памяти. Результат записи заменяет содержимое out,
+// читатель ссылается на data и не должен её пережить
+bool SaveBMP(ByteBuffer& out, const ImageView& image, const RasterOptions& raster = {});
+Image LoadBMP(ByteView data, const RasterOptions& raster = {});
+std::unique_ptr<ImageReader> OpenBMPReader(ByteView data, const RasterOptions& raster = {});
+std::unique_ptr<ImageWriter> CreateBMPWriter(ByteBuffer& out, Size size, const RasterOptions& raster = {});
+
+// читает только заголовки, nullopt - если файл не в формате BMP
+std::optional<ImageInfo> ProbeBMP(const Path& file);
+
+// отображает файл в память и разбирает заголовки без копирования пикселей
+std::optional<MappedImage> MapBMP(const Path& file);
+
+// длина строки в файле с учётом выравнивания до 4 байт,
+// по умолчанию для 24-битных пикселей, которые пишет SaveBMP
+int GetBMPStride(int width, int bytes_per_pixel = 3);
+
+// Пишет оба заголовка файла для изображения size. Строки пикселей
+// идут следом снизу вверх, каждая длиной GetBMPStride(size.width)
+void WriteBMPHeaders(std::ostream& out, Size size);
 
 } // namespace img_lib
\ No newline at end of file
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+namespace img_lib {
+
+// Очередь ограниченной длины между стадиями конвейера. Push ждёт,
+// пока в очереди появится место, поэтому быстрая стадия не может
+// уйти далеко вперёд медленной и накопить в памяти много данных
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity)
+        : capacity_(capacity > 0 ? capacity : 1) {
+    }
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    // false - если очередь уже закрыта, тогда value не добавляется
+    bool Push(T value) {
+        {
+            std::unique_lock lock(mutex_);
+            not_full_.wait(lock, [this] { return closed_ || items_.size() < capacity_; });
+            if (closed_) {
+                return false;
+            }
+            items_.push_back(std::move(value));
+        }
+        not_empty_.notify_one();
+        return true;
+    }
+
+    // ждёт следующий элемент, nullopt - если очередь закрыта и опустела
+    std::optional<T> Pop() {
+        std::optional<T> value;
+        {
+            std::unique_lock lock(mutex_);
+            not_empty_.wait(lock, [this] { return closed_ || !items_.empty(); });
+            if (items_.empty()) {
+                return std::nullopt;
+            }
+            value = std::move(items_.front());
+            items_.pop_front();
+        }
+        not_full_.notify_one();
+        return value;
+    }
+
+    // новых элементов не будет: оставшиеся ещё можно забрать через Pop
+    void Close() {
+        {
+            std::lock_guard lock(mutex_);
+            closed_ = true;
+        }
+        not_full_.notify_all();
+        not_empty_.notify_all();
+    }
+
+private:
+    std::deque<T> items_;
+    size_t capacity_;
+    bool closed_ = false;
+
+    std::mutex mutex_;
+    std::condition_variable not_full_;
+    std::condition_variable not_empty_;
+};
+
+}  // namespace img_lib
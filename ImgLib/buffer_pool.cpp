@@ -0,0 +1,218 @@
+#include "buffer_pool.h"
+
+#include <atomic>
+#include <cstring>
+#include <new>
+#include <utility>
+
+#if defined(__linux__)
+    #include <sys/mman.h>
+#endif
+
+using namespace std;
+
+namespace img_lib {
+
+namespace {
+
+// выравнивание буферов под самые широкие SIMD-загрузки и строку кеша
+constexpr size_t BUFFER_ALIGNMENT = 64;
+
+// с этого размера блок выделяется страницами, а не из кучи
+constexpr size_t HUGE_PAGE_SIZE = size_t(2) << 20;
+
+size_t RoundUp(size_t size, size_t alignment) {
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+// Способ выделения определяется ёмкостью блока, поэтому
+// SystemDeallocate не нужно хранить, откуда взят блок. Выбор делается
+// по ёмкости и здесь: блок из кучи всегда меньше HUGE_PAGE_SIZE
+BufferBlock SystemAllocate(size_t size) {
+    if (size == 0) {
+        return {};
+    }
+
+    const size_t capacity = RoundUp(size, BUFFER_ALIGNMENT);
+#if defined(__linux__)
+    if (capacity >= HUGE_PAGE_SIZE) {
+        const size_t mapped_capacity = RoundUp(size, HUGE_PAGE_SIZE);
+        void* data = mmap(nullptr, mapped_capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (data == MAP_FAILED) {
+            throw bad_alloc();
+        }
+    #if defined(MADV_HUGEPAGE)
+        // только подсказка: без прозрачных больших страниц блок останется обычным
+        madvise(data, mapped_capacity, MADV_HUGEPAGE);
+    #endif
+        return {static_cast<std::byte*>(data), mapped_capacity};
+    }
+#endif
+
+    return {static_cast<std::byte*>(::operator new(capacity, align_val_t{BUFFER_ALIGNMENT})), capacity};
+}
+
+void SystemDeallocate(BufferBlock block) {
+    if (block.data == nullptr) {
+        return;
+    }
+
+#if defined(__linux__)
+    if (block.capacity >= HUGE_PAGE_SIZE) {
+        munmap(block.data, block.capacity);
+        return;
+    }
+#endif
+
+    ::operator delete(block.data, align_val_t{BUFFER_ALIGNMENT});
+}
+
+class SystemBufferPool : public BufferPool {
+public:
+    BufferBlock Allocate(size_t size) override {
+        return SystemAllocate(size);
+    }
+
+    void Deallocate(BufferBlock block) override {
+        SystemDeallocate(block);
+    }
+};
+
+atomic<BufferPool*> default_pool{nullptr};
+thread_local BufferPool* current_pool = nullptr;
+
+}  // namespace
+
+BufferPool& GetSystemBufferPool() {
+    static SystemBufferPool pool;
+    return pool;
+}
+
+RecyclingBufferPool::RecyclingBufferPool(size_t max_cached_bytes)
+    : max_cached_bytes_(max_cached_bytes) {
+}
+
+RecyclingBufferPool::~RecyclingBufferPool() {
+    for (const auto& [capacity, data] : free_blocks_) {
+        SystemDeallocate({data, capacity});
+    }
+}
+
+BufferBlock RecyclingBufferPool::Allocate(size_t size) {
+    if (size == 0) {
+        return {};
+    }
+
+    {
+        lock_guard lock(mutex_);
+        // подходит наименьший свободный блок не больше чем вдвое крупнее запроса,
+        // чтобы маленькие буферы не занимали надолго большие блоки
+        auto it = free_blocks_.lower_bound(size);
+        if (it != free_blocks_.end() && it->first / 2 <= size) {
+            const BufferBlock block = {it->second, it->first};
+            cached_bytes_ -= block.capacity;
+            free_blocks_.erase(it);
+            return block;
+        }
+    }
+
+    return SystemAllocate(size);
+}
+
+void RecyclingBufferPool::Deallocate(BufferBlock block) {
+    if (block.data == nullptr) {
+        return;
+    }
+
+    {
+        lock_guard lock(mutex_);
+        if (cached_bytes_ + block.capacity <= max_cached_bytes_) {
+            free_blocks_.emplace(block.capacity, block.data);
+            cached_bytes_ += block.capacity;
+            return;
+        }
+    }
+
+    SystemDeallocate(block);
+}
+
+void SetDefaultBufferPool(BufferPool* pool) {
+    default_pool.store(pool);
+}
+
+BufferPool& GetCurrentBufferPool() {
+    if (current_pool != nullptr) {
+        return *current_pool;
+    }
+    BufferPool* pool = default_pool.load();
+    return pool != nullptr ? *pool : GetSystemBufferPool();
+}
+
+ScopedBufferPool::ScopedBufferPool(BufferPool& pool)
+    : previous_(current_pool) {
+    current_pool = &pool;
+}
+
+ScopedBufferPool::~ScopedBufferPool() {
+    current_pool = previous_;
+}
+
+PooledBuffer::PooledBuffer(size_t size, BufferPool& pool)
+    : block_(pool.Allocate(size))
+    , size_(size)
+    , pool_(&pool) {
+}
+
+PooledBuffer::~PooledBuffer() {
+    Release();
+}
+
+PooledBuffer::PooledBuffer(const PooledBuffer& other)
+    : PooledBuffer(other.size_) {
+    if (size_ != 0) {
+        memcpy(block_.data, other.block_.data, size_);
+    }
+}
+
+PooledBuffer& PooledBuffer::operator=(const PooledBuffer& other) {
+    if (this != &other) {
+        *this = PooledBuffer(other);
+    }
+    return *this;
+}
+
+PooledBuffer::PooledBuffer(PooledBuffer&& other) noexcept
+    : block_(exchange(other.block_, {}))
+    , size_(exchange(other.size_, 0))
+    , pool_(exchange(other.pool_, nullptr)) {
+}
+
+PooledBuffer& PooledBuffer::operator=(PooledBuffer&& other) noexcept {
+    if (this != &other) {
+        Release();
+        block_ = exchange(other.block_, {});
+        size_ = exchange(other.size_, 0);
+        pool_ = exchange(other.pool_, nullptr);
+    }
+    return *this;
+}
+
+void PooledBuffer::Resize(size_t size) {
+    if (size > block_.capacity) {
+        BufferPool& pool = pool_ != nullptr ? *pool_ : GetCurrentBufferPool();
+        Release();
+        block_ = pool.Allocate(size);
+        pool_ = &pool;
+    }
+    size_ = size;
+}
+
+void PooledBuffer::Release() {
+    if (pool_ != nullptr) {
+        pool_->Deallocate(block_);
+    }
+    block_ = {};
+    size_ = 0;
+}
+
+}  // namespace img_lib
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+
+namespace img_lib {
+
+// Блок памяти из пула: capacity может быть больше запрошенного размера
+struct BufferBlock {
+    std::byte* data = nullptr;
+    size_t capacity = 0;
+};
+
+// Источник памяти для пикселей Image и рабочих буферов кодеков.
+// Реализации должны быть потокобезопасными: один пул обычно
+// разделяют все рабочие потоки пакетной конвертации
+class BufferPool {
+public:
+    virtual ~BufferPool() = default;
+
+    virtual BufferBlock Allocate(size_t size) = 0;
+    virtual void Deallocate(BufferBlock block) = 0;
+};
+
+// Пул, который ничего не кеширует: каждый блок берётся у системы и сразу
+// ей возвращается. Используется, пока другой пул не установлен
+BufferPool& GetSystemBufferPool();
+
+// Пул, переиспользующий освобождённые блоки. Подходит для долгоживущих
+// процессов, которые обрабатывают много изображений подряд: крупные буферы
+// не возвращаются системе, и повторные изображения не вызывают ни
+// выделений памяти, ни первых обращений к новым страницам.
+// Блоки от 2 МиБ выделяются через mmap с просьбой к ядру использовать
+// большие страницы (Linux), остальные - через operator new
+class RecyclingBufferPool : public BufferPool {
+public:
+    // max_cached_bytes ограничивает суммарный объём свободных блоков в кеше
+    explicit RecyclingBufferPool(size_t max_cached_bytes = size_t(1) << 30);
+    ~RecyclingBufferPool() override;
+
+    RecyclingBufferPool(const RecyclingBufferPool&) = delete;
+    RecyclingBufferPool& operator=(const RecyclingBufferPool&) = delete;
+
+    BufferBlock Allocate(size_t size) override;
+    void Deallocate(BufferBlock block) override;
+
+private:
+    std::mutex mutex_;
+    std::multimap<size_t, std::byte*> free_blocks_;  // ёмкость -> блок
+    size_t cached_bytes_ = 0;
+    size_t max_cached_bytes_;
+};
+
+// Пул процесса по умолчанию; nullptr возвращает системный пул.
+// Пул должен жить дольше всех выделенных из него буферов
+void SetDefaultBufferPool(BufferPool* pool);
+
+// Пул, из которого выделяют память Image и кодеки в текущем потоке:
+// установленный ScopedBufferPool, иначе пул процесса по умолчанию
+BufferPool& GetCurrentBufferPool();
+
+// Временно подменяет пул текущего потока
+class ScopedBufferPool {
+public:
+    explicit ScopedBufferPool(BufferPool& pool);
+    ~ScopedBufferPool();
+
+    ScopedBufferPool(const ScopedBufferPool&) = delete;
+    ScopedBufferPool& operator=(const ScopedBufferPool&) = delete;
+
+private:
+    BufferPool* previous_;
+};
+
+// Непрерывный буфер байтов, память которого берётся из пула.
+// Запоминает свой пул и возвращает блок именно в него.
+// Память не инициализируется: блок из кеша пула хранит старые данные
+class PooledBuffer {
+public:
+    PooledBuffer() = default;
+    explicit PooledBuffer(size_t size, BufferPool& pool = GetCurrentBufferPool());
+    ~PooledBuffer();
+
+    // копия выделяется из пула текущего потока
+    PooledBuffer(const PooledBuffer& other);
+    PooledBuffer& operator=(const PooledBuffer& other);
+    PooledBuffer(PooledBuffer&& other) noexcept;
+    PooledBuffer& operator=(PooledBuffer&& other) noexcept;
+
+    // меняет размер без сохранения содержимого: новая память
+    // берётся, только если не хватает текущей ёмкости
+    void Resize(size_t size);
+
+    std::byte* GetData() {
+        return block_.data;
+    }
+
+    const std::byte* GetData() const {
+        return block_.data;
+    }
+
+    size_t GetSize() const {
+        return size_;
+    }
+
+private:
+    void Release();
+
+    BufferBlock block_;
+    size_t size_ = 0;
+    BufferPool* pool_ = nullptr;
+};
+
+}  // namespace img_lib
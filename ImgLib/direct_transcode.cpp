@@ -0,0 +1,134 @@
+#include "direct_transcode.h"
+#include "bmp_image.h"
+#include "buffer_pool.h"
+#include "pixel_convert.h"
+#include "ppm_image.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <ostream>
+
+using namespace std;
+
+namespace img_lib {
+
+namespace {
+
+// не меньше стольких строк переставляется в буфер перед одной записью
+const int CHUNK_ROWS = 64;
+
+// Выход, который окажется тем же файлом, что и вход, обрезался бы при
+// открытии, пока вход отображён, и чтение отображения упало бы с SIGBUS
+bool IsSameFile(const Path& in_file, const Path& out_file) {
+    error_code ec;
+    return filesystem::equivalent(in_file, out_file, ec) && !ec;
+}
+
+// Пишет строки отображённого изображения в out в порядке файла:
+// сверху вниз или, с bottom_up, снизу вверх. Каналы меняются местами,
+// а строка дополняется нулями до out_stride байт
+bool WriteSwappedRows(const MappedPixels& pixels, int out_stride, bool bottom_up,
+                      const RasterOptions& raster, ostream& out) {
+    const ImageView view = bottom_up ? pixels.GetView().FlipVertical() : pixels.GetView();
+    const PixelFormat out_format = pixels.format == PixelFormat::RGB24 ? PixelFormat::BGR24 : PixelFormat::RGB24;
+    const int w = pixels.size.width;
+    const int h = pixels.size.height;
+    const int row_size = w * 3;
+    const int chunk_rows = GetParallelChunkRows(out_stride, size_t(CHUNK_ROWS) * out_stride, raster);
+
+    PooledBuffer chunk;
+    for (int done = 0; done < h;) {
+        const int k = min(chunk_rows, h - done);
+        chunk.Resize(size_t(k) * out_stride);
+
+        {
+            IMGLIB_TRACE_SCOPE("direct.swizzle");
+            ParallelForRows(k, out_stride, raster, [&](int begin, int end) {
+                ConvertRows(view.GetRowData(done + begin), view.GetStride(), view.GetFormat(),
+                            chunk.GetData() + size_t(begin) * out_stride, out_stride, out_format, w, end - begin);
+                for (int i = begin; i < end && out_stride > row_size; ++i) {
+                    memset(chunk.GetData() + size_t(i) * out_stride + row_size, 0, out_stride - row_size);
+                }
+            });
+        }
+
+        out.write(reinterpret_cast<const char*>(chunk.GetData()), chunk.GetSize());
+        done += k;
+    }
+    return out.good();
+}
+
+optional<TranscodeResult> TranscodeBMPToPPM(const Path& in_file, const Path& out_file,
+                                            const FileWriteOptions& options, const RasterOptions& raster) {
+    IMGLIB_TRACE_SCOPE("direct.bmp_to_ppm");
+    if (IsSameFile(in_file, out_file)) {
+        return nullopt;
+    }
+    const auto image = MapBMP(in_file);
+    if (!image) {
+        return nullopt;
+    }
+
+    const auto buf = OpenFileForWrite(out_file, options);
+    if (!buf) {
+        return TranscodeResult::WRITE_FAILED;
+    }
+    ostream out(buf.get());
+
+    // MappedPixels уже выдаёт строки BMP сверху вниз
+    WritePPMHeader(out, image->pixels.size);
+    const bool ok = WriteSwappedRows(image->pixels, image->pixels.size.width * 3, false, raster, out);
+    out.flush();
+    return ok && out ? TranscodeResult::OK : TranscodeResult::WRITE_FAILED;
+}
+
+optional<TranscodeResult> TranscodePPMToBMP(const Path& in_file, const Path& out_file,
+                                            const FileWriteOptions& options, const RasterOptions& raster) {
+    IMGLIB_TRACE_SCOPE("direct.ppm_to_bmp");
+    if (IsSameFile(in_file, out_file)) {
+        return nullopt;
+    }
+    const auto image = MapPPM(in_file);
+    if (!image) {
+        return nullopt;
+    }
+
+    const auto buf = OpenFileForWrite(out_file, options);
+    if (!buf) {
+        return TranscodeResult::WRITE_FAILED;
+    }
+    ostream out(buf.get());
+
+    // BMP хранит строки снизу вверх: первой в файле идёт нижняя строка
+    WriteBMPHeaders(out, image->pixels.size);
+    const bool ok = WriteSwappedRows(image->pixels, GetBMPStride(image->pixels.size.width), true, raster, out);
+    out.flush();
+    return ok && out ? TranscodeResult::OK : TranscodeResult::WRITE_FAILED;
+}
+
+struct DirectTranscoderEntry {
+    FileFormat in_format;
+    FileFormat out_format;
+    DirectTranscoder transcoder;
+};
+
+const array DIRECT_TRANSCODERS = {
+    DirectTranscoderEntry{FileFormat::BMP, FileFormat::PPM, TranscodeBMPToPPM},
+    DirectTranscoderEntry{FileFormat::PPM, FileFormat::BMP, TranscodePPMToBMP},
+};
+
+}  // namespace
+
+DirectTranscoder FindDirectTranscoder(FileFormat in_format, FileFormat out_format) {
+    for (const auto& entry : DIRECT_TRANSCODERS) {
+        if (entry.in_format == in_format && entry.out_format == out_format) {
+            return entry.transcoder;
+        }
+    }
+    return nullptr;
+}
+
+}  // namespace img_lib
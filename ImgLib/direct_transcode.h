@@ -0,0 +1,31 @@
+#pragma once
+#include "image_info.h"
+#include "image_stream.h"
+#include "output_file.h"
+#include "parallel_rows.h"
+
+#include <filesystem>
+#include <optional>
+
+namespace img_lib {
+using Path = std::filesystem::path;
+
+// Конвертация файла в файл без Image и без полос: строки берутся прямо
+// из отображения входного файла, переставляются одним проходом ядра
+// и пишутся в выходной файл по порядку, без переходов по файлу.
+// nullopt - быстрый путь неприменим (файл не отображается, его
+// заголовок не поддерживается или out_file - тот же файл, что in_file),
+// и нужно конвертировать обычным путём: он и сообщит об ошибке, если
+// она есть. В последнем случае и обычный путь должен писать через временный
+// файл: иначе открытие выхода обрежет ещё не прочитанный вход.
+// Перестановка кусков строк делится между потоками по raster
+using DirectTranscoder = std::optional<TranscodeResult> (*)(const Path& in_file, const Path& out_file,
+                                                            const FileWriteOptions& options,
+                                                            const RasterOptions& raster);
+
+// Быстрый путь для пары форматов, nullptr - если его нет.
+// Есть для BMP <-> PPM: оба хранят 8-битный RGB без сжатия и отличаются
+// только порядком каналов, порядком строк и выравниванием
+DirectTranscoder FindDirectTranscoder(FileFormat in_format, FileFormat out_format);
+
+}  // namespace img_lib
@@ -0,0 +1,174 @@
+#include "format_interface.h"
+#include "bmp_image.h"
+#include "ppm_image.h"
+
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+namespace img_lib {
+
+namespace {
+
+class ImagePPM : public ImageFormatInterface {
+public:
+    FileFormat GetFormat() const override {
+        return FileFormat::PPM;
+    }
+
+    bool SaveImage(const Path& file, const ImageView& image, const CodecOptions& options) const override {
+        return SavePPM(file, image, options.file_write, options.raster);
+    }
+
+    Image LoadImage(const Path& file, const CodecOptions& options) const override {
+        return LoadPPM(file, options.raster);
+    }
+
+    bool SaveImage(ByteBuffer& out, const ImageView& image, const CodecOptions& options) const override {
+        return SavePPM(out, image, options.raster);
+    }
+
+    Image LoadImage(ByteView data, const CodecOptions& options) const override {
+        return LoadPPM(data, options.raster);
+    }
+
+    unique_ptr<ImageReader> OpenReader(const Path& file, const CodecOptions& options) const override {
+        return OpenPPMReader(file, options.raster);
+    }
+
+    unique_ptr<ImageWriter> CreateWriter(const Path& file, Size size, const CodecOptions& options) const override {
+        return CreatePPMWriter(file, size, options.file_write, options.raster);
+    }
+
+    optional<ImageInfo> Probe(const Path& file) const override {
+        return ProbePPM(file);
+    }
+};
+
+class ImageJPEG : public ImageFormatInterface {
+public:
+    FileFormat GetFormat() const override {
+        return FileFormat::JPEG;
+    }
+
+    bool SaveImage(const Path& file, const ImageView& image, const CodecOptions& options) const override {
+        return SaveJPEG(file, image, options.jpeg_save);
+    }
+
+    Image LoadImage(const Path& file, const CodecOptions& options) const override {
+        return LoadJPEG(file, options.jpeg_load);
+    }
+
+    bool SaveImage(ByteBuffer& out, const ImageView& image, const CodecOptions& options) const override {
+        return SaveJPEG(out, image, options.jpeg_save);
+    }
+
+    Image LoadImage(ByteView data, const CodecOptions& options) const override {
+        return LoadJPEG(data, options.jpeg_load);
+    }
+
+    unique_ptr<ImageReader> OpenReader(const Path& file, const CodecOptions& options) const override {
+        return OpenJPEGReader(file, options.jpeg_load);
+    }
+
+    unique_ptr<ImageWriter> CreateWriter(const Path& file, Size size,
+                                         const CodecOptions& options) const override {
+        return CreateJPEGWriter(file, size, options.jpeg_save);
+    }
+
+    optional<ImageInfo> Probe(const Path& file) const override {
+        return ProbeJPEG(file);
+    }
+};
+
+class ImageBMP : public ImageFormatInterface {
+public:
+    FileFormat GetFormat() const override {
+        return FileFormat::BMP;
+    }
+
+    bool SaveImage(const Path& file, const ImageView& image, const CodecOptions& options) const override {
+        return SaveBMP(file, image, options.file_write, options.raster);
+    }
+
+    Image LoadImage(const Path& file, const CodecOptions& options) const override {
+        return LoadBMP(file, options.raster);
+    }
+
+    bool SaveImage(ByteBuffer& out, const ImageView& image, const CodecOptions& options) const override {
+        return SaveBMP(out, image, options.raster);
+    }
+
+    Image LoadImage(ByteView data, const CodecOptions& options) const override {
+        return LoadBMP(data, options.raster);
+    }
+
+    unique_ptr<ImageReader> OpenReader(const Path& file, const CodecOptions& options) const override {
+        return OpenBMPReader(file, options.raster);
+    }
+
+    unique_ptr<ImageWriter> CreateWriter(const Path& file, Size size, const CodecOptions& options) const override {
+        return CreateBMPWriter(file, size, options.file_write, options.raster);
+    }
+
+    optional<ImageInfo> Probe(const Path& file) const override {
+        return ProbeBMP(file);
+    }
+};
+
+}  // namespace
+
+optional<FileFormat> GetFormatByExtension(const Path& file) {
+    const string ext = file.extension().string();
+    if (ext == ".jpg"sv || ext == ".jpeg"sv) {
+        return FileFormat::JPEG;
+    }
+
+    if (ext == ".ppm"sv) {
+        return FileFormat::PPM;
+    }
+
+    if (ext == ".bmp"sv) {
+        return FileFormat::BMP;
+    }
+
+    return nullopt;
+}
+
+const ImageFormatInterface& GetFormatInterface(FileFormat format) {
+    static const ImagePPM ppmInterface;
+    static const ImageJPEG jpegInterface;
+    static const ImageBMP bmpInterface;
+
+    switch (format) {
+        case FileFormat::JPEG:
+            return jpegInterface;
+        case FileFormat::BMP:
+            return bmpInterface;
+        case FileFormat::PPM:
+        default:
+            return ppmInterface;
+    }
+}
+
+const ImageFormatInterface* GetFormatInterfaceByExtension(const Path& file) {
+    const auto format = GetFormatByExtension(file);
+    return format ? &GetFormatInterface(*format) : nullptr;
+}
+
+const ImageFormatInterface* DetectFormatInterface(const Path& file) {
+    if (const auto format = SniffFormat(file)) {
+        return &GetFormatInterface(*format);
+    }
+    return GetFormatInterfaceByExtension(file);
+}
+
+const ImageFormatInterface* DetectFormatInterface(const Path& file, ByteView data) {
+    if (const auto format = SniffFormat(data)) {
+        return &GetFormatInterface(*format);
+    }
+    return GetFormatInterfaceByExtension(file);
+}
+
+}  // namespace img_lib
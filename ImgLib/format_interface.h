@@ -0,0 +1,68 @@
+#pragma once
+#include "img_lib.h"
+#include "image_info.h"
+#include "image_stream.h"
+#include "jpeg_image.h"
+#include "memory_buffer.h"
+#include "output_file.h"
+#include "parallel_rows.h"
+
+#include <filesystem>
+#include <memory>
+#include <optional>
+
+namespace img_lib {
+using Path = std::filesystem::path;
+
+// Параметры кодеков, которые задаются вызывающим кодом.
+// Форматы без настраиваемых параметров их игнорируют
+struct CodecOptions {
+    JPEGLoadOptions jpeg_load;
+    JPEGSaveOptions jpeg_save;
+    FileWriteOptions file_write;  // запись PPM и BMP
+    RasterOptions raster;         // потоки перестановки строк PPM и BMP
+};
+
+// Единый интерфейс к кодекам всех форматов.
+// Реализации интерфейса не хранят состояния, поэтому один и тот же
+// объект можно безопасно использовать из нескольких потоков одновременно
+class ImageFormatInterface {
+public:
+    virtual FileFormat GetFormat() const = 0;
+
+    virtual bool SaveImage(const Path& file, const ImageView& image, const CodecOptions& options) const = 0;
+    virtual Image LoadImage(const Path& file, const CodecOptions& options) const = 0;
+
+    // то же для файла в памяти: результат записи заменяет содержимое out
+    virtual bool SaveImage(ByteBuffer& out, const ImageView& image, const CodecOptions& options) const = 0;
+    virtual Image LoadImage(ByteView data, const CodecOptions& options) const = 0;
+
+    // построчные чтение и запись для конвертации без полного кадра в памяти
+    virtual std::unique_ptr<ImageReader> OpenReader(const Path& file, const CodecOptions& options) const = 0;
+    virtual std::unique_ptr<ImageWriter> CreateWriter(const Path& file, Size size,
+                                                      const CodecOptions& options) const = 0;
+
+    // размеры и формат по одному заголовку, без декодирования
+    virtual std::optional<ImageInfo> Probe(const Path& file) const = 0;
+};
+
+std::optional<FileFormat> GetFormatByExtension(const Path& file);
+
+// Возвращает ссылку на статический объект формата. Статические объекты
+// инициализируются потокобезопасно, функции можно вызывать из рабочих потоков
+const ImageFormatInterface& GetFormatInterface(FileFormat format);
+
+// Формат по расширению, nullptr - если расширение неизвестно.
+// Подходит для выходных файлов, которых ещё нет
+const ImageFormatInterface* GetFormatInterfaceByExtension(const Path& file);
+
+// Формат входного файла: сначала по сигнатуре в первых байтах (одно
+// короткое чтение), а если её не удалось распознать или файл не открылся -
+// по расширению. nullptr - если не подошло ни то, ни другое
+const ImageFormatInterface* DetectFormatInterface(const Path& file);
+
+// То же для уже прочитанного содержимого файла: сигнатура берётся из data,
+// расширение - из имени file
+const ImageFormatInterface* DetectFormatInterface(const Path& file, ByteView data);
+
+}  // namespace img_lib
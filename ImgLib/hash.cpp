@@ -0,0 +1,137 @@
+#include "hash.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+namespace img_lib {
+
+namespace {
+
+constexpr uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+constexpr uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+constexpr uint64_t PRIME4 = 0x85EBCA77C2B2AE63ULL;
+constexpr uint64_t PRIME5 = 0x27D4EB2F165667C5ULL;
+
+uint64_t RotateLeft(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+// чтение little-endian независимо от порядка байт процессора
+uint64_t Read64(const byte* data) {
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; --i) {
+        value = (value << 8) | uint64_t(data[i]);
+    }
+    return value;
+}
+
+uint32_t Read32(const byte* data) {
+    uint32_t value = 0;
+    for (int i = 3; i >= 0; --i) {
+        value = (value << 8) | uint32_t(data[i]);
+    }
+    return value;
+}
+
+uint64_t Round(uint64_t acc, uint64_t input) {
+    acc += input * PRIME2;
+    acc = RotateLeft(acc, 31);
+    return acc * PRIME1;
+}
+
+uint64_t MergeRound(uint64_t acc, uint64_t value) {
+    acc ^= Round(0, value);
+    return acc * PRIME1 + PRIME4;
+}
+
+// обрабатывает целые 32-байтные блоки, возвращает число обработанных байт
+size_t ConsumeBlocks(array<uint64_t, 4>& acc, const byte* data, size_t size) {
+    const byte* p = data;
+    const byte* end = data + size / 32 * 32;
+    for (; p < end; p += 32) {
+        acc[0] = Round(acc[0], Read64(p));
+        acc[1] = Round(acc[1], Read64(p + 8));
+        acc[2] = Round(acc[2], Read64(p + 16));
+        acc[3] = Round(acc[3], Read64(p + 24));
+    }
+    return size_t(p - data);
+}
+
+}  // namespace
+
+Hasher::Hasher(uint64_t seed)
+    : acc_{seed + PRIME1 + PRIME2, seed + PRIME2, seed, seed - PRIME1}
+    , seed_(seed) {
+}
+
+void Hasher::Update(ByteView data) {
+    const byte* p = data.GetData();
+    size_t size = data.GetSize();
+    total_size_ += size;
+
+    if (tail_size_ > 0) {
+        const size_t take = min(size, tail_.size() - tail_size_);
+        memcpy(tail_.data() + tail_size_, p, take);
+        tail_size_ += take;
+        p += take;
+        size -= take;
+        if (tail_size_ < tail_.size()) {
+            return;
+        }
+        ConsumeBlocks(acc_, tail_.data(), tail_.size());
+        tail_size_ = 0;
+    }
+
+    const size_t consumed = ConsumeBlocks(acc_, p, size);
+    tail_size_ = size - consumed;
+    if (tail_size_ > 0) {
+        memcpy(tail_.data(), p + consumed, tail_size_);
+    }
+}
+
+uint64_t Hasher::Finish() const {
+    uint64_t hash;
+    if (total_size_ >= 32) {
+        hash = RotateLeft(acc_[0], 1) + RotateLeft(acc_[1], 7) + RotateLeft(acc_[2], 12) + RotateLeft(acc_[3], 18);
+        for (uint64_t acc : acc_) {
+            hash = MergeRound(hash, acc);
+        }
+    } else {
+        hash = seed_ + PRIME5;
+    }
+    hash += total_size_;
+
+    const byte* p = tail_.data();
+    const byte* end = p + tail_size_;
+    for (; p + 8 <= end; p += 8) {
+        hash ^= Round(0, Read64(p));
+        hash = RotateLeft(hash, 27) * PRIME1 + PRIME4;
+    }
+    if (p + 4 <= end) {
+        hash ^= uint64_t(Read32(p)) * PRIME1;
+        hash = RotateLeft(hash, 23) * PRIME2 + PRIME3;
+        p += 4;
+    }
+    for (; p < end; ++p) {
+        hash ^= uint64_t(*p) * PRIME5;
+        hash = RotateLeft(hash, 11) * PRIME1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= PRIME2;
+    hash ^= hash >> 29;
+    hash *= PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+uint64_t HashBytes(ByteView data, uint64_t seed) {
+    Hasher hasher(seed);
+    hasher.Update(data);
+    return hasher.Finish();
+}
+
+}  // namespace img_lib
@@ -0,0 +1,30 @@
+#pragma once
+#include "memory_buffer.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace img_lib {
+
+// 64-битный некриптографический хеш XXH64. Считается со скоростью чтения
+// памяти, поэтому подходит для ключей кэша по содержимому файлов.
+// Данные можно подавать частями: результат не зависит от разбиения
+class Hasher {
+public:
+    explicit Hasher(uint64_t seed = 0);
+
+    void Update(ByteView data);
+    uint64_t Finish() const;
+
+private:
+    std::array<uint64_t, 4> acc_;
+    std::array<std::byte, 32> tail_;  // неполный блок между вызовами Update
+    size_t tail_size_ = 0;
+    uint64_t total_size_ = 0;
+    uint64_t seed_;
+};
+
+uint64_t HashBytes(ByteView data, uint64_t seed = 0);
+
+}  // namespace img_lib
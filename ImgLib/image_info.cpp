@@ -0,0 +1,71 @@
+#include "image_info.h"
+#include "bmp_image.h"
+#include "jpeg_image.h"
+#include "ppm_image.h"
+
+#include <array>
+#include <cctype>
+#include <fstream>
+
+using namespace std;
+
+namespace img_lib {
+
+string_view GetFileFormatName(FileFormat format) {
+    switch (format) {
+        case FileFormat::PPM:
+            return "PPM"sv;
+        case FileFormat::BMP:
+            return "BMP"sv;
+        case FileFormat::JPEG:
+            return "JPEG"sv;
+    }
+    return {};
+}
+
+optional<FileFormat> SniffFormat(ByteView header) {
+    const auto* bytes = reinterpret_cast<const unsigned char*>(header.GetData());
+    const size_t size = header.GetSize();
+
+    if (size >= 3 && bytes[0] == 0xFF && bytes[1] == 0xD8 && bytes[2] == 0xFF) {
+        return FileFormat::JPEG;
+    }
+    if (size >= 2 && bytes[0] == 'B' && bytes[1] == 'M') {
+        return FileFormat::BMP;
+    }
+    if (size >= 3 && bytes[0] == 'P' && bytes[1] == '6' && isspace(bytes[2])) {
+        return FileFormat::PPM;
+    }
+    return nullopt;
+}
+
+optional<FileFormat> SniffFormat(const Path& file) {
+    error_code ec;
+    if (!filesystem::is_regular_file(file, ec)) {
+        return nullopt;
+    }
+
+    ifstream in(file, ios::binary);
+    array<char, SNIFF_BYTES> header;
+    in.read(header.data(), header.size());
+    return SniffFormat(ByteView(header.data(), size_t(in.gcount())));
+}
+
+optional<ImageInfo> Probe(const Path& file) {
+    const auto format = SniffFormat(file);
+    if (!format) {
+        return nullopt;
+    }
+
+    switch (*format) {
+        case FileFormat::JPEG:
+            return ProbeJPEG(file);
+        case FileFormat::BMP:
+            return ProbeBMP(file);
+        case FileFormat::PPM:
+        default:
+            return ProbePPM(file);
+    }
+}
+
+}  // namespace img_lib
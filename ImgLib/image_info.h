@@ -0,0 +1,45 @@
+#pragma once
+#include "img_lib.h"
+#include "memory_buffer.h"
+
+#include <filesystem>
+#include <optional>
+#include <string_view>
+
+namespace img_lib {
+using Path = std::filesystem::path;
+
+enum class FileFormat {
+    PPM,
+    BMP,
+    JPEG,
+};
+
+std::string_view GetFileFormatName(FileFormat format);
+
+// столько первых байт файла нужно SniffFormat
+inline constexpr size_t SNIFF_BYTES = 3;
+
+// Определяет формат по сигнатуре: "BM" - BMP, "P6" и пробельный символ - PPM,
+// FF D8 FF - JPEG. Смотрит не больше SNIFF_BYTES байт,
+// nullopt - если сигнатура не распознана
+std::optional<FileFormat> SniffFormat(ByteView header);
+
+// То же для начала файла: одно чтение SNIFF_BYTES байт. Каналы и другие
+// необычные файлы не читаются, иначе прочитанные байты пропали бы для декодера.
+// nullopt - если сигнатура не распознана или файл не удалось прочитать
+std::optional<FileFormat> SniffFormat(const Path& file);
+
+// Сведения из заголовка файла, без декодирования пикселей
+struct ImageInfo {
+    FileFormat format = FileFormat::PPM;
+    Size size = {0, 0};
+    int channels = 0;          // компонент цвета в файле: 1 - оттенки серого, 3 - цветное
+    int bits_per_channel = 0;
+};
+
+// Определяет формат по сигнатуре и читает только заголовок файла.
+// nullopt - если файл не удалось открыть или ни один формат не подошёл
+std::optional<ImageInfo> Probe(const Path& file);
+
+}  // namespace img_lib
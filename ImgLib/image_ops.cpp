@@ -0,0 +1,53 @@
+#include "image_ops.h"
+#include "trace.h"
+
+#include <tuple>
+
+using namespace std;
+
+namespace img_lib {
+
+namespace {
+
+auto AsTuple(const optional<Rect>& rect) {
+    return rect ? make_tuple(true, rect->x, rect->y, rect->width, rect->height) : make_tuple(false, 0, 0, 0, 0);
+}
+
+auto AsTuple(const optional<Size>& size) {
+    return size ? make_tuple(true, size->width, size->height) : make_tuple(false, 0, 0);
+}
+
+}  // namespace
+
+bool operator==(const ImageOps& lhs, const ImageOps& rhs) {
+    return AsTuple(lhs.crop) == AsTuple(rhs.crop)
+        && lhs.flip_horizontal == rhs.flip_horizontal
+        && lhs.flip_vertical == rhs.flip_vertical
+        && AsTuple(lhs.resize) == AsTuple(rhs.resize)
+        // фильтр без изменения размера ничего не значит
+        && (!lhs.resize || lhs.resize_filter == rhs.resize_filter);
+}
+
+bool operator!=(const ImageOps& lhs, const ImageOps& rhs) {
+    return !(lhs == rhs);
+}
+
+Image ApplyImageOps(const ImageView& image, const ImageOps& ops, const RasterOptions& raster) {
+    IMGLIB_TRACE_SCOPE("image_ops");
+    ImageView view = image;
+    if (ops.crop) {
+        view = view.Crop(ops.crop->x, ops.crop->y, ops.crop->width, ops.crop->height);
+    }
+    if (ops.flip_vertical) {
+        view = view.FlipVertical();
+    }
+    if (!view) {
+        return {};
+    }
+
+    const Size source = {view.GetWidth(), view.GetHeight()};
+    const Size size = ops.resize ? GetResizeTarget(source, *ops.resize) : source;
+    return Resize(view, size, {ops.resize_filter, raster, ops.flip_horizontal});
+}
+
+}  // namespace img_lib
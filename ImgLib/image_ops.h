@@ -0,0 +1,45 @@
+#pragma once
+#include "img_lib.h"
+#include "parallel_rows.h"
+#include "resize.h"
+
+#include <optional>
+
+namespace img_lib {
+
+// Прямоугольная область изображения
+struct Rect {
+    int x = 0;
+    int y = 0;
+    int width = 0;
+    int height = 0;
+};
+
+// Обработка кадра между загрузкой и сохранением. Операции выполняются
+// в порядке полей: обрезка в координатах исходного кадра, отражения,
+// изменение размера
+struct ImageOps {
+    std::optional<Rect> crop;
+    bool flip_horizontal = false;  // слева направо
+    bool flip_vertical = false;    // сверху вниз
+
+    // нулевая сторона вычисляется по пропорциям, см. GetResizeTarget
+    std::optional<Size> resize;
+    ResizeFilter resize_filter = ResizeFilter::LANCZOS3;
+
+    bool IsEmpty() const {
+        return !crop && !flip_horizontal && !flip_vertical && !resize;
+    }
+};
+
+bool operator==(const ImageOps& lhs, const ImageOps& rhs);
+bool operator!=(const ImageOps& lhs, const ImageOps& rhs);
+
+// Выполняет операции одним проходом по пикселям: обрезка и отражение
+// сверху вниз только меняют вид на кадр, а отражение слева направо
+// делается при проходе по строкам в Resize. Результат всегда новый кадр,
+// даже если операций нет. Пустое изображение - если обрезка
+// выходит за границы кадра
+Image ApplyImageOps(const ImageView& image, const ImageOps& ops, const RasterOptions& raster = {});
+
+}  // namespace img_lib
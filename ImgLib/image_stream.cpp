@@ -0,0 +1,92 @@
+#include "image_stream.h"
+#include "pixel_convert.h"
+#include "trace.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace img_lib {
+
+namespace {
+
+class ImageReaderFromImage : public ImageReader {
+public:
+    explicit ImageReaderFromImage(Image image)
+        : image_(move(image)) {
+    }
+
+    Size GetSize() const override {
+        return {image_.GetWidth(), image_.GetHeight()};
+    }
+
+    PixelFormat GetPixelFormat() const override {
+        return image_.GetFormat();
+    }
+
+    int ReadRows(Image& band) override {
+        const int count = min(band.GetHeight(), image_.GetHeight() - rows_read_);
+        if (count > 0) {
+            ConvertRows(image_.GetRowData(rows_read_), image_.GetStride(), image_.GetFormat(),
+                        band.GetRowData(0), band.GetStride(), band.GetFormat(), image_.GetWidth(), count);
+        }
+        rows_read_ += count;
+        return count;
+    }
+
+private:
+    Image image_;
+    int rows_read_ = 0;
+};
+
+}  // namespace
+
+unique_ptr<ImageReader> MakeImageReader(Image image) {
+    return make_unique<ImageReaderFromImage>(move(image));
+}
+
+Image ReadWholeImage(unique_ptr<ImageReader> reader) {
+    if (!reader) {
+        return {};
+    }
+
+    const Size size = reader->GetSize();
+    Image result(size.width, size.height, reader->GetPixelFormat(), FOR_OVERWRITE);
+    if (reader->ReadRows(result) != size.height) {
+        return {};
+    }
+
+    return result;
+}
+
+bool WriteWholeImage(unique_ptr<ImageWriter> writer, const ImageView& image) {
+    return writer && writer->WriteRows(image, image.GetHeight()) && writer->Finish();
+}
+
+TranscodeResult TranscodeStream(ImageReader& reader, ImageWriter& writer, int band_rows) {
+    IMGLIB_TRACE_SCOPE("transcode_stream");
+    const Size size = reader.GetSize();
+    if (size.width <= 0 || size.height <= 0 || band_rows <= 0) {
+        return TranscodeResult::READ_FAILED;
+    }
+
+    // полоса в формате источника: конвертация каналов, если нужна, будет одна - при записи
+    Image band(size.width, min(band_rows, size.height), reader.GetPixelFormat(), FOR_OVERWRITE);
+
+    int rows_done = 0;
+    while (rows_done < size.height) {
+        const int count = reader.ReadRows(band);
+        if (count <= 0) {
+            // файл закончился раньше, чем заявлено в заголовке
+            return TranscodeResult::READ_FAILED;
+        }
+        if (!writer.WriteRows(band, count)) {
+            return TranscodeResult::WRITE_FAILED;
+        }
+        rows_done += count;
+    }
+
+    return writer.Finish() ? TranscodeResult::OK : TranscodeResult::WRITE_FAILED;
+}
+
+}  // namespace img_lib
@@ -0,0 +1,71 @@
+#pragma once
+#include "img_lib.h"
+
+#include <filesystem>
+#include <memory>
+
+namespace img_lib {
+using Path = std::filesystem::path;
+
+// Построчное чтение изображения без создания полного кадра.
+// Строки всегда выдаются сверху вниз, независимо от того,
+// в каком порядке они хранятся в файле
+class ImageReader {
+public:
+    virtual ~ImageReader() = default;
+
+    // размер изображения известен сразу после открытия
+    virtual Size GetSize() const = 0;
+
+    // формат пикселей в самом файле: полоса в этом формате
+    // заполняется без перестановки каналов
+    virtual PixelFormat GetPixelFormat() const = 0;
+
+    // читает следующие строки в полосу band, ширина band должна совпадать
+    // с шириной изображения, формат может быть любым. Возвращает число прочитанных строк (не больше
+    // высоты band), 0 - если строки закончились или произошла ошибка
+    virtual int ReadRows(Image& band) = 0;
+};
+
+// Построчная запись изображения, размер которого задан при создании
+class ImageWriter {
+public:
+    virtual ~ImageWriter() = default;
+
+    // записывает первые count строк полосы band следом за уже записанными,
+    // полоса может быть в любом формате пикселей и с любым шагом строк,
+    // например, областью большого изображения (см. ImageView::Crop)
+    virtual bool WriteRows(const ImageView& band, int count) = 0;
+
+    // завершает запись, должна вызываться после записи всех строк.
+    // Без вызова Finish файл может остаться неполным
+    virtual bool Finish() = 0;
+};
+
+// Построчный читатель поверх готового изображения в памяти.
+// Полезен, когда кодек может декодировать только кадр целиком
+std::unique_ptr<ImageReader> MakeImageReader(Image image);
+
+// Читает изображение целиком в кадр формата файла.
+// nullptr или ошибка чтения дают пустое изображение
+Image ReadWholeImage(std::unique_ptr<ImageReader> reader);
+
+// Записывает кадр одной полосой и завершает запись, false - при ошибке
+// или если writer равен nullptr
+bool WriteWholeImage(std::unique_ptr<ImageWriter> writer, const ImageView& image);
+
+// высота полосы по умолчанию: 64 строки ограничивают буфер
+// несколькими мегабайтами даже для очень широких изображений
+inline constexpr int DEFAULT_BAND_ROWS = 64;
+
+enum class TranscodeResult {
+    OK,
+    READ_FAILED,
+    WRITE_FAILED,
+};
+
+// Перекачивает изображение из reader в writer полосами по band_rows строк.
+// Пиковая память ограничена одной полосой плюс буферами кодеков
+TranscodeResult TranscodeStream(ImageReader& reader, ImageWriter& writer, int band_rows = DEFAULT_BAND_ROWS);
+
+}  // namespace img_lib
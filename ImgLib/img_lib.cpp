@@ -1,23 +1,54 @@
 #include "img_lib.h"
 
+#include <algorithm>
+#include <cstring>
+
 namespace img_lib {
 
 Image::Image(int w, int h, Color fill)
     : width_(w)
     , height_(h)
     , step_(w)
-    , pixels_(step_ * height_, fill) {
+    , format_(PixelFormat::RGBA32)
+    , pixels_(size_t(step_) * height_ * sizeof(Color)) {
+    Color* data = reinterpret_cast<Color*>(pixels_.GetData());
+    std::fill(data, data + size_t(step_) * height_, fill);
+}
+
+Image::Image(int w, int h, PixelFormat format)
+    : Image(w, h, format, FOR_OVERWRITE) {
+    if (pixels_.GetSize() != 0) {
+        std::memset(pixels_.GetData(), 0, pixels_.GetSize());
+    }
+}
+
+// PooledBuffer не инициализирует память, поэтому достаточно не заполнять её
+Image::Image(int w, int h, PixelFormat format, ForOverwrite)
+    : width_(w)
+    , height_(h)
+    , step_(w)
+    , format_(format)
+    , pixels_(size_t(step_) * height_ * GetBytesPerPixel(format)) {
 }
 
 Color* Image::GetLine(int y) {
-    assert(y >= 0 && y < height_);
-    return pixels_.data() + step_ * y;
+    assert(format_ == PixelFormat::RGBA32);
+    return reinterpret_cast<Color*>(GetRowData(y));
 }
 
 const Color* Image::GetLine(int y) const {
     return const_cast<Image*>(this)->GetLine(y);
 }
 
+std::byte* Image::GetRowData(int y) {
+    assert(y >= 0 && y < height_);
+    return pixels_.GetData() + size_t(step_) * y * GetBytesPerPixel(format_);
+}
+
+const std::byte* Image::GetRowData(int y) const {
+    return const_cast<Image*>(this)->GetRowData(y);
+}
+
 int Image::GetWidth() const {
     return width_;
 }
@@ -26,10 +57,44 @@ int Image::GetHeight() const {
     return height_;
 }
 
+PixelFormat Image::GetFormat() const {
+    return format_;
+}
+
 // шаг задаёт смещение соседних строк изображения
 // он обычно совпадает с width, но может быть больше
 int Image::GetStep() const {
     return step_;
 }
 
+std::ptrdiff_t Image::GetStride() const {
+    return std::ptrdiff_t(step_) * GetBytesPerPixel(format_);
+}
+
+ImageView Image::Crop(int x, int y, int w, int h) const {
+    return ImageView(*this).Crop(x, y, w, h);
+}
+
+ImageView::ImageView(const Image& image) {
+    if (image) {
+        *this = ImageView(image.GetRowData(0), image.GetWidth(), image.GetHeight(),
+                          image.GetStride(),
+                          image.GetFormat());
+    }
+}
+
+ImageView ImageView::Crop(int x, int y, int w, int h) const {
+    if (x < 0 || y < 0 || w <= 0 || h <= 0 || x > width_ - w || y > height_ - h) {
+        return {};
+    }
+    return ImageView(GetRowData(y) + size_t(x) * GetBytesPerPixel(format_), w, h, stride_, format_);
+}
+
+ImageView ImageView::FlipVertical() const {
+    if (!*this) {
+        return {};
+    }
+    return ImageView(GetRowData(height_ - 1), width_, height_, -stride_, format_);
+}
+
 }  // namespace img_lib
\ No newline at end of file
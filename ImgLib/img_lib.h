@@ -1,9 +1,10 @@
 #pragma once
 
+#include "buffer_pool.h"
+
 #include <array>
 #include <cassert>
 #include <cstddef>
-#include <vector>
 
 namespace img_lib {
 
@@ -20,15 +21,94 @@ struct Color {
     std::byte r, g, b, a;
 };
 
+// упакованные 24-битные пиксели без альфа-канала, как в файлах PPM и BMP
+struct RGB24 {
+    std::byte r, g, b;
+};
+
+struct BGR24 {
+    std::byte b, g, r;
+};
+
+// 32-битный пиксель BMP: четвёртый байт в файлах не хранит прозрачность
+struct BGRA32 {
+    std::byte b, g, r, a;
+};
+
+// Формат хранения пикселей в Image. Ни один из поддерживаемых файловых
+// форматов не хранит прозрачность, поэтому загрузчики выбирают формат строк
+// своего файла (24 бита, BGRA32 - у 32-битного BMP), а RGBA32 остаётся
+// для изображений, созданных в памяти
+enum class PixelFormat {
+    RGBA32,
+    RGB24,
+    BGR24,
+    BGRA32,
+};
+
+constexpr int GetBytesPerPixel(PixelFormat format) {
+    return format == PixelFormat::RGBA32 || format == PixelFormat::BGRA32 ? 4 : 3;
+}
+
+// сопоставление типа пикселя и формата для типизированного доступа к строкам
+// и для ядер, которые собираются шаблонами под пару форматов
+template <typename Pixel>
+struct PixelTraits;
+
+template <>
+struct PixelTraits<Color> {
+    static constexpr PixelFormat format = PixelFormat::RGBA32;
+    static constexpr bool has_alpha = true;
+};
+
+template <>
+struct PixelTraits<RGB24> {
+    static constexpr PixelFormat format = PixelFormat::RGB24;
+    static constexpr bool has_alpha = false;
+};
+
+template <>
+struct PixelTraits<BGR24> {
+    static constexpr PixelFormat format = PixelFormat::BGR24;
+    static constexpr bool has_alpha = false;
+};
+
+template <>
+struct PixelTraits<BGRA32> {
+    static constexpr PixelFormat format = PixelFormat::BGRA32;
+    static constexpr bool has_alpha = true;
+};
+
+// Тег конструктора Image, который не заполняет пиксели. Нужен загрузчикам:
+// они всё равно перезаписывают каждый пиксель, а лишнее заполнение
+// стоит прохода по всей памяти изображения до начала декодирования
+struct ForOverwrite {
+    explicit ForOverwrite() = default;
+};
+
+inline constexpr ForOverwrite FOR_OVERWRITE{};
+
+class ImageView;
+
 class Image {
 public:
     // создаёт пустое изображение
     Image() = default;
 
-    // создаёт изображение заданного размера, заполняя его заданным цветом
+    // Память пикселей во всех конструкторах выделяется из GetCurrentBufferPool()
+
+    // создаёт изображение заданного размера в формате RGBA32,
+    // заполняя его заданным цветом
     Image(int w, int h, Color fill);
 
-    // геттеры для отдельного пикселя изображения
+    // создаёт изображение заданного размера и формата, заполненное нулями
+    Image(int w, int h, PixelFormat format);
+
+    // создаёт изображение заданного размера и формата, не инициализируя пиксели:
+    // их содержимое не определено, пока не будет записано
+    Image(int w, int h, PixelFormat format, ForOverwrite);
+
+    // геттеры для отдельного пикселя изображения, только для RGBA32
     Color GetPixel(int x, int y) const {
         return const_cast<Image*>(this)->GetPixel(x, y);
     }
@@ -37,17 +117,37 @@ public:
         return GetLine(y)[x];
     }
 
-    // геттер для заданной строки изображения
+    // геттер для заданной строки изображения, только для RGBA32
     Color* GetLine(int y);
     const Color* GetLine(int y) const;
 
+    // типизированный доступ к строке: тип пикселя должен соответствовать формату
+    template <typename Pixel>
+    Pixel* GetRow(int y) {
+        assert(PixelTraits<Pixel>::format == format_);
+        return reinterpret_cast<Pixel*>(GetRowData(y));
+    }
+
+    template <typename Pixel>
+    const Pixel* GetRow(int y) const {
+        return const_cast<Image*>(this)->GetRow<Pixel>(y);
+    }
+
+    // байты заданной строки в формате GetFormat()
+    std::byte* GetRowData(int y);
+    const std::byte* GetRowData(int y) const;
+
     int GetWidth() const;
     int GetHeight() const;
+    PixelFormat GetFormat() const;
 
-    // шаг задаёт смещение соседних строк изображения
+    // шаг задаёт смещение соседних строк изображения в пикселях
     // он обычно совпадает с шириной, но может быть больше неё
     int GetStep() const;
 
+    // то же смещение в байтах, как у ImageView
+    std::ptrdiff_t GetStride() const;
+
     // будем считать изображение корректным, если
     // его площадь положительна
     explicit operator bool() const {
@@ -58,12 +158,92 @@ public:
         return !operator bool();
     }
 
+    // прямоугольная область без копирования пикселей, см. ImageView::Crop
+    ImageView Crop(int x, int y, int w, int h) const;
+
 private:
     int width_ = 0;
     int height_ = 0;
-    int step_;
+    int step_ = 0;
+    PixelFormat format_ = PixelFormat::RGBA32;
+
+    // память берётся из пула текущего потока, см. buffer_pool.h
+    PooledBuffer pixels_;
+};
+
+// Вид на пиксели чужого изображения только для чтения: ничем не владеет
+// и ничего не копирует, поэтому передаётся по значению. Шаг строк задаётся
+// в байтах и может быть отрицательным - так выглядят строки BMP, которые
+// хранятся в файле снизу вверх. Память пикселей должна жить, пока с видом работают.
+// Все кодеки принимают на сохранение вид, а Image приводится к нему неявно
+class ImageView {
+public:
+    // создаёт пустой вид
+    ImageView() = default;
+
+    ImageView(const std::byte* top_row, int w, int h, std::ptrdiff_t stride, PixelFormat format)
+        : top_row_(top_row)
+        , width_(w)
+        , height_(h)
+        , stride_(stride)
+        , format_(format) {
+    }
+
+    // вид на всё изображение
+    ImageView(const Image& image);
+
+    // байты заданной строки в формате GetFormat()
+    const std::byte* GetRowData(int y) const {
+        assert(y >= 0 && y < height_);
+        return top_row_ + stride_ * y;
+    }
+
+    // типизированный доступ к строке: тип пикселя должен соответствовать формату
+    template <typename Pixel>
+    const Pixel* GetRow(int y) const {
+        assert(PixelTraits<Pixel>::format == format_);
+        return reinterpret_cast<const Pixel*>(GetRowData(y));
+    }
+
+    int GetWidth() const {
+        return width_;
+    }
+
+    int GetHeight() const {
+        return height_;
+    }
 
-    std::vector<Color> pixels_;
+    PixelFormat GetFormat() const {
+        return format_;
+    }
+
+    // смещение соседних строк в байтах
+    std::ptrdiff_t GetStride() const {
+        return stride_;
+    }
+
+    // Прямоугольная область с левым верхним углом (x, y) и теми же
+    // пикселями, что у исходного вида. Пустой вид - если область
+    // пуста или не лежит внутри вида целиком
+    ImageView Crop(int x, int y, int w, int h) const;
+
+    // те же строки в обратном порядке, без копирования: шаг меняет знак
+    ImageView FlipVertical() const;
+
+    explicit operator bool() const {
+        return width_ > 0 && height_ > 0;
+    }
+
+    bool operator!() const {
+        return !operator bool();
+    }
+
+private:
+    const std::byte* top_row_ = nullptr;
+    int width_ = 0;
+    int height_ = 0;
+    std::ptrdiff_t stride_ = 0;
+    PixelFormat format_ = PixelFormat::RGBA32;
 };
 
 }  // namespace img_lib
\ No newline at end of file
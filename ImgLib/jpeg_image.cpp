@@ -1,11 +1,24 @@
-#include "ppm_image.h"
-
+#include "jpeg_image.h"
+#include "jpeg_parallel.h"
+#include "pixel_convert.h"
+#include "buffer_pool.h"
+#include "mapped_file.h"
+#include "output_file.h"
+#include "trace.h"
+
+#include <algorithm>
 #include <array>
+#include <climits>
+#include <cstdint>
 #include <fstream>
+#include <memory>
+#include <optional>
 #include <stdio.h>
 #include <setjmp.h>
+#include <vector>
 
 #include <jpeglib.h>
+#include <jerror.h>
 
 using namespace std;
 
@@ -27,221 +40,728 @@ my_error_exit (j_common_ptr cinfo) {
     longjmp(myerr->setjmp_buffer, 1);
 }
 
-// В эту функцию вставлен код примера из библиотеки libjpeg.
-// Измените его, чтобы адаптировать к переменным file и image.
-// Задание качества уберите - будет использовано качество по умолчанию
-bool SaveJPEG(const Path& file, const Image& image) {
-    /* This struct contains the JPEG compression parameters and pointers to
-    * working space (which is allocated as needed by the JPEG library).
-    * It is possible to have several such structures, representing multiple
-    * compression/decompression processes, in existence at once.  We refer
-    * to any one struct (and its associated working data) as a "JPEG object".
-    */
-     jpeg_compress_struct cinfo;
-    /* This struct represents a JPEG error handler.  It is declared separately
-    * because applications often want to supply a specialized error handler
-    * (see the second half of this file for an example).  But here we just
-    * take the easy way out and use the standard error handler, which will
-    * print a message on stderr and call exit() if compression fails.
-    * Note that this struct must live as long as the main JPEG parameter
-    * struct, to avoid dangling-pointer problems.
-    */
-     jpeg_error_mgr jerr;
-    /* More stuff */
-    FILE * outfile;       /* target file */
-    JSAMPROW row_pointer[1];  /* pointer to JSAMPLE row[s] */
-    int row_stride;       /* physical row width in image buffer */
-
-    /* Step 1: allocate and initialize JPEG compression object */
-
-    /* We have to set up the error handler first, in case the initialization
-    * step fails.  (Unlikely, but it could happen if you are out of memory.)
-    * This routine fills in the contents of struct jerr, and returns jerr's
-    * address which we place into the link field in cinfo.
-    */
-    cinfo.err = jpeg_std_error(&jerr);
-    /* Now we can initialize the JPEG compression object. */
+// Тут не избежать функции открытия файла из языка C,
+// поэтому приходится использовать конвертацию пути к string.
+// Под Visual Studio это может быть опасно, и нужно применить
+// нестандартную функцию _wfopen
+static FILE* OpenCFile(const Path& file, bool for_write) {
+#ifdef _MSC_VER
+    return _wfopen(file.wstring().c_str(), for_write ? L"wb" : L"rb");
+#else
+    return fopen(file.string().c_str(), for_write ? "wb" : "rb");
+#endif
+}
+
+// тип JSAMPLE фактически псевдоним для unsigned char
+// libjpeg выдаёт строки в формате RGB24
+void SaveSсanlineToImage(const JSAMPLE* row, int y, Image& out_image) {
+    ConvertRow(reinterpret_cast<const std::byte*>(row), PixelFormat::RGB24,
+               out_image.GetRowData(y), out_image.GetFormat(), out_image.GetWidth());
+}
+
+static J_DCT_METHOD ToLibJPEG(JPEGDCTMethod method) {
+    switch (method) {
+        case JPEGDCTMethod::IFAST:
+            return JDCT_IFAST;
+        case JPEGDCTMethod::FLOAT:
+            return JDCT_FLOAT;
+        case JPEGDCTMethod::ISLOW:
+        default:
+            return JDCT_ISLOW;
+    }
+}
+
+// Приёмник libjpeg, пишущий сразу в ByteBuffer. jpeg_mem_dest выделяет
+// собственный буфер через malloc, и результат пришлось бы копировать.
+// Буфер растёт удвоением, лишний хвост обрезается в конце сжатия
+struct ByteBufferDestination {
+    struct jpeg_destination_mgr pub; /* public fields */
+    ByteBuffer* buffer;
+};
+
+static const size_t JPEG_DESTINATION_MIN_SIZE = 64 * 1024;
+
+METHODDEF(void)
+init_buffer_destination(j_compress_ptr cinfo) {
+    ByteBufferDestination* dest = reinterpret_cast<ByteBufferDestination*>(cinfo->dest);
+    ByteBuffer& buffer = *dest->buffer;
+    try {
+        buffer.resize(max(buffer.capacity(), JPEG_DESTINATION_MIN_SIZE));
+    } catch (const bad_alloc&) {
+        // исключение нельзя пропускать через код libjpeg на C
+        ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 0);
+    }
+    dest->pub.next_output_byte = reinterpret_cast<JOCTET*>(buffer.data());
+    dest->pub.free_in_buffer = buffer.size();
+}
+
+METHODDEF(boolean)
+empty_buffer_destination(j_compress_ptr cinfo) {
+    ByteBufferDestination* dest = reinterpret_cast<ByteBufferDestination*>(cinfo->dest);
+    ByteBuffer& buffer = *dest->buffer;
+    // libjpeg вызывает эту функцию, только когда буфер заполнен целиком
+    const size_t used = buffer.size();
+    try {
+        buffer.resize(used * 2);
+    } catch (const bad_alloc&) {
+        ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 1);
+    }
+    dest->pub.next_output_byte = reinterpret_cast<JOCTET*>(buffer.data()) + used;
+    dest->pub.free_in_buffer = buffer.size() - used;
+    return TRUE;
+}
+
+METHODDEF(void)
+term_buffer_destination(j_compress_ptr cinfo) {
+    ByteBufferDestination* dest = reinterpret_cast<ByteBufferDestination*>(cinfo->dest);
+    dest->buffer->resize(dest->buffer->size() - dest->pub.free_in_buffer);
+}
+
+// Строки передаются в libjpeg пачками: один вызов jpeg_*_scanlines на полосу
+// или на JPEG_BUFFER_ROWS строк, если полосу приходится конвертировать через
+// буфер. 16 строк - высота MCU при стандартной субдискретизации 2x2, кодер
+// всё равно накапливает столько строк, прежде чем начать сжатие
+static const int JPEG_BUFFER_ROWS = 16;
+
+namespace {
+
+// Объект libjpeg вместе со своим обработчиком ошибок
+template <typename CInfo>
+struct JPEGContext {
+    CInfo cinfo;
+    my_error_mgr jerr;
+    long default_max_memory = 0;  // предел памяти libjpeg при создании, см. JPEGLoadOptions::max_memory
+};
+
+// libjpeg не даёт сменить тип источника или приёмника у созданного объекта,
+// поэтому объекты для файлов и для памяти хранятся раздельно
+enum class JPEGStream {
+    FILE,
+    MEMORY,
+};
+
+void CreateJPEGObject(jpeg_compress_struct& cinfo) {
     jpeg_create_compress(&cinfo);
+}
 
-    /* Step 2: specify data destination (eg, a file) */
-    /* Note: steps 2 and 3 can be done in either order. */
+void CreateJPEGObject(jpeg_decompress_struct& cinfo) {
+    jpeg_create_decompress(&cinfo);
+}
 
-    /* Here we use the library-supplied code to send compressed data to a
-    * stdio stream.  You can also write your own code to do something else.
-    * VERY IMPORTANT: use "b" option to fopen() if you are on a machine that
-    * requires it in order to write binary files.
-    */
+void DestroyJPEGObject(jpeg_compress_struct& cinfo) {
+    jpeg_destroy_compress(&cinfo);
+}
+
+void DestroyJPEGObject(jpeg_decompress_struct& cinfo) {
+    jpeg_destroy_decompress(&cinfo);
+}
 
-    #ifdef _MSC_VER
-        if ((outfile = _wfopen(file.wstring().c_str(), L"wb")) == nullptr) {
-    #else
-        if ((outfile = fopen(file.string().c_str(), "wb")) == nullptr) {
-    #endif
-            jpeg_destroy_compress(&cinfo);
+// Свободные объекты libjpeg одного потока. jpeg_create_* выделяет постоянный
+// пул памяти, таблицы и менеджер источника, и на маленьких изображениях
+// это стоит больше самого кодирования. Поэтому освобождённый объект
+// сбрасывается jpeg_abort и ждёт следующего изображения этого потока,
+// а уничтожается только при завершении потока
+template <typename CInfo>
+class JPEGContextCache {
+public:
+    using Context = JPEGContext<CInfo>;
+
+    ~JPEGContextCache() {
+        for (auto& contexts : free_) {
+            for (auto& context : contexts) {
+                DestroyJPEGObject(context->cinfo);
+            }
+        }
+    }
+
+    // bad_alloc, если libjpeg не смог выделить память под объект
+    unique_ptr<Context> Acquire(JPEGStream stream) {
+        auto& contexts = free_[size_t(stream)];
+        if (!contexts.empty()) {
+            unique_ptr<Context> context = move(contexts.back());
+            contexts.pop_back();
+            return context;
+        }
+
+        auto context = make_unique<Context>();
+        context->cinfo.err = jpeg_std_error(&context->jerr.pub);
+        context->jerr.pub.error_exit = my_error_exit;
+        if (setjmp(context->jerr.setjmp_buffer)) {
+            throw bad_alloc();
+        }
+        CreateJPEGObject(context->cinfo);
+        context->default_max_memory = context->cinfo.mem->max_memory_to_use;
+        return context;
+    }
+
+    void Release(unique_ptr<Context> context, JPEGStream stream) {
+        // сбрасывает объект и после ошибки, освобождая память изображения
+        jpeg_abort(reinterpret_cast<j_common_ptr>(&context->cinfo));
+        context->cinfo.mem->max_memory_to_use = context->default_max_memory;
+
+        auto& contexts = free_[size_t(stream)];
+        if (contexts.size() < MAX_FREE_CONTEXTS) {
+            contexts.push_back(move(context));
+        } else {
+            DestroyJPEGObject(context->cinfo);
+        }
+    }
+
+private:
+    // одновременно открытых изображений на поток обычно одно-два
+    static const size_t MAX_FREE_CONTEXTS = 4;
+    array<vector<unique_ptr<Context>>, 2> free_;
+};
+
+// Объект libjpeg из кэша текущего потока, возвращается в кэш при разрушении
+template <typename CInfo>
+class PooledJPEGContext {
+public:
+    explicit PooledJPEGContext(JPEGStream stream)
+        : stream_(stream)
+        , context_(GetCache().Acquire(stream)) {
+    }
+
+    ~PooledJPEGContext() {
+        GetCache().Release(move(context_), stream_);
+    }
+
+    PooledJPEGContext(const PooledJPEGContext&) = delete;
+    PooledJPEGContext& operator=(const PooledJPEGContext&) = delete;
+
+    CInfo& GetInfo() {
+        return context_->cinfo;
+    }
+
+    my_error_mgr& GetErrorManager() {
+        return context_->jerr;
+    }
+
+private:
+    static JPEGContextCache<CInfo>& GetCache() {
+        thread_local JPEGContextCache<CInfo> cache;
+        return cache;
+    }
+
+    JPEGStream stream_;
+    unique_ptr<JPEGContext<CInfo>> context_;
+};
+
+// Код этого класса взят из примера библиотеки libjpeg и разбит на шаги:
+// конструктор и Start() - шаги 1-4, WriteRows() - шаг 5, Finish() - шаги 6-7.
+// Качество и метод ДКП задаются через JPEGSaveOptions.
+// Каждый метод, вызывающий libjpeg, ставит свою точку setjmp:
+// при ошибке кодировщик переходит в состояние failed_.
+// Пишет либо в файл outfile, либо в буфер memory
+class JPEGWriter : public ImageWriter {
+public:
+    JPEGWriter(FILE* outfile, ByteBuffer* memory, Size size, const JPEGSaveOptions& options)
+        /* Step 1: allocate and initialize JPEG compression object */
+        // объект берётся из кэша потока уже созданным, с обработчиком ошибок,
+        // который вместо exit() возвращается по longjmp в точку setjmp
+        : context_(outfile != nullptr ? JPEGStream::FILE : JPEGStream::MEMORY)
+        , cinfo_(context_.GetInfo())
+        , jerr_(context_.GetErrorManager())
+        , outfile_(outfile)
+        , size_(size)
+        , options_(options) {
+        dest_.buffer = memory;
+
+        //количество байт в JPEG_BUFFER_ROWS строках изображения
+        buffer_.Resize(size_t(size_.width) * 3 * JPEG_BUFFER_ROWS); /* JSAMPLEs in image_buffer */
+    }
+
+    ~JPEGWriter() override {
+        /* Step 7: release JPEG compression object */
+        // память изображения освобождает jpeg_abort при возврате объекта в кэш
+        if (outfile_ != nullptr) {
+            fclose(outfile_);
+        }
+    }
+
+    bool Start() {
+        IMGLIB_TRACE_SCOPE("jpeg.start_compress");
+        if (setjmp(jerr_.setjmp_buffer)) {
             return false;
         }
 
-    jpeg_stdio_dest(&cinfo, outfile);
+        /* Step 2: specify data destination (eg, a file) */
+        if (outfile_ != nullptr) {
+            jpeg_stdio_dest(&cinfo_, outfile_);
+        } else {
+            // структура приёмника принадлежит нам, libjpeg её не освобождает
+            dest_.buffer->clear();
+            dest_.pub.init_destination = init_buffer_destination;
+            dest_.pub.empty_output_buffer = empty_buffer_destination;
+            dest_.pub.term_destination = term_buffer_destination;
+            cinfo_.dest = &dest_.pub;
+        }
 
-    /* Step 3: set parameters for compression */
+        /* Step 3: set parameters for compression */
+
+        /* First we supply a description of the input image.
+        * Four fields of the cinfo struct must be filled in:
+        */
+        cinfo_.image_width = size_.width;  /* image width and height, in pixels */
+        cinfo_.image_height = size_.height;
+        cinfo_.input_components = 3;       /* # of color components per pixel */
+        cinfo_.in_color_space = JCS_RGB;   /* colorspace of input image */
+        /* Now use the library's routine to set default compression parameters.
+        * (You must set at least cinfo.in_color_space before calling this,
+        * since the defaults depend on the source color space.)
+        */
+        jpeg_set_defaults(&cinfo_);
+        /* Now you can set any non-default parameters you wish to.
+        * Here we just illustrate the use of quality (quantization table) scaling:
+        */
+        jpeg_set_quality(&cinfo_, options_.quality, TRUE /* limit to baseline-JPEG values */);
+        cinfo_.dct_method = ToLibJPEG(options_.dct_method);
+
+        /* Step 4: Start compressor */
+
+        /* TRUE ensures that we will write a complete interchange-JPEG file.
+        * Pass TRUE unless you are very sure of what you're doing.
+        */
+        jpeg_start_compress(&cinfo_, TRUE);
+        return true;
+    }
 
-    /* First we supply a description of the input image.
-    * Four fields of the cinfo struct must be filled in:
-    */
-    cinfo.image_width = image.GetWidth();  /* image width and height, in pixels */
-    cinfo.image_height = image.GetHeight();
-    cinfo.input_components = 3;       /* # of color components per pixel */
-    cinfo.in_color_space = JCS_RGB;   /* colorspace of input image */
-    /* Now use the library's routine to set default compression parameters.
-    * (You must set at least cinfo.in_color_space before calling this,
-    * since the defaults depend on the source color space.)
-    */
-    jpeg_set_defaults(&cinfo);
-    /* Now you can set any non-default parameters you wish to.
-    * Here we just illustrate the use of quality (quantization table) scaling:
-    */
-    //jpeg_set_quality(&cinfo, quality, TRUE /* limit to baseline-JPEG values */);
+    bool WriteRows(const ImageView& band, int count) override {
+        IMGLIB_TRACE_SCOPE("jpeg.encode");
+        if (failed_ || count > size_.height - int(cinfo_.next_scanline)) {
+            return false;
+        }
+        if (setjmp(jerr_.setjmp_buffer)) {
+            failed_ = true;
+            return false;
+        }
 
-    /* Step 4: Start compressor */
+        /* Step 5: while (scan lines remain to be written) */
+        /*           jpeg_write_scanlines(...); */
+        const bool direct = band.GetFormat() == PixelFormat::RGB24;
+        // без конвертации вся полоса уходит одним вызовом
+        const int chunk_rows = direct ? count : JPEG_BUFFER_ROWS;
+        row_pointers_.resize(chunk_rows);
+
+        for (int done = 0; done < count;) {
+            const int k = min(chunk_rows, count - done);
+            const size_t row_size = size_t(size_.width) * 3;
+            if (!direct) {
+                ConvertRows(band.GetRowData(done), band.GetStride(), band.GetFormat(),
+                            buffer_.GetData(), ptrdiff_t(row_size), PixelFormat::RGB24, size_.width, k);
+            }
+            for (int i = 0; i < k; ++i) {
+                // строки RGB24 libjpeg может читать прямо из изображения:
+                // на входные данные он только смотрит, поэтому const_cast безопасен
+                row_pointers_[i] = direct
+                    ? reinterpret_cast<JSAMPLE*>(const_cast<std::byte*>(band.GetRowData(done + i)))
+                    : reinterpret_cast<JSAMPLE*>(buffer_.GetData() + row_size * i);
+            }
+
+            //Функция libjpeg, которая записывает пачку строк изображения.
+            for (int written = 0; written < k;) {
+                const int n = jpeg_write_scanlines(&cinfo_, row_pointers_.data() + written, k - written);
+                if (n <= 0) {
+                    failed_ = true;
+                    return false;
+                }
+                written += n;
+            }
+            done += k;
+        }
+        return true;
+    }
 
-    /* TRUE ensures that we will write a complete interchange-JPEG file.
-    * Pass TRUE unless you are very sure of what you're doing.
-    */
-    jpeg_start_compress(&cinfo, TRUE);
+    bool Finish() override {
+        IMGLIB_TRACE_SCOPE("jpeg.finish_compress");
+        if (failed_ || cinfo_.next_scanline != cinfo_.image_height) {
+            return false;
+        }
+        if (setjmp(jerr_.setjmp_buffer)) {
+            failed_ = true;
+            return false;
+        }
 
-    /* Step 5: while (scan lines remain to be written) */
-    /*           jpeg_write_scanlines(...); */
+        /* Step 6: Finish compression */
+        jpeg_finish_compress(&cinfo_);
+        /* After finish_compress, we can flush the output file. */
+        if (outfile_ == nullptr) {
+            return true;
+        }
+        if (fflush(outfile_) != 0) {
+            return false;
+        }
+        IMGLIB_TRACE_BYTES(BYTES_WRITTEN, uint64_t(max(ftell(outfile_), 0L)));
+        return true;
+    }
 
-    /* Here we use the library's state variable cinfo.next_scanline as the
-    * loop counter, so that we don't have to keep track ourselves.
-    * To keep things simple, we pass one scanline per call; you can pass
-    * more if you wish, though.
+private:
+    /* This struct contains the JPEG compression parameters and pointers to
+    * working space (which is allocated as needed by the JPEG library).
     */
-    //количество байт в одной строке изображения
-    row_stride = image.GetWidth() * 3; /* JSAMPLEs per row in image_buffer */
+    PooledJPEGContext<jpeg_compress_struct> context_;
+    jpeg_compress_struct& cinfo_;
+    my_error_mgr& jerr_;
+    FILE* outfile_;       /* target file */
+    ByteBufferDestination dest_ = {};  /* target buffer if there's no file */
+    Size size_;
+    JPEGSaveOptions options_;
+    bool failed_ = false;
+
+    //Буфер для хранения строк изображения в формате, который понимает libjpeg.
+    PooledBuffer buffer_;
+    std::vector<JSAMPROW> row_pointers_;
+};
 
-    //Создаётся буфер для хранения одной строки изображения в формате, который понимает libjpeg.
-    std::vector<JSAMPLE> buffer(row_stride);
+// Читает либо из файла infile, либо из памяти memory
+class JPEGReader : public ImageReader {
+public:
+    // whole_frame - кадр будет загружен целиком и тоже занимает предел options.max_memory
+    JPEGReader(FILE* infile, ByteView memory, const JPEGLoadOptions& options, bool whole_frame)
+        /* Шаг 1: берём готовый объект декодирования JPEG из кэша потока */
+        : context_(infile != nullptr ? JPEGStream::FILE : JPEGStream::MEMORY)
+        , cinfo_(context_.GetInfo())
+        , jerr_(context_.GetErrorManager())
+        , infile_(infile)
+        , memory_(memory)
+        , options_(options)
+        , whole_frame_(whole_frame) {
+    }
 
-    //Пока строки не закончились — продолжаем заполнять буфер и передавать строки.
-    while (cinfo.next_scanline < cinfo.image_height) {
-        const Color* line = image.GetLine(cinfo.next_scanline);
-        for (int x = 0; x < image.GetWidth(); ++x) {
-            //Функция std::to_integer<unsigned char>() — это безопасный способ преобразовать std::byte в обычный unsigned char (байт).
-            //Это делает код более надёжным и совместимым с типами C++.
-            buffer[x * 3 + 0] = std::to_integer<unsigned char>(line[x].r);
-            buffer[x * 3 + 1] = std::to_integer<unsigned char>(line[x].g);
-            buffer[x * 3 + 2] = std::to_integer<unsigned char>(line[x].b);
+    ~JPEGReader() override {
+        /* Шаг 8: объект декодирования сбрасывается при возврате в кэш */
+        if (infile_ != nullptr) {
+            // libjpeg читает файл последовательно, позиция равна объёму прочитанного
+            IMGLIB_TRACE_BYTES(BYTES_READ, uint64_t(max(ftell(infile_), 0L)));
+            fclose(infile_);
         }
-        //массив со строкой 
-        row_pointer[0] = buffer.data();
-        //Функция libjpeg, которая записывает одну строку изображения.
-        jpeg_write_scanlines(&cinfo, row_pointer, 1);
     }
 
-    /* Step 6: Finish compression */
+    bool Start() {
+        IMGLIB_TRACE_SCOPE("jpeg.header");
+        if (setjmp(jerr_.setjmp_buffer)) {
+            return false;
+        }
+
+        /* Шаг 2: устанавливаем источник данных */
 
-    jpeg_finish_compress(&cinfo);
-    /* After finish_compress, we can close the output file. */
-    fclose(outfile);
+        if (infile_ != nullptr) {
+            jpeg_stdio_src(&cinfo_, infile_);
+        } else {
+            // старые версии libjpeg объявляют буфер неконстантным,
+            // хотя только читают его
+            jpeg_mem_src(&cinfo_, reinterpret_cast<unsigned char*>(const_cast<std::byte*>(memory_.GetData())),
+                         static_cast<unsigned long>(memory_.GetSize()));
+        }
 
-    /* Step 7: release JPEG compression object */
+        /* Шаг 3: читаем параметры изображения через jpeg_read_header() */
+
+        (void) jpeg_read_header(&cinfo_, TRUE);
+
+        /* Шаг 4: устанавливаем параметры декодирования */
+
+        // установим желаемый формат изображения
+        cinfo_.out_color_space = JCS_RGB;
+        cinfo_.output_components = 3;
+
+        cinfo_.dct_method = ToLibJPEG(options_.dct_method);
+        cinfo_.do_fancy_upsampling = options_.fancy_upsampling ? TRUE : FALSE;
+        cinfo_.scale_num = 1;
+        cinfo_.scale_denom = GetJPEGScaleDenom({int(cinfo_.image_width), int(cinfo_.image_height)}, options_);
+
+        if (options_.max_memory > 0) {
+            // Прогрессивному файлу нужны коэффициенты всего кадра: если они
+            // не помещаются в предел, jpeg_start_decompress завершится
+            // ошибкой, а не займёт память сверх него
+            jpeg_calc_output_dimensions(&cinfo_);
+            const uint64_t frame_bytes = whole_frame_
+                ? uint64_t(cinfo_.output_width) * cinfo_.output_height * cinfo_.output_components
+                : 0;
+            if (frame_bytes >= options_.max_memory) {
+                return false;
+            }
+            cinfo_.mem->max_memory_to_use = long(min<uint64_t>(options_.max_memory - frame_bytes, LONG_MAX));
+        }
 
-    /* This is an important step since it will release a good deal of memory. */
-    jpeg_destroy_compress(&cinfo);
+        /* Шаг 5: начинаем декодирование */
 
-    /* And we're done! */
-    return true;
-}
+        (void) jpeg_start_decompress(&cinfo_);
 
-// тип JSAMPLE фактически псевдоним для unsigned char
-void SaveSсanlineToImage(const JSAMPLE* row, int y, Image& out_image) {
-    Color* line = out_image.GetLine(y);
-    for (int x = 0; x < out_image.GetWidth(); ++x) {
-        const JSAMPLE* pixel = row + x * 3;
-        line[x] = Color{byte{pixel[0]}, byte{pixel[1]}, byte{pixel[2]}, byte{255}};
+        const int row_stride = cinfo_.output_width * cinfo_.output_components;
+
+        // буфер строк берём из пула ImgLib, а не из пулов libjpeg,
+        // чтобы он переиспользовался между изображениями.
+        // Декодер выдаёт за вызов до rec_outbuf_height строк
+        buffer_rows_ = max(JPEG_BUFFER_ROWS, cinfo_.rec_outbuf_height);
+        buffer_.Resize(size_t(row_stride) * buffer_rows_);
+        return true;
     }
-}
 
-Image LoadJPEG(const Path& file) {
-    jpeg_decompress_struct cinfo;
-    my_error_mgr jerr;
-    
-    FILE* infile;
-    JSAMPARRAY buffer;
-    int row_stride;
-
-    // Тут не избежать функции открытия файла из языка C,
-    // поэтому приходится использовать конвертацию пути к string.
-    // Под Visual Studio это может быть опасно, и нужно применить
-    // нестандартную функцию _wfopen
-#ifdef _MSC_VER
-    if ((infile = _wfopen(file.wstring().c_str(), "rb")) == NULL) {
-#else
-    if ((infile = fopen(file.string().c_str(), "rb")) == NULL) {
-#endif
-        return {};
+    Size GetSize() const override {
+        return {int(cinfo_.output_width), int(cinfo_.output_height)};
+    }
+
+    PixelFormat GetPixelFormat() const override {
+        return PixelFormat::RGB24;
     }
 
-    /* Шаг 1: выделяем память и инициализируем объект декодирования JPEG */
+    int ReadRows(Image& band) override {
+        IMGLIB_TRACE_SCOPE("jpeg.decode");
+        if (failed_) {
+            return 0;
+        }
+        if (setjmp(jerr_.setjmp_buffer)) {
+            failed_ = true;
+            return 0;
+        }
+
+        const int count = min(band.GetHeight(), int(cinfo_.output_height - cinfo_.output_scanline));
+
+        /* Шаг 6: while (остаются строки изображения) */
+        /*                     jpeg_read_scanlines(...); */
+
+        // в полосу RGB24 libjpeg пишет напрямую, иначе через буфер
+        const bool direct = band.GetFormat() == PixelFormat::RGB24;
+        const int chunk_rows = direct ? count : buffer_rows_;
+        const size_t row_stride = size_t(cinfo_.output_width) * 3;
+        row_pointers_.resize(chunk_rows);
+
+        for (int done = 0; done < count;) {
+            const int k = min(chunk_rows, count - done);
+            for (int i = 0; i < k; ++i) {
+                row_pointers_[i] = direct
+                    ? reinterpret_cast<JSAMPLE*>(band.GetRowData(done + i))
+                    : reinterpret_cast<JSAMPLE*>(buffer_.GetData()) + i * row_stride;
+            }
+
+            for (int read = 0; read < k;) {
+                const int n = jpeg_read_scanlines(&cinfo_, row_pointers_.data() + read, k - read);
+                if (n <= 0) {
+                    failed_ = true;
+                    return 0;
+                }
+                read += n;
+            }
+
+            if (!direct) {
+                for (int i = 0; i < k; ++i) {
+                    SaveSсanlineToImage(row_pointers_[i], done + i, band);
+                }
+            }
+            done += k;
+        }
+
+        /* Шаг 7: Останавливаем декодирование */
+        if (count > 0 && cinfo_.output_scanline == cinfo_.output_height) {
+            (void) jpeg_finish_decompress(&cinfo_);
+        }
 
-    cinfo.err = jpeg_std_error(&jerr.pub);
-    jerr.pub.error_exit = my_error_exit;
+        return count;
+    }
+
+private:
+    PooledJPEGContext<jpeg_decompress_struct> context_;
+    jpeg_decompress_struct& cinfo_;
+    my_error_mgr& jerr_;
+    FILE* infile_;
+    ByteView memory_;
+    JPEGLoadOptions options_;
+    bool whole_frame_;
+    bool failed_ = false;
+    PooledBuffer buffer_;
+    int buffer_rows_ = 0;
+    std::vector<JSAMPROW> row_pointers_;
+};
 
-    if (setjmp(jerr.setjmp_buffer)) {
-        jpeg_destroy_decompress(&cinfo);
+}  // namespace
+
+optional<ImageInfo> ProbeJPEG(const Path& file) {
+    FILE* infile = OpenCFile(file, false);
+    if (infile == nullptr) {
+        return nullopt;
+    }
+
+    // сигнатуру проверяем сами: на чужом файле libjpeg сообщил бы об ошибке в stderr
+    const array<int, 2> soi = {fgetc(infile), fgetc(infile)};
+    if (soi[0] != 0xFF || soi[1] != 0xD8 || fseek(infile, 0, SEEK_SET) != 0) {
         fclose(infile);
-        return {};
+        return nullopt;
     }
 
-    jpeg_create_decompress(&cinfo);
+    optional<ImageInfo> result;
+    {
+        PooledJPEGContext<jpeg_decompress_struct> context(JPEGStream::FILE);
+        jpeg_decompress_struct& cinfo = context.GetInfo();
+        if (setjmp(context.GetErrorManager().setjmp_buffer) == 0) {
+            jpeg_stdio_src(&cinfo, infile);
+            // jpeg_read_header останавливается перед сжатыми данными первого скана
+            (void) jpeg_read_header(&cinfo, TRUE);
+            result = ImageInfo{FileFormat::JPEG, {int(cinfo.image_width), int(cinfo.image_height)},
+                               cinfo.num_components, cinfo.data_precision};
+        }
+    }
+    fclose(infile);
+    return result;
+}
+
+int GetJPEGScaleDenom(Size image, const JPEGLoadOptions& options) {
+    if (options.min_size.width <= 0 && options.min_size.height <= 0) {
+        return options.scale_denom;
+    }
 
-    /* Шаг 2: устанавливаем источник данных */
+    // libjpeg округляет размеры уменьшенного кадра вверх
+    auto fits = [&](int denom) {
+        return (image.width + denom - 1) / denom >= options.min_size.width
+            && (image.height + denom - 1) / denom >= options.min_size.height;
+    };
+    for (int denom = 8; denom > options.scale_denom; denom /= 2) {
+        if (fits(denom)) {
+            return denom;
+        }
+    }
+    return options.scale_denom;
+}
 
-    jpeg_stdio_src(&cinfo, infile);
+static bool IsValid(const JPEGSaveOptions& options) {
+    return options.quality >= 1 && options.quality <= 100 && options.threads >= 0;
+}
 
-    /* Шаг 3: читаем параметры изображения через jpeg_read_header() */
+static bool IsValid(const JPEGLoadOptions& options) {
+    const int denom = options.scale_denom;
+    return (denom == 1 || denom == 2 || denom == 4 || denom == 8) && options.threads >= 0;
+}
 
-    (void) jpeg_read_header(&cinfo, TRUE);
+// Параллельное декодирование работает с файлом целиком в памяти,
+// поэтому файл отображается; если это не удалось - nullopt
+static optional<Image> LoadJPEGParallel(const Path& file, const JPEGLoadOptions& options) {
+    const MappedFile mapped = MappedFile::Open(file);
+    if (!mapped) {
+        return nullopt;
+    }
+    return LoadJPEGParallel(ByteView(mapped.GetData(), mapped.GetSize()), options);
+}
 
-    /* Шаг 4: устанавливаем параметры декодирования */
+unique_ptr<ImageWriter> CreateJPEGWriter(const Path& file, Size size, const JPEGSaveOptions& options) {
+    if (!IsValid(options)) {
+        return nullptr;
+    }
 
-    // установим желаемый формат изображения
-    cinfo.out_color_space = JCS_RGB;
-    cinfo.output_components = 3;
+    if (options.threads != 1) {
+        auto buf = OpenFileForWrite(file);
+        if (!buf) {
+            return nullptr;
+        }
+        return CreateParallelJPEGWriter(move(buf), size, options);
+    }
 
-    /* Шаг 5: начинаем декодирование */
+    FILE* outfile = OpenCFile(file, true);
+    if (outfile == nullptr) {
+        return nullptr;
+    }
 
-    (void) jpeg_start_decompress(&cinfo);
-    
-    row_stride = cinfo.output_width * cinfo.output_components;
-    
-    buffer = (*cinfo.mem->alloc_sarray)
-                ((j_common_ptr) &cinfo, JPOOL_IMAGE, row_stride, 1);
+    auto writer = make_unique<JPEGWriter>(outfile, nullptr, size, options);
+    if (!writer->Start()) {
+        return nullptr;
+    }
+    return writer;
+}
 
-    /* Шаг 5a: выделим изображение ImgLib */
-    Image result(cinfo.output_width, cinfo.output_height, Color::Black());
+unique_ptr<ImageWriter> CreateJPEGWriter(ByteBuffer& out, Size size, const JPEGSaveOptions& options) {
+    if (!IsValid(options)) {
+        return nullptr;
+    }
 
-    /* Шаг 6: while (остаются строки изображения) */
-    /*                     jpeg_read_scanlines(...); */
+    if (options.threads != 1) {
+        return CreateParallelJPEGWriter(make_unique<ByteBufferStreamBuf>(out), size, options);
+    }
 
-    while (cinfo.output_scanline < cinfo.output_height) {
-        int y = cinfo.output_scanline;
-        (void) jpeg_read_scanlines(&cinfo, buffer, 1);
+    auto writer = make_unique<JPEGWriter>(nullptr, &out, size, options);
+    if (!writer->Start()) {
+        return nullptr;
+    }
+    return writer;
+}
 
-        SaveSсanlineToImage(buffer[0], y, result);
+// Последовательный читатель файла file или, если file пустой, памяти data
+static unique_ptr<ImageReader> StartJPEGReader(const Path& file, ByteView data, const JPEGLoadOptions& options,
+                                               bool whole_frame) {
+    FILE* infile = nullptr;
+    if (!file.empty()) {
+        infile = OpenCFile(file, false);
+        if (infile == nullptr) {
+            return nullptr;
+        }
     }
 
-    /* Шаг 7: Останавливаем декодирование */
+    auto reader = make_unique<JPEGReader>(infile, data, options, whole_frame);
+    if (!reader->Start()) {
+        return nullptr;
+    }
+    return reader;
+}
 
-    (void) jpeg_finish_decompress(&cinfo);
+unique_ptr<ImageReader> OpenJPEGReader(const Path& file, const JPEGLoadOptions& options) {
+    if (!IsValid(options)) {
+        return nullptr;
+    }
 
-    /* Шаг 8: Освобождаем объект декодирования */
+    if (options.threads != 1) {
+        if (auto image = LoadJPEGParallel(file, options)) {
+            return MakeImageReader(move(*image));
+        }
+    }
+    return StartJPEGReader(file, ByteView(), options, false);
+}
 
-    jpeg_destroy_decompress(&cinfo);
-    fclose(infile);
+unique_ptr<ImageReader> OpenJPEGReader(ByteView data, const JPEGLoadOptions& options) {
+    if (!IsValid(options) || data.GetSize() == 0) {
+        return nullptr;
+    }
 
-    return result;
+    if (options.threads != 1) {
+        if (auto image = LoadJPEGParallel(data, options)) {
+            return MakeImageReader(move(*image));
+        }
+    }
+    return StartJPEGReader({}, data, options, false);
+}
+
+bool SaveJPEG(const Path& file, const ImageView& image, const JPEGSaveOptions& options) {
+    IMGLIB_TRACE_SCOPE("jpeg.save");
+    return WriteWholeImage(CreateJPEGWriter(file, {image.GetWidth(), image.GetHeight()}, options), image);
+}
+
+bool SaveJPEG(ByteBuffer& out, const ImageView& image, const JPEGSaveOptions& options) {
+    IMGLIB_TRACE_SCOPE("jpeg.save");
+    return WriteWholeImage(CreateJPEGWriter(out, {image.GetWidth(), image.GetHeight()}, options), image);
+}
+
+// параллельный путь проверяется здесь, а не через OpenJPEGReader,
+// чтобы не копировать готовый кадр ещё раз
+Image LoadJPEG(const Path& file, const JPEGLoadOptions& options) {
+    IMGLIB_TRACE_SCOPE("jpeg.load");
+    if (options.threads != 1 && IsValid(options)) {
+        if (auto image = LoadJPEGParallel(file, options)) {
+            return move(*image);
+        }
+    }
+    if (!IsValid(options)) {
+        return {};
+    }
+    return ReadWholeImage(StartJPEGReader(file, ByteView(), options, true));
+}
+
+Image LoadJPEG(ByteView data, const JPEGLoadOptions& options) {
+    IMGLIB_TRACE_SCOPE("jpeg.load");
+    if (options.threads != 1 && IsValid(options)) {
+        if (auto image = LoadJPEGParallel(data, options)) {
+            return move(*image);
+        }
+    }
+    if (!IsValid(options) || data.GetSize() == 0) {
+        return {};
+    }
+    return ReadWholeImage(StartJPEGReader({}, data, options, true));
 }
 
-} // of namespace img_lib
\ No newline at end of file
+} // of namespace img_lib
@@ -1,12 +1,92 @@
 #pragma once
 #include "img_lib.h"
+#include "image_info.h"
+#include "image_stream.h"
+#include "memory_buffer.h"
 
 #include <filesystem>
+#include <memory>
 
 namespace img_lib {
 using Path = std::filesystem::path;
 
-bool SaveJPEG(const Path& file, const Image& image);
-Image LoadJPEG(const Path& file);
+// способ вычисления ДКП, соответствует J_DCT_METHOD из libjpeg
+enum class JPEGDCTMethod {
+    ISLOW,  // точное целочисленное, по умолчанию
+    IFAST,  // быстрое целочисленное, чуть менее точное
+    FLOAT,  // с плавающей точкой
+};
+
+// Параметры кодирования. Значения по умолчанию совпадают с jpeg_set_defaults
+struct JPEGSaveOptions {
+    int quality = 75;  // 1..100
+    JPEGDCTMethod dct_method = JPEGDCTMethod::ISLOW;
+
+    // Число потоков кодирования, 0 - по числу ядер. При значении больше 1
+    // изображение делится на полосы из целых строк MCU, полосы сжимаются
+    // параллельно и склеиваются в один baseline JPEG с маркерами перезапуска.
+    // Результат декодируется так же, как при обычном кодировании,
+    // и лишь немного больше по размеру из-за маркеров
+    int threads = 1;
+};
+
+// Параметры декодирования для превью и миниатюр
+struct JPEGLoadOptions {
+    JPEGDCTMethod dct_method = JPEGDCTMethod::ISLOW;
+
+    // false отключает сглаживающую интерполяцию цветоразностных каналов:
+    // быстрее, но на резких цветовых границах появляется ступенька
+    bool fancy_upsampling = true;
+
+    // Уменьшение в 1, 2, 4 или 8 раз прямо при обратном ДКП: декодер
+    // считает только нужные коэффициенты, что в разы дешевле полного
+    // декодирования с последующим уменьшением. Размер результата
+    // округляется вверх, его возвращает ImageReader::GetSize()
+    int scale_denom = 1;
+
+    // Размер, до которого кадр всё равно будут уменьшать после загрузки.
+    // Если задан, знаменатель берётся наибольшим из scale_denom, 2, 4 и 8,
+    // при котором кадр остаётся не меньше min_size (нулевая сторона
+    // не ограничивает), а остаток уменьшения делает Resize. См. GetJPEGScaleDenom
+    Size min_size = {0, 0};
+
+    // Предел памяти на декодирование одного файла в байтах, 0 - без предела.
+    // В него входят буферы libjpeg (cinfo.mem->max_memory_to_use), а при
+    // загрузке кадра целиком (LoadJPEG и параллельное декодирование) - и сам
+    // кадр. Больше всего памяти требуют прогрессивные файлы: коэффициенты
+    // хранятся для всего кадра. libjpeg-turbo не выгружает их во временные
+    // файлы, поэтому файл, которому не хватает предела, не загружается,
+    // вместо того чтобы исчерпать память процесса. Построчное чтение
+    // (OpenJPEGReader) держит в памяти лишь полосу: параллельное декодирование,
+    // кадру которого предела не хватает, заменяется последовательным
+    size_t max_memory = 0;
+
+    // Число потоков декодирования, 0 - по числу ядер. Если в файле есть
+    // маркеры перезапуска (DRI), интервалы между ними декодируются
+    // параллельно. Кадр при этом декодируется в память целиком, в том числе
+    // через OpenJPEGReader. Файлы без маркеров декодируются как обычно
+    int threads = 1;
+};
+
+// знаменатель уменьшения, с которым options декодируют кадр размера image
+int GetJPEGScaleDenom(Size image, const JPEGLoadOptions& options);
+
+bool SaveJPEG(const Path& file, const ImageView& image, const JPEGSaveOptions& options = {});
+Image LoadJPEG(const Path& file, const JPEGLoadOptions& options = {});
+
+// построчное чтение и запись без полного кадра, nullptr - если файл
+// не удалось открыть или его заголовок не поддерживается
+std::unique_ptr<ImageReader> OpenJPEGReader(const Path& file, const JPEGLoadOptions& options = {});
+std::unique_ptr<ImageWriter> CreateJPEGWriter(const Path& file, Size size, const JPEGSaveOptions& options = {});
+
+// читает маркеры до начала сжатых данных, nullopt - если это не JPEG
+std::optional<ImageInfo> ProbeJPEG(const Path& file);
+
+// То же для файла в памяти. Результат записи заменяет содержимое out,
+// читатель ссылается на data и не должен её пережить
+bool SaveJPEG(ByteBuffer& out, const ImageView& image, const JPEGSaveOptions& options = {});
+Image LoadJPEG(ByteView data, const JPEGLoadOptions& options = {});
+std::unique_ptr<ImageReader> OpenJPEGReader(ByteView data, const JPEGLoadOptions& options = {});
+std::unique_ptr<ImageWriter> CreateJPEGWriter(ByteBuffer& out, Size size, const JPEGSaveOptions& options = {});
 
 } // of namespace img_lib
\ No newline at end of file
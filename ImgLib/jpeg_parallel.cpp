@@ -0,0 +1,616 @@
+#include "jpeg_parallel.h"
+#include "memory_buffer.h"
+#include "parallel_rows.h"
+#include "pixel_convert.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <stdio.h>
+#include <vector>
+
+#include <jpeglib.h>
+
+using namespace std;
+
+namespace img_lib {
+
+// Каждая полоса кодируется отдельным компрессором libjpeg как самостоятельный
+// JPEG. Результат склеивается так:
+//   заголовок первой полосы (высота в SOF заменена на полную) + DRI,
+//   энтропийные данные полосы 0, RST0, данные полосы 1, RST1, ... , EOI.
+// Это корректно, потому что на маркере перезапуска декодер сбрасывает
+// предсказание DC и выравнивание битов - ровно то состояние, с которого
+// начинает каждый отдельный компрессор. Заголовки полос совпадают:
+// таблицы квантования зависят только от качества, а таблицы Хаффмана
+// стандартные (optimize_coding выключен). Субдискретизация цвета в libjpeg
+// не заглядывает в соседние строки MCU, поэтому коэффициенты выходят те же,
+// что и при кодировании изображения целиком
+
+namespace {
+
+// строка MCU при стандартной субдискретизации 2x2 - 16 строк пикселей,
+// при 1x1 - 8, полосы кратны 16 и подходят для обоих случаев
+constexpr int MCU_ROWS = 16;
+
+// примерный объём одной полосы: достаточно, чтобы накладные расходы
+// на создание компрессора были незаметны, и мало, чтобы полос хватило всем потокам
+constexpr int64_t BAND_PIXELS = int64_t(1) << 20;
+
+// интервал перезапуска хранится в 16 битах и считается в MCU
+constexpr int MAX_RESTART_INTERVAL = 65535;
+
+// Сколько частей кадра обрабатывается одновременно: threads из параметров,
+// 0 - по числу потоков общего пула. Части выполняются на общем пуле, чтобы
+// параллельные задания пакетного режима не создавали каждое свои потоки
+size_t GetPartCount(int threads) {
+    return threads > 0 ? size_t(threads) : GetSharedThreadPool().GetThreadCount();
+}
+
+constexpr unsigned char MARKER = 0xFF;
+constexpr unsigned char SOI = 0xD8;
+constexpr unsigned char SOF0 = 0xC0;
+constexpr unsigned char SOF1 = 0xC1;
+constexpr unsigned char DHT = 0xC4;
+constexpr unsigned char DAC = 0xCC;
+constexpr unsigned char SOS = 0xDA;
+constexpr unsigned char DRI = 0xDD;
+constexpr unsigned char RST0 = 0xD0;
+constexpr unsigned char EOI = 0xD9;
+
+// Положение частей заголовка JPEG и параметры кадра, нужные для разбиения
+struct JPEGLayout {
+    size_t height_pos = 0;  // старший байт высоты в SOF
+    size_t sos_pos = 0;     // начало маркера SOS
+    size_t data_pos = 0;    // первый байт энтропийных данных
+    int width = 0;
+    int height = 0;
+    int mcu_width = 0;
+    int mcu_height = 0;
+    int restart_interval = 0;  // в MCU, 0 - маркеров перезапуска нет
+};
+
+int ReadUInt16(ByteView data, size_t pos) {
+    return (int(data.GetData()[pos]) << 8) | int(data.GetData()[pos + 1]);
+}
+
+// Проходит по маркерам заголовка от SOI до SOS. Поддерживаются только
+// baseline и extended sequential кадры с одним сканом, в котором есть все
+// компоненты: только у них MCU покрывает прямоугольник всех компонент сразу
+optional<JPEGLayout> ParseJPEGLayout(ByteView data) {
+    const std::byte* bytes = data.GetData();
+    if (data.GetSize() < 2 || bytes[0] != std::byte{MARKER} || bytes[1] != std::byte{SOI}) {
+        return nullopt;
+    }
+
+    JPEGLayout layout;
+    int components = 0;
+    size_t pos = 2;
+
+    while (pos + 4 <= data.GetSize()) {
+        if (bytes[pos] != std::byte{MARKER}) {
+            return nullopt;
+        }
+        const auto marker = static_cast<unsigned char>(bytes[pos + 1]);
+        if (marker == MARKER) {
+            ++pos;  // байт-заполнитель перед маркером
+            continue;
+        }
+        const size_t length = size_t(ReadUInt16(data, pos + 2));
+        if (length < 2 || pos + 2 + length > data.GetSize()) {
+            return nullopt;
+        }
+
+        if (marker == SOF0 || marker == SOF1) {
+            // FF C0, длина, точность, высота, ширина, число компонент, компоненты по 3 байта
+            components = int(bytes[pos + 9]);
+            if (components == 0 || length < size_t(8 + 3 * components)) {
+                return nullopt;
+            }
+            int max_h = 1, max_v = 1;
+            for (int i = 0; i < components; ++i) {
+                const int sampling = int(bytes[pos + 11 + 3 * i]);
+                max_h = max(max_h, sampling >> 4);
+                max_v = max(max_v, sampling & 0xF);
+            }
+            layout.height_pos = pos + 5;
+            layout.height = ReadUInt16(data, pos + 5);
+            layout.width = ReadUInt16(data, pos + 7);
+            layout.mcu_width = 8 * max_h;
+            layout.mcu_height = 8 * max_v;
+        } else if (marker >= 0xC2 && marker <= 0xCF && marker != DHT && marker != DAC) {
+            return nullopt;  // прогрессивный, lossless или арифметический кадр
+        } else if (marker == DRI) {
+            if (length != 4) {
+                return nullopt;
+            }
+            layout.restart_interval = ReadUInt16(data, pos + 4);
+        } else if (marker == SOS) {
+            // без SOF или скан не со всеми компонентами
+            if (components == 0 || int(bytes[pos + 4]) != components
+                || layout.width == 0 || layout.height == 0) {
+                return nullopt;
+            }
+            layout.sos_pos = pos;
+            layout.data_pos = pos + 2 + length;
+            return layout;
+        }
+        pos += 2 + length;
+    }
+    return nullopt;
+}
+
+// Строки полосы и результат их сжатия
+struct Band {
+    Image pixels;
+    int rows = 0;
+    ByteBuffer encoded;
+    future<bool> done;
+};
+
+class ParallelJPEGWriter : public ImageWriter {
+public:
+    ParallelJPEGWriter(unique_ptr<streambuf> buf, Size size, const JPEGSaveOptions& options, int band_rows)
+        : buf_(move(buf))
+        , out_(buf_.get())
+        , size_(size)
+        , band_options_(options)
+        , band_rows_(band_rows)
+        , threads_(GetPartCount(options.threads)) {
+        // полосы сжимаются обычным однопоточным кодировщиком
+        band_options_.threads = 1;
+    }
+
+    // задачи общего пула ссылаются на полосы, поэтому их нужно дождаться
+    ~ParallelJPEGWriter() override {
+        for (const auto& band : pending_) {
+            band->done.wait();
+        }
+    }
+
+    bool IsOpen() const {
+        return out_.good();
+    }
+
+    bool WriteRows(const ImageView& band, int count) override {
+        if (failed_ || count > size_.height - rows_written_) {
+            return false;
+        }
+
+        for (int y = 0; y < count; ++y) {
+            if (!current_) {
+                current_ = make_unique<Band>();
+                const int rows = min(band_rows_, size_.height - rows_written_);
+                current_->pixels = Image(size_.width, rows, PixelFormat::RGB24, FOR_OVERWRITE);
+            }
+
+            ConvertRow(band.GetRowData(y), band.GetFormat(),
+                       current_->pixels.GetRowData(current_->rows), PixelFormat::RGB24, size_.width);
+            ++current_->rows;
+            ++rows_written_;
+
+            if (current_->rows == current_->pixels.GetHeight() && !SubmitCurrent()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool Finish() override {
+        if (failed_ || rows_written_ != size_.height) {
+            return false;
+        }
+
+        while (!pending_.empty()) {
+            if (!WriteOldest()) {
+                return false;
+            }
+        }
+
+        const array<unsigned char, 2> eoi = {MARKER, EOI};
+        out_.write(reinterpret_cast<const char*>(eoi.data()), eoi.size());
+        out_.flush();
+        return out_.good();
+    }
+
+private:
+    bool SubmitCurrent() {
+        Band* band = current_.get();
+        auto task = make_shared<packaged_task<bool()>>([band, options = band_options_] {
+            IMGLIB_TRACE_SCOPE("jpeg.encode_band");
+            auto writer = CreateJPEGWriter(band->encoded, {band->pixels.GetWidth(), band->rows}, options);
+            return writer && writer->WriteRows(band->pixels, band->rows) && writer->Finish();
+        });
+        band->done = task->get_future();
+        pending_.push_back(move(current_));
+        GetSharedThreadPool().Submit([task] { (*task)(); });
+
+        // готовые полосы сразу уходят в файл, чтобы в памяти
+        // не копилось больше работы, чем нужно для загрузки потоков
+        while (pending_.size() > 2 * threads_) {
+            if (!WriteOldest()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // дожидается самой старой полосы и дописывает её в выходной поток
+    bool WriteOldest() {
+        unique_ptr<Band> band = move(pending_.front());
+        pending_.pop_front();
+
+        if (!band->done.get()) {
+            failed_ = true;
+            return false;
+        }
+        const ByteBuffer& data = band->encoded;
+
+        if (bands_written_ == 0) {
+            if (!WriteHeader(data)) {
+                failed_ = true;
+                return false;
+            }
+        } else {
+            const array<unsigned char, 2> rst = {MARKER, static_cast<unsigned char>(RST0 + (bands_written_ - 1) % 8)};
+            out_.write(reinterpret_cast<const char*>(rst.data()), rst.size());
+        }
+
+        // у всех полос одинаковый заголовок, его длина известна по первой
+        if (data.size() < data_pos_ + 2) {
+            failed_ = true;
+            return false;
+        }
+        out_.write(reinterpret_cast<const char*>(data.data()) + data_pos_, data.size() - data_pos_ - 2);  // без EOI
+        ++bands_written_;
+
+        if (!out_) {
+            failed_ = true;
+            return false;
+        }
+        return true;
+    }
+
+    bool WriteHeader(const ByteBuffer& data) {
+        const auto layout = ParseJPEGLayout(data);
+        if (!layout || MCU_ROWS % layout->mcu_height != 0) {
+            return false;
+        }
+
+        const int mcus_per_row = (size_.width + layout->mcu_width - 1) / layout->mcu_width;
+        const int interval = mcus_per_row * (band_rows_ / layout->mcu_height);
+        if (interval > MAX_RESTART_INTERVAL) {
+            return false;
+        }
+
+        ByteBuffer header(data.begin(), data.begin() + layout->sos_pos);
+        header[layout->height_pos] = std::byte(size_.height >> 8);
+        header[layout->height_pos + 1] = std::byte(size_.height & 0xFF);
+
+        const array<unsigned char, 6> dri = {MARKER, DRI, 0, 4,
+                                             static_cast<unsigned char>(interval >> 8),
+                                             static_cast<unsigned char>(interval & 0xFF)};
+        out_.write(reinterpret_cast<const char*>(header.data()), header.size());
+        out_.write(reinterpret_cast<const char*>(dri.data()), dri.size());
+        // сам маркер SOS вместе с его параметрами
+        out_.write(reinterpret_cast<const char*>(data.data()) + layout->sos_pos, layout->data_pos - layout->sos_pos);
+
+        data_pos_ = layout->data_pos;
+        return true;
+    }
+
+    unique_ptr<streambuf> buf_;
+    ostream out_;
+    Size size_;
+    JPEGSaveOptions band_options_;
+    int band_rows_;
+    int rows_written_ = 0;
+    int bands_written_ = 0;
+    size_t data_pos_ = 0;
+    bool failed_ = false;
+
+    size_t threads_;  // сколько полос сжимается одновременно
+
+    unique_ptr<Band> current_;
+    deque<unique_ptr<Band>> pending_;
+};
+
+}  // namespace
+
+unique_ptr<ImageWriter> CreateParallelJPEGWriter(unique_ptr<streambuf> out, Size size,
+                                                 const JPEGSaveOptions& options) {
+    if (size.width <= 0 || size.height <= 0 || options.threads < 0) {
+        return nullptr;
+    }
+    // Полосы короче предела libjpeg и сжались бы, но высота всего кадра
+    // в SOF больше предела не поместится: отказываем, как и SaveJPEG
+    if (size.width > JPEG_MAX_DIMENSION || size.height > JPEG_MAX_DIMENSION) {
+        return nullptr;
+    }
+
+    // высота полосы в строках MCU; интервал перезапуска ограничен и при MCU
+    // шириной 8 пикселей, самой узкой, которую может выбрать libjpeg
+    const int64_t mcus_per_row = (size.width + 7) / 8;
+    const int64_t wanted = (BAND_PIXELS + int64_t(size.width) * MCU_ROWS - 1) / (int64_t(size.width) * MCU_ROWS);
+    const int64_t allowed = max<int64_t>(1, MAX_RESTART_INTERVAL / mcus_per_row / (MCU_ROWS / 8));
+    const int band_rows = int(clamp<int64_t>(wanted, 1, allowed)) * MCU_ROWS;
+
+    auto writer = make_unique<ParallelJPEGWriter>(move(out), size, options, band_rows);
+    if (!writer->IsOpen()) {
+        return nullptr;
+    }
+    return writer;
+}
+
+// Параллельное декодирование - обратная операция: энтропийные данные делятся
+// по маркерам перезапуска на части из целых строк MCU, и каждая часть
+// декодируется отдельным декомпрессором как самостоятельный JPEG той же ширины
+
+namespace {
+
+// Интервал перезапуска в энтропийных данных, без маркеров по краям
+struct RestartSegment {
+    size_t begin = 0;
+    size_t end = 0;
+};
+
+// Находит все маркеры RST до EOI. Внутри энтропийных данных байт 0xFF
+// всегда записывается как FF 00, поэтому любой другой FF xx - маркер.
+// nullopt - если встретился маркер, после которого части уже не независимы
+// (например, следующий скан) или файл обрезан
+optional<vector<RestartSegment>> FindRestartSegments(ByteView data, size_t data_pos) {
+    const std::byte* bytes = data.GetData();
+    const size_t size = data.GetSize();
+
+    vector<RestartSegment> segments;
+    size_t begin = data_pos;
+    size_t pos = data_pos;
+
+    while (pos < size) {
+        const void* found = memchr(bytes + pos, MARKER, size - pos);
+        if (found == nullptr) {
+            return nullopt;
+        }
+        const size_t marker_pos = static_cast<const std::byte*>(found) - bytes;
+
+        size_t code_pos = marker_pos + 1;
+        while (code_pos < size && bytes[code_pos] == std::byte{MARKER}) {
+            ++code_pos;  // байты-заполнители
+        }
+        if (code_pos == size) {
+            return nullopt;
+        }
+
+        const auto code = static_cast<unsigned char>(bytes[code_pos]);
+        if (code == 0) {
+            pos = code_pos + 1;
+        } else if (code >= RST0 && code < RST0 + 8) {
+            segments.push_back({begin, marker_pos});
+            begin = pos = code_pos + 1;
+        } else if (code == EOI) {
+            segments.push_back({begin, marker_pos});
+            return segments;
+        } else {
+            return nullopt;
+        }
+    }
+    return nullopt;
+}
+
+// Часть изображения из строк MCU [first_row, last_row)
+struct DecodeChunk {
+    int first_row = 0;
+    int last_row = 0;
+};
+
+// Делит строки MCU на части по границам интервалов перезапуска,
+// примерно по target строк в каждой
+vector<DecodeChunk> SplitIntoChunks(int mcu_rows, int mcus_per_row, int interval, int target) {
+    vector<DecodeChunk> chunks;
+    int first = 0;
+    for (int row = 1; row < mcu_rows; ++row) {
+        // интервал начинается с этой строки MCU
+        const bool at_restart = int64_t(row) * mcus_per_row % interval == 0;
+        if (at_restart && row - first >= target) {
+            chunks.push_back({first, row});
+            first = row;
+        }
+    }
+    chunks.push_back({first, mcu_rows});
+    return chunks;
+}
+
+// Собирает самостоятельный JPEG из заголовка исходного файла и интервалов
+// части: высота в SOF заменяется на высоту части, маркеры RST
+// перенумеровываются с нуля, как их ждёт новый декомпрессор
+ByteBuffer BuildChunkJPEG(ByteView data, const JPEGLayout& layout, const vector<RestartSegment>& segments,
+                          size_t first_segment, size_t last_segment, int chunk_height) {
+    const std::byte* bytes = data.GetData();
+    const size_t data_size = segments[last_segment - 1].end - segments[first_segment].begin;
+
+    ByteBuffer result;
+    result.reserve(layout.data_pos + data_size + 2 * (last_segment - first_segment) + 2);
+    result.insert(result.end(), bytes, bytes + layout.data_pos);
+    result[layout.height_pos] = std::byte(chunk_height >> 8);
+    result[layout.height_pos + 1] = std::byte(chunk_height & 0xFF);
+
+    for (size_t i = first_segment; i < last_segment; ++i) {
+        if (i != first_segment) {
+            result.push_back(std::byte{MARKER});
+            result.push_back(std::byte(RST0 + (i - first_segment - 1) % 8));
+        }
+        result.insert(result.end(), bytes + segments[i].begin, bytes + segments[i].end);
+    }
+    result.push_back(std::byte{MARKER});
+    result.push_back(std::byte{EOI});
+    return result;
+}
+
+// Декодирует часть и копирует её строки в image, начиная со строки first_out_row
+bool DecodeChunkInto(ByteView chunk, const JPEGLoadOptions& options, int first_out_row, int out_rows,
+                     Image& image) {
+    auto reader = OpenJPEGReader(chunk, options);
+    if (!reader || reader->GetSize().width != image.GetWidth() || reader->GetSize().height != out_rows
+        || reader->GetPixelFormat() != image.GetFormat()) {
+        return false;
+    }
+
+    Image band(image.GetWidth(), min(DEFAULT_BAND_ROWS, out_rows), image.GetFormat(), FOR_OVERWRITE);
+
+    for (int done = 0; done < out_rows;) {
+        const int count = reader->ReadRows(band);
+        if (count <= 0) {
+            return false;
+        }
+        ConvertRows(band.GetRowData(0), band.GetStride(), band.GetFormat(),
+                    image.GetRowData(first_out_row + done), image.GetStride(), image.GetFormat(),
+                    image.GetWidth(), count);
+        done += count;
+    }
+    return true;
+}
+
+// Очередь частей, общая для вызова LoadJPEGParallel и его помощников из пула.
+// Помощник может начаться, когда вызов уже вернулся, поэтому очередь живёт
+// в shared_ptr, а вызов ждёт только выполнения всех частей, а не помощников
+struct ChunkQueue {
+    explicit ChunkQueue(size_t chunk_count)
+        : chunk_count(chunk_count) {
+    }
+
+    // Выполняет части, пока они не кончатся. decode разыменовывается только
+    // после того, как часть взята: пока она не выполнена, вызов ждёт и decode жив
+    template <typename Decode>
+    void DecodeChunks(const Decode* decode) {
+        for (size_t i = next_chunk++; i < chunk_count; i = next_chunk++) {
+            (*decode)(i);
+            lock_guard lock(done_mutex);
+            if (++done_chunks == chunk_count) {
+                all_done.notify_one();
+            }
+        }
+    }
+
+    void WaitAll() {
+        unique_lock lock(done_mutex);
+        all_done.wait(lock, [this] { return done_chunks == chunk_count; });
+    }
+
+    const size_t chunk_count;
+    atomic<size_t> next_chunk = 0;
+    mutex done_mutex;
+    condition_variable all_done;
+    size_t done_chunks = 0;
+};
+
+}  // namespace
+
+optional<Image> LoadJPEGParallel(ByteView data, const JPEGLoadOptions& options) {
+    IMGLIB_TRACE_SCOPE("jpeg.parallel_decode");
+    const auto layout = ParseJPEGLayout(data);
+    if (!layout || layout->restart_interval == 0) {
+        return nullopt;
+    }
+    // Сглаживающая интерполяция цветоразностных каналов, прореженных по
+    // вертикали, берёт соседние строки, а у части нет строк соседней: стыки
+    // отличались бы от последовательного декодирования. Горизонтальной
+    // интерполяции хватает строки самой части
+    if (options.fancy_upsampling && layout->mcu_height > 8) {
+        return nullopt;
+    }
+
+    const auto segments = FindRestartSegments(data, layout->data_pos);
+    if (!segments) {
+        return nullopt;
+    }
+
+    const int interval = layout->restart_interval;
+    const int mcus_per_row = (layout->width + layout->mcu_width - 1) / layout->mcu_width;
+    const int mcu_rows = (layout->height + layout->mcu_height - 1) / layout->mcu_height;
+    const int64_t total_mcus = int64_t(mcus_per_row) * mcu_rows;
+    if (int64_t(segments->size()) != (total_mcus + interval - 1) / interval) {
+        return nullopt;  // повреждённый файл - пусть с ним разбирается обычный декодер
+    }
+
+    const size_t threads = GetPartCount(options.threads);
+    // частей вдвое больше, чем потоков, чтобы неравномерные части не простаивали
+    const int target_rows = max<int>(1, mcu_rows / int(2 * threads));
+    const vector<DecodeChunk> chunks = SplitIntoChunks(mcu_rows, mcus_per_row, interval, target_rows);
+    if (chunks.size() < 2) {
+        return nullopt;
+    }
+
+    // размеры уменьшенного изображения libjpeg округляет вверх. Части, кроме
+    // последней, кратны высоте MCU, а она делится на любой знаменатель 1..8
+    const int denom = GetJPEGScaleDenom({layout->width, layout->height}, options);
+    const int out_width = (layout->width + denom - 1) / denom;
+    const int out_height = (layout->height + denom - 1) / denom;
+    // кадр декодируется целиком, и с пределом памяти, в который
+    // он не помещается, остаётся только построчный декодер
+    const uint64_t frame_bytes = uint64_t(out_width) * out_height * 3;
+    if (options.max_memory > 0 && frame_bytes >= options.max_memory) {
+        return nullopt;
+    }
+    Image image(out_width, out_height, PixelFormat::RGB24, FOR_OVERWRITE);
+
+    JPEGLoadOptions chunk_options = options;
+    chunk_options.threads = 1;
+    // части ниже целого кадра, поэтому знаменатель выбран здесь, для всего кадра
+    chunk_options.scale_denom = denom;
+    chunk_options.min_size = {0, 0};
+    atomic<bool> ok = true;
+
+    auto decode = [&](const DecodeChunk& chunk) {
+        try {
+            const int first_pixel_row = chunk.first_row * layout->mcu_height;
+            const int chunk_height = min(layout->height, chunk.last_row * layout->mcu_height) - first_pixel_row;
+            const size_t first_segment = size_t(int64_t(chunk.first_row) * mcus_per_row / interval);
+            const size_t last_segment = chunk.last_row == mcu_rows
+                ? segments->size()
+                : size_t(int64_t(chunk.last_row) * mcus_per_row / interval);
+
+            const ByteBuffer chunk_data = BuildChunkJPEG(data, *layout, *segments, first_segment,
+                                                         last_segment, chunk_height);
+            if (!DecodeChunkInto(chunk_data, chunk_options, first_pixel_row / denom,
+                                 (chunk_height + denom - 1) / denom, image)) {
+                ok = false;
+            }
+        } catch (const exception&) {
+            ok = false;
+        }
+    };
+
+    // Части разбирают по очереди вызывающий поток и помощники из общего
+    // пула. Если пул занят другими файлами, части достаются вызывающему
+    // потоку, и он ждёт лишь те части, которые помощники уже взяли.
+    // Помощник, запущенный позже, не находит частей и сразу завершается,
+    // см. ChunkQueue
+    const auto queue = make_shared<ChunkQueue>(chunks.size());
+    const auto decode_chunk = [&](size_t i) {
+        decode(chunks[i]);
+    };
+
+    for (size_t i = 0, helpers = min(threads, chunks.size()) - 1; i < helpers; ++i) {
+        GetSharedThreadPool().Submit([queue, decode = &decode_chunk] {
+            queue->DecodeChunks(decode);
+        });
+    }
+    queue->DecodeChunks(&decode_chunk);
+    queue->WaitAll();
+
+    if (!ok) {
+        return nullopt;
+    }
+    return image;
+}
+
+}  // namespace img_lib
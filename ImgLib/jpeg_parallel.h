@@ -0,0 +1,32 @@
+#pragma once
+#include "img_lib.h"
+#include "image_stream.h"
+#include "jpeg_image.h"
+
+#include <memory>
+#include <optional>
+#include <streambuf>
+
+namespace img_lib {
+
+// Кодировщик JPEG, сжимающий полосы изображения параллельно на options.threads
+// потоках. Полоса отправляется в работу, как только в неё записаны все строки,
+// поэтому в памяти одновременно живут лишь несколько полос, а готовые куски
+// пишутся в out по порядку. Полосы сжимаются на общем пуле GetSharedThreadPool,
+// поэтому писать из задачи этого пула нельзя: ожидание полос заняло бы его потоки.
+// Используется CreateJPEGWriter и SaveJPEG при options.threads != 1
+std::unique_ptr<ImageWriter> CreateParallelJPEGWriter(std::unique_ptr<std::streambuf> out, Size size,
+                                                      const JPEGSaveOptions& options);
+
+// Декодирует JPEG с маркерами перезапуска на options.threads потоках:
+// независимые интервалы между маркерами декодируются одновременно
+// в разные строки результата: вызывающим потоком и помощниками из общего
+// пула GetSharedThreadPool. nullopt - если маркеров нет, их слишком
+// мало для деления, файл не удалось разобрать или при fancy_upsampling
+// цветоразностные каналы прорежены по вертикали (интерполяции на стыке
+// частей не видны строки соседней); тогда нужно обычное последовательное
+// декодирование. Результат совпадает с последовательным. Вызывающий поток
+// не ждёт помощников, до которых не дошла очередь в пуле
+std::optional<Image> LoadJPEGParallel(ByteView data, const JPEGLoadOptions& options);
+
+}  // namespace img_lib
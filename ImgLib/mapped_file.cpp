@@ -0,0 +1,179 @@
+#include "mapped_file.h"
+#include "pixel_convert.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <utility>
+
+#ifdef _WIN32
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace img_lib {
+
+MappedFile::~MappedFile() {
+    Release();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept {
+    *this = move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+    if (this != &other) {
+        Release();
+        data_ = exchange(other.data_, nullptr);
+        size_ = exchange(other.size_, 0);
+#ifdef _WIN32
+        mapping_ = exchange(other.mapping_, nullptr);
+#endif
+    }
+    return *this;
+}
+
+#ifdef _WIN32
+
+MappedFile MappedFile::Open(const Path& file) {
+    IMGLIB_TRACE_SCOPE("file.map");
+    MappedFile result;
+
+    HANDLE handle = CreateFileW(file.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                                OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return result;
+    }
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(handle, &file_size) || file_size.QuadPart <= 0) {
+        CloseHandle(handle);
+        return result;
+    }
+
+    HANDLE mapping = CreateFileMappingW(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    // объект отображения держит файл открытым, сам дескриптор больше не нужен
+    CloseHandle(handle);
+    if (mapping == nullptr) {
+        return result;
+    }
+
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (view == nullptr) {
+        CloseHandle(mapping);
+        return result;
+    }
+
+    result.data_ = static_cast<const std::byte*>(view);
+    result.size_ = static_cast<size_t>(file_size.QuadPart);
+    result.mapping_ = mapping;
+    IMGLIB_TRACE_BYTES(BYTES_READ, result.size_);
+    return result;
+}
+
+void MappedFile::Release() {
+    if (data_ != nullptr) {
+        UnmapViewOfFile(data_);
+        CloseHandle(mapping_);
+        data_ = nullptr;
+        size_ = 0;
+        mapping_ = nullptr;
+    }
+}
+
+#else
+
+MappedFile MappedFile::Open(const Path& file) {
+    IMGLIB_TRACE_SCOPE("file.map");
+    MappedFile result;
+
+    const int fd = open(file.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return result;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+        close(fd);
+        return result;
+    }
+
+    void* view = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // отображение остаётся действительным и после закрытия дескриптора
+    close(fd);
+    if (view == MAP_FAILED) {
+        return result;
+    }
+
+    result.data_ = static_cast<const std::byte*>(view);
+    result.size_ = static_cast<size_t>(st.st_size);
+    // страницы подгружаются при обращении, но читается обычно весь файл
+    IMGLIB_TRACE_BYTES(BYTES_READ, result.size_);
+    return result;
+}
+
+void MappedFile::Release() {
+    if (data_ != nullptr) {
+        munmap(const_cast<std::byte*>(data_), size_);
+        data_ = nullptr;
+        size_ = 0;
+    }
+}
+
+#endif
+
+namespace {
+
+class MappedReader : public ImageReader {
+public:
+    MappedReader(MappedImage image, const RasterOptions& options)
+        : image_(move(image))
+        , options_(options) {
+    }
+
+    Size GetSize() const override {
+        return image_.pixels.size;
+    }
+
+    PixelFormat GetPixelFormat() const override {
+        return image_.pixels.format;
+    }
+
+    int ReadRows(Image& band) override {
+        // чтение страниц отображения и перестановка каналов за один проход
+        IMGLIB_TRACE_SCOPE("mapped.read_rows");
+        const MappedPixels& pixels = image_.pixels;
+        const int count = min(band.GetHeight(), pixels.size.height - rows_read_);
+        const size_t row_bytes = size_t(pixels.size.width) * GetBytesPerPixel(band.GetFormat());
+
+        ParallelForRows(count, row_bytes, options_, [&](int begin, int end) {
+            ConvertRows(pixels.GetRow(rows_read_ + begin), pixels.stride, pixels.format,
+                        band.GetRowData(begin), band.GetStride(), band.GetFormat(),
+                        pixels.size.width, end - begin);
+        });
+
+        rows_read_ += count;
+        return count;
+    }
+
+private:
+    MappedImage image_;
+    RasterOptions options_;
+    int rows_read_ = 0;
+};
+
+}  // namespace
+
+unique_ptr<ImageReader> MakeMappedReader(MappedImage image, const RasterOptions& options) {
+    return make_unique<MappedReader>(move(image), options);
+}
+
+}  // namespace img_lib
@@ -0,0 +1,94 @@
+#pragma once
+#include "img_lib.h"
+#include "image_stream.h"
+#include "parallel_rows.h"
+
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+
+namespace img_lib {
+using Path = std::filesystem::path;
+
+// Файл, отображённый в память только для чтения
+// (mmap в POSIX, MapViewOfFile в Windows).
+// Если файл укоротят, пока он отображён, чтение упадёт с SIGBUS.
+// Отображение само этого не проверяет: вызывающий код не должен открывать
+// на запись отображённый файл, а результат, который заменяет вход,
+// пишется во временный файл и переименовывается поверх входа
+class MappedFile {
+public:
+    // создаёт пустой объект, ничего не отображая
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // возвращает пустой объект, если файл не удалось открыть или отобразить
+    // (например, файл пустой или это не обычный файл)
+    static MappedFile Open(const Path& file);
+
+    const std::byte* GetData() const {
+        return data_;
+    }
+
+    size_t GetSize() const {
+        return size_;
+    }
+
+    explicit operator bool() const {
+        return data_ != nullptr;
+    }
+
+    bool operator!() const {
+        return !operator bool();
+    }
+
+private:
+    void Release();
+
+    const std::byte* data_ = nullptr;
+    size_t size_ = 0;
+#ifdef _WIN32
+    void* mapping_ = nullptr;  // HANDLE объекта отображения
+#endif
+};
+
+// Пиксели прямо в отображённом файле, без копирования.
+// Строки идут сверху вниз с шагом stride байт; у BMP строки в файле
+// обычно хранятся снизу вверх, поэтому шаг отрицательный
+struct MappedPixels {
+    const std::byte* top_row = nullptr;
+    std::ptrdiff_t stride = 0;
+    Size size = {0, 0};
+    PixelFormat format = PixelFormat::RGB24;  // BGR24 или BGRA32 у BMP, RGB24 у PPM
+
+    const std::byte* GetRow(int y) const {
+        return top_row + stride * y;
+    }
+
+    // Вид прямо на строки отображения, с их выравниванием и порядком:
+    // сохранение вида кодирует файл без промежуточной копии кадра
+    ImageView GetView() const {
+        return {top_row, size.width, size.height, stride, format};
+    }
+};
+
+// Отображённый файл вместе с разобранной из него пиксельной областью.
+// file может быть пустым, если пиксели лежат в памяти вызывающего:
+// тогда за время жизни этой памяти отвечает он
+struct MappedImage {
+    MappedFile file;
+    MappedPixels pixels;
+};
+
+// Построчный читатель поверх отображённого изображения:
+// копирует строки из отображения сразу в полосу, без промежуточного буфера.
+// Строки полосы делятся между потоками по options
+std::unique_ptr<ImageReader> MakeMappedReader(MappedImage image, const RasterOptions& options = {});
+
+}  // namespace img_lib
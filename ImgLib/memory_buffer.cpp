@@ -0,0 +1,58 @@
+#include "memory_buffer.h"
+
+#include <cstring>
+
+using namespace std;
+
+namespace img_lib {
+
+ByteBufferStreamBuf::ByteBufferStreamBuf(ByteBuffer& buffer)
+    : buffer_(buffer) {
+    buffer_.clear();
+}
+
+streamsize ByteBufferStreamBuf::xsputn(const char* data, streamsize count) {
+    if (count <= 0) {
+        return 0;
+    }
+
+    const size_t end = pos_ + size_t(count);
+    if (end > buffer_.size()) {
+        buffer_.resize(end);
+    }
+    memcpy(buffer_.data() + pos_, data, size_t(count));
+    pos_ = end;
+    return count;
+}
+
+ByteBufferStreamBuf::int_type ByteBufferStreamBuf::overflow(int_type ch) {
+    if (traits_type::eq_int_type(ch, traits_type::eof())) {
+        return traits_type::not_eof(ch);
+    }
+
+    const char c = traits_type::to_char_type(ch);
+    xsputn(&c, 1);
+    return ch;
+}
+
+ByteBufferStreamBuf::pos_type ByteBufferStreamBuf::seekoff(off_type off, ios_base::seekdir dir,
+                                                           ios_base::openmode which) {
+    off_type base = 0;
+    if (dir == ios_base::cur) {
+        base = off_type(pos_);
+    } else if (dir == ios_base::end) {
+        base = off_type(buffer_.size());
+    }
+    return seekpos(pos_type(base + off), which);
+}
+
+ByteBufferStreamBuf::pos_type ByteBufferStreamBuf::seekpos(pos_type pos, ios_base::openmode which) {
+    if (!(which & ios_base::out) || off_type(pos) < 0) {
+        return pos_type(off_type(-1));
+    }
+
+    pos_ = size_t(off_type(pos));
+    return pos;
+}
+
+}  // namespace img_lib
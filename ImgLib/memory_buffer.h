@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <streambuf>
+#include <vector>
+
+namespace img_lib {
+
+// Растущий буфер, в который кодеки записывают закодированный файл
+using ByteBuffer = std::vector<std::byte>;
+
+// Закодированный файл в памяти, только для чтения (аналог
+// std::span<const std::byte> из C++20). Память не копируется:
+// она должна жить, пока с ней работает созданный по ней читатель
+class ByteView {
+public:
+    ByteView() = default;
+
+    ByteView(const void* data, size_t size)
+        : data_(static_cast<const std::byte*>(data))
+        , size_(size) {
+    }
+
+    ByteView(const ByteBuffer& buffer)
+        : ByteView(buffer.data(), buffer.size()) {
+    }
+
+    const std::byte* GetData() const {
+        return data_;
+    }
+
+    size_t GetSize() const {
+        return size_;
+    }
+
+private:
+    const std::byte* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// Буфер потока, пишущий в ByteBuffer. Поддерживает переход к любой
+// позиции, в том числе за конец данных: пропуск заполняется нулями.
+// Нужен кодекам, которые пишут файл через std::ostream
+class ByteBufferStreamBuf : public std::streambuf {
+public:
+    // содержимое buffer заменяется, уже выделенная ёмкость переиспользуется
+    explicit ByteBufferStreamBuf(ByteBuffer& buffer);
+
+protected:
+    std::streamsize xsputn(const char* data, std::streamsize count) override;
+    int_type overflow(int_type ch) override;
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override;
+    pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
+
+private:
+    ByteBuffer& buffer_;
+    size_t pos_ = 0;
+};
+
+}  // namespace img_lib
@@ -0,0 +1,181 @@
+#include "output_file.h"
+#include "buffer_pool.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <fstream>
+
+#ifndef _WIN32
+    #include <cerrno>
+    #include <fcntl.h>
+    #include <sys/uio.h>
+    #include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace img_lib {
+
+namespace {
+
+#ifdef _WIN32
+
+// в Windows достаточно filebuf с буфером заданного размера
+class BufferedFileBuf : public filebuf {
+public:
+    BufferedFileBuf(const Path& file, const FileWriteOptions& options)
+        : buffer_(max<size_t>(options.buffer_size, 1)) {
+        pubsetbuf(reinterpret_cast<char*>(buffer_.GetData()), streamsize(buffer_.GetSize()));
+        open(file, ios::out | ios::binary);
+    }
+
+private:
+    PooledBuffer buffer_;
+};
+
+#else
+
+// Буфер потока поверх дескриптора файла. В отличие от filebuf размер
+// буфера задаётся явно, а по закрытии можно освободить кэш страниц
+class FileWriteBuf : public streambuf {
+public:
+    FileWriteBuf(const Path& file, const FileWriteOptions& options)
+        : fd_(open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666))
+        , buffer_(max<size_t>(options.buffer_size, 1))
+        , drop_page_cache_(options.drop_page_cache) {
+        ResetBuffer();
+    }
+
+    ~FileWriteBuf() override {
+        if (fd_ < 0) {
+            return;
+        }
+        Flush();
+        if (drop_page_cache_) {
+            // вытеснить можно только уже записанные на диск страницы
+            fdatasync(fd_);
+            posix_fadvise(fd_, 0, 0, POSIX_FADV_DONTNEED);
+        }
+        close(fd_);
+    }
+
+    // как у filebuf, чтобы обе реализации проверялись одинаково
+    bool is_open() const {
+        return fd_ >= 0;
+    }
+
+protected:
+    streamsize xsputn(const char* data, streamsize count) override {
+        if (count <= epptr() - pptr()) {
+            copy(data, data + count, pptr());
+            pbump(int(count));
+            return count;
+        }
+
+        // содержимое буфера и новые данные уходят одним вызовом
+        iovec parts[2] = {
+            {pbase(), size_t(pptr() - pbase())},
+            {const_cast<char*>(data), size_t(count)},
+        };
+        if (!WriteAll(parts, 2)) {
+            return 0;
+        }
+        ResetBuffer();
+        return count;
+    }
+
+    int_type overflow(int_type ch) override {
+        if (!Flush()) {
+            return traits_type::eof();
+        }
+        if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(ch);
+            pbump(1);
+        }
+        return traits_type::not_eof(ch);
+    }
+
+    int sync() override {
+        return Flush() ? 0 : -1;
+    }
+
+    pos_type seekoff(off_type off, ios_base::seekdir dir, ios_base::openmode which) override {
+        if (!(which & ios_base::out) || !Flush()) {
+            return pos_type(off_type(-1));
+        }
+        const int whence = dir == ios_base::beg ? SEEK_SET : dir == ios_base::cur ? SEEK_CUR : SEEK_END;
+        return pos_type(off_type(lseek(fd_, off, whence)));
+    }
+
+    pos_type seekpos(pos_type pos, ios_base::openmode which) override {
+        return seekoff(off_type(pos), ios_base::beg, which);
+    }
+
+private:
+    void ResetBuffer() {
+        char* begin = reinterpret_cast<char*>(buffer_.GetData());
+        setp(begin, begin + buffer_.GetSize());
+    }
+
+    bool Flush() {
+        iovec part = {pbase(), size_t(pptr() - pbase())};
+        const bool ok = WriteAll(&part, 1);
+        ResetBuffer();
+        return ok;
+    }
+
+    // пишет части целиком, повторяя вызов после частичной записи
+    bool WriteAll(iovec* parts, int count) {
+        while (count > 0) {
+            if (parts->iov_len == 0) {
+                ++parts;
+                --count;
+                continue;
+            }
+
+            const ssize_t written = writev(fd_, parts, count);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            IMGLIB_TRACE_BYTES(BYTES_WRITTEN, uint64_t(written));
+
+            for (size_t left = size_t(written); left > 0;) {
+                const size_t step = min(left, parts->iov_len);
+                parts->iov_base = static_cast<char*>(parts->iov_base) + step;
+                parts->iov_len -= step;
+                left -= step;
+                if (parts->iov_len == 0) {
+                    ++parts;
+                    --count;
+                }
+            }
+        }
+        return true;
+    }
+
+    int fd_;
+    PooledBuffer buffer_;
+    bool drop_page_cache_;
+};
+
+#endif
+
+}  // namespace
+
+unique_ptr<streambuf> OpenFileForWrite(const Path& file, const FileWriteOptions& options) {
+    IMGLIB_TRACE_SCOPE("file.open_write");
+#ifdef _WIN32
+    auto buf = make_unique<BufferedFileBuf>(file, options);
+#else
+    auto buf = make_unique<FileWriteBuf>(file, options);
+#endif
+    if (!buf->is_open()) {
+        return nullptr;
+    }
+    return buf;
+}
+
+}  // namespace img_lib
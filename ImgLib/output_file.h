@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <streambuf>
+
+namespace img_lib {
+using Path = std::filesystem::path;
+
+// размер буфера записи по умолчанию: на сетевых файловых системах каждый
+// системный вызов дорог, а 1 МиБ сводит их число к одному на мегабайт файла
+inline constexpr size_t DEFAULT_WRITE_BUFFER_SIZE = size_t(1) << 20;
+
+// Параметры записи файлов кодеками без сжатия (PPM, BMP)
+struct FileWriteOptions {
+    // Данные копируются в буфер и уходят в файл одним вызовом на буфер.
+    // Запись крупнее свободного места отправляется вместе с содержимым
+    // буфера одним writev, без лишнего копирования
+    size_t buffer_size = DEFAULT_WRITE_BUFFER_SIZE;
+
+    // Записанный файл больше не понадобится этому процессу: при закрытии
+    // он сбрасывается на диск и вытесняется из кэша страниц (posix_fadvise).
+    // Сам файл пишется дольше, зато пакетная конвертация больших
+    // изображений не вытесняет из памяти всё остальное
+    bool drop_page_cache = false;
+};
+
+// Открывает файл для записи, создавая или обрезая его.
+// Буфер поддерживает переходы по файлу для кодеков, которые пишут не по порядку.
+// nullptr - если файл не удалось открыть
+std::unique_ptr<std::streambuf> OpenFileForWrite(const Path& file, const FileWriteOptions& options = {});
+
+}  // namespace img_lib
@@ -0,0 +1,87 @@
+#include "parallel_rows.h"
+
+#include <algorithm>
+#include <climits>
+#include <condition_variable>
+#include <mutex>
+
+using namespace std;
+
+namespace img_lib {
+
+namespace {
+
+// меньшие диапазоны не окупают передачу задачи в пул
+const size_t MIN_BYTES_PER_RANGE = size_t(256) << 10;
+
+// true в потоке, который выполняет диапазон ParallelForRows
+thread_local bool inside_parallel_rows = false;
+
+// число диапазонов, на которые можно делить строки
+size_t GetRangeCount(const RasterOptions& options) {
+    return options.threads > 0 ? size_t(options.threads) : GetSharedThreadPool().GetThreadCount();
+}
+
+}  // namespace
+
+ThreadPool& GetSharedThreadPool() {
+    static ThreadPool pool;
+    return pool;
+}
+
+void ParallelForRows(int rows, size_t row_bytes, const RasterOptions& options,
+                     const function<void(int begin, int end)>& body) {
+    if (rows <= 0) {
+        return;
+    }
+
+    size_t ranges = GetRangeCount(options);
+    const size_t total_bytes = size_t(rows) * max<size_t>(row_bytes, 1);
+    ranges = min({ranges, size_t(rows), max<size_t>(total_bytes / MIN_BYTES_PER_RANGE, 1)});
+
+    if (ranges <= 1 || inside_parallel_rows) {
+        body(0, rows);
+        return;
+    }
+
+    mutex done_mutex;
+    condition_variable all_done;
+    size_t pending = ranges - 1;
+
+    auto range_begin = [&](size_t i) {
+        return int(int64_t(rows) * int64_t(i) / int64_t(ranges));
+    };
+
+    ThreadPool& pool = GetSharedThreadPool();
+    for (size_t i = 1; i < ranges; ++i) {
+        pool.Submit([&, begin = range_begin(i), end = range_begin(i + 1)] {
+            inside_parallel_rows = true;
+            body(begin, end);
+            inside_parallel_rows = false;
+
+            lock_guard lock(done_mutex);
+            if (--pending == 0) {
+                all_done.notify_one();
+            }
+        });
+    }
+
+    // первый диапазон - в этом потоке, пока пул занят остальными
+    inside_parallel_rows = true;
+    body(0, range_begin(1));
+    inside_parallel_rows = false;
+
+    unique_lock lock(done_mutex);
+    all_done.wait(lock, [&] { return pending == 0; });
+}
+
+int GetParallelChunkRows(size_t row_bytes, size_t min_bytes, const RasterOptions& options) {
+    row_bytes = max<size_t>(row_bytes, 1);
+    size_t bytes = min_bytes;
+    if (options.threads != 1) {
+        bytes = max(bytes, GetRangeCount(options) * MIN_BYTES_PER_RANGE);
+    }
+    return int(min<size_t>(max<size_t>(bytes / row_bytes, 1), INT_MAX));
+}
+
+}  // namespace img_lib
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "thread_pool.h"
+
+#include <cstddef>
+#include <functional>
+
+namespace img_lib {
+
+// Параметры построчной обработки форматов без сжатия (PPM, BMP):
+// перестановки каналов и разворота строк при загрузке и сохранении
+struct RasterOptions {
+    // число частей, на которые делятся строки: 1 - в вызывающем потоке,
+    // 0 - по числу ядер. Части выполняются на общем пуле GetSharedThreadPool
+    int threads = 1;
+};
+
+// Общий пул с потоком на каждое ядро, создаётся при первом обращении.
+// Один на процесс, чтобы параллельные циклы разных файлов в пакетном
+// режиме не создавали каждый свои потоки
+ThreadPool& GetSharedThreadPool();
+
+// Выполняет body(begin, end) для диапазонов строк, покрывающих [0, rows),
+// и возвращается, когда все диапазоны готовы. Строк на диапазон
+// не меньше, чем помещается в несколько сотен килобайт при длине строки
+// row_bytes, иначе подготовка задачи дороже самой работы. Один диапазон
+// выполняет вызывающий поток. Вызов из задачи общего пула выполняется
+// целиком в текущем потоке: ожидание внутри задачи могло бы занять все
+// потоки пула. body не должен бросать исключений
+void ParallelForRows(int rows, size_t row_bytes, const RasterOptions& options,
+                     const std::function<void(int begin, int end)>& body);
+
+// Число строк длиной row_bytes в куске, который переставляется параллельно
+// и пишется одной записью: не меньше min_bytes и не меньше, чем нужно,
+// чтобы ParallelForRows заняла все потоки из options
+int GetParallelChunkRows(size_t row_bytes, size_t min_bytes, const RasterOptions& options);
+
+}  // namespace img_lib
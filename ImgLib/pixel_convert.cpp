@@ -0,0 +1,120 @@
+#include "pixel_convert.h"
+#include "pixel_kernels.h"
+
+#include <climits>
+#include <cstring>
+
+using namespace std;
+
+namespace img_lib {
+
+namespace {
+
+// каналы пикселя идут в порядке B, G, R
+template <typename Pixel>
+constexpr bool IS_BGR = PixelTraits<Pixel>::format == PixelFormat::BGR24
+    || PixelTraits<Pixel>::format == PixelFormat::BGRA32;
+
+// Ядро перестановки каналов для пары форматов, nullptr - форматы совпадают.
+// SIMD-ядра выбираются по процессору, поэтому берутся из таблицы, а пара
+// известна при компиляции. Ядра переставляют байты, а не именованные
+// каналы, поэтому пары с BGRA32 берут ядра RGBA32 с нужным порядком:
+// BGRA32 -> BGR24 - то же, что RGBA32 -> RGB24
+template <typename Src, typename Dst>
+SwizzleKernel SelectKernel(const SwizzleKernels& kernels) {
+    constexpr bool SAME_ORDER = IS_BGR<Src> == IS_BGR<Dst>;
+    if constexpr (PixelTraits<Src>::format == PixelTraits<Dst>::format) {
+        return nullptr;
+    } else if constexpr (PixelTraits<Src>::has_alpha == PixelTraits<Dst>::has_alpha) {
+        // пиксели одного размера в разных форматах отличаются только порядком
+        return PixelTraits<Dst>::has_alpha ? kernels.rgba_to_bgra : kernels.swap_rb;
+    } else if constexpr (PixelTraits<Dst>::has_alpha) {
+        return SAME_ORDER ? kernels.rgb_to_rgba : kernels.bgr_to_rgba;
+    } else {
+        return SAME_ORDER ? kernels.rgba_to_rgb : kernels.rgba_to_bgr;
+    }
+}
+
+template <typename Src, typename Dst>
+void ConvertRowsOf(const std::byte* src, ptrdiff_t src_stride, std::byte* dst, ptrdiff_t dst_stride,
+                   int width, int rows) {
+    const SwizzleKernel kernel = SelectKernel<Src, Dst>(GetSwizzleKernels());
+
+    auto convert = [kernel](const std::byte* from, std::byte* to, int count) {
+        if constexpr (is_same_v<Src, Dst>) {
+            memcpy(to, from, size_t(count) * sizeof(Src));
+        } else {
+            kernel(from, to, count);
+        }
+    };
+
+    const ptrdiff_t src_row = ptrdiff_t(sizeof(Src)) * width;
+    const ptrdiff_t dst_row = ptrdiff_t(sizeof(Dst)) * width;
+    // строки вплотную друг к другу и в одном направлении: ядро проходит
+    // область за один вызов, без хвоста на каждой строке
+    const bool packed = (src_stride == src_row && dst_stride == dst_row)
+        || (src_stride == -src_row && dst_stride == -dst_row);
+    if (rows > 1 && packed && ptrdiff_t(width) * rows <= INT_MAX) {
+        if (src_stride < 0) {
+            // начало области - её последняя строка
+            src += src_stride * (rows - 1);
+            dst += dst_stride * (rows - 1);
+        }
+        convert(src, dst, width * rows);
+        return;
+    }
+
+    for (int y = 0; y < rows; ++y) {
+        convert(src + src_stride * y, dst + dst_stride * y, width);
+    }
+}
+
+using RowsConverter = void (*)(const std::byte*, ptrdiff_t, std::byte*, ptrdiff_t, int, int);
+
+template <typename Src>
+RowsConverter SelectConverter(PixelFormat dst_format) {
+    switch (dst_format) {
+        case PixelFormat::RGB24:
+            return ConvertRowsOf<Src, RGB24>;
+        case PixelFormat::BGR24:
+            return ConvertRowsOf<Src, BGR24>;
+        case PixelFormat::BGRA32:
+            return ConvertRowsOf<Src, BGRA32>;
+        case PixelFormat::RGBA32:
+        default:
+            return ConvertRowsOf<Src, Color>;
+    }
+}
+
+// одна из шестнадцати специализаций ConvertRowsOf
+RowsConverter SelectConverter(PixelFormat src_format, PixelFormat dst_format) {
+    switch (src_format) {
+        case PixelFormat::RGB24:
+            return SelectConverter<RGB24>(dst_format);
+        case PixelFormat::BGR24:
+            return SelectConverter<BGR24>(dst_format);
+        case PixelFormat::BGRA32:
+            return SelectConverter<BGRA32>(dst_format);
+        case PixelFormat::RGBA32:
+        default:
+            return SelectConverter<Color>(dst_format);
+    }
+}
+
+}  // namespace
+
+void ConvertRow(const std::byte* src, PixelFormat src_format,
+                std::byte* dst, PixelFormat dst_format, int width) {
+    ConvertRows(src, 0, src_format, dst, 0, dst_format, width, 1);
+}
+
+void ConvertRows(const std::byte* src, std::ptrdiff_t src_stride, PixelFormat src_format,
+                 std::byte* dst, std::ptrdiff_t dst_stride, PixelFormat dst_format,
+                 int width, int rows) {
+    if (rows <= 0 || width <= 0) {
+        return;
+    }
+    SelectConverter(src_format, dst_format)(src, src_stride, dst, dst_stride, width, rows);
+}
+
+}  // namespace img_lib
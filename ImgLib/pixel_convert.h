@@ -0,0 +1,23 @@
+#pragma once
+#include "img_lib.h"
+
+#include <cstddef>
+
+namespace img_lib {
+
+// Переводит width пикселей строки из формата src_format в dst_format.
+// При совпадении форматов это простое копирование, при переходе
+// к RGBA32 или BGRA32 альфа-канал заполняется значением 255.
+// Буферы src и dst не должны перекрываться
+void ConvertRow(const std::byte* src, PixelFormat src_format,
+                std::byte* dst, PixelFormat dst_format, int width);
+
+// То же для rows строк с шагами src_stride и dst_stride байт. Шаг может быть
+// отрицательным - тогда строки идут снизу вверх, как в BMP. Пара форматов
+// выбирается один раз на всю область, а области без промежутков между
+// строками и с одним направлением обрабатываются как одна длинная строка
+void ConvertRows(const std::byte* src, std::ptrdiff_t src_stride, PixelFormat src_format,
+                 std::byte* dst, std::ptrdiff_t dst_stride, PixelFormat dst_format,
+                 int width, int rows);
+
+}  // namespace img_lib
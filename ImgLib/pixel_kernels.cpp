@@ -0,0 +1,432 @@
+#include "pixel_kernels.h"
+#include "img_lib.h"
+
+#include <cstdint>
+#include <initializer_list>
+
+#if !defined(IMGLIB_NO_SIMD)
+    #if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+        #define IMGLIB_SIMD_X86 1
+        #include <immintrin.h>
+        #if defined(_MSC_VER) && !defined(__clang__)
+            #include <intrin.h>
+        #endif
+    #elif defined(__aarch64__) || defined(_M_ARM64) || defined(__ARM_NEON)
+        #define IMGLIB_SIMD_NEON 1
+        #include <arm_neon.h>
+    #endif
+#endif
+
+// GCC и Clang компилируют функцию под расширенный набор инструкций
+// только по атрибуту target; MSVC разрешает интринсики и без него
+#if defined(IMGLIB_SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+    #define IMGLIB_TARGET(isa) __attribute__((target(isa)))
+#else
+    #define IMGLIB_TARGET(isa)
+#endif
+
+using namespace std;
+
+namespace img_lib {
+
+namespace {
+
+// Скалярные ядра: запасной вариант и обработка хвостов строк в SIMD-ядрах.
+// Каналы копируются по именам полей типов пикселей, поэтому порядок байт
+// каждой пары форматов известен при компиляции и цикл раскрывается целиком
+template <typename Src, typename Dst>
+void SwizzleScalar(const std::byte* src, std::byte* dst, int width) {
+    const Src* in = reinterpret_cast<const Src*>(src);
+    Dst* out = reinterpret_cast<Dst*>(dst);
+    for (int x = 0; x < width; ++x) {
+        out[x].r = in[x].r;
+        out[x].g = in[x].g;
+        out[x].b = in[x].b;
+        if constexpr (PixelTraits<Dst>::has_alpha) {
+            out[x].a = std::byte{255};
+        }
+    }
+}
+
+constexpr SwizzleKernel SWAP_RB_SCALAR = SwizzleScalar<RGB24, BGR24>;  // то же ядро и для BGR24 -> RGB24
+constexpr SwizzleKernel RGB_TO_RGBA_SCALAR = SwizzleScalar<RGB24, Color>;
+constexpr SwizzleKernel BGR_TO_RGBA_SCALAR = SwizzleScalar<BGR24, Color>;
+constexpr SwizzleKernel RGBA_TO_RGB_SCALAR = SwizzleScalar<Color, RGB24>;
+constexpr SwizzleKernel RGBA_TO_BGR_SCALAR = SwizzleScalar<Color, BGR24>;
+constexpr SwizzleKernel RGBA_TO_BGRA_SCALAR = SwizzleScalar<Color, BGRA32>;  // и для BGRA32 -> RGBA32
+
+const SwizzleKernels SCALAR_KERNELS = {
+    SimdLevel::SCALAR,
+    SWAP_RB_SCALAR,
+    RGB_TO_RGBA_SCALAR,
+    BGR_TO_RGBA_SCALAR,
+    RGBA_TO_RGB_SCALAR,
+    RGBA_TO_BGR_SCALAR,
+    RGBA_TO_BGRA_SCALAR,
+};
+
+#if defined(IMGLIB_SIMD_X86)
+
+// Маски pshufb задают индекс исходного байта, -1 даёт ноль.
+// Векторные циклы читают и пишут по 16 байт, поэтому выходят из цикла
+// с запасом до конца строки; остаток обрабатывает скалярное ядро.
+// Условие x + 6 <= width гарантирует, что 16 байт от пикселя x в упакованной
+// 3-байтовой строке не выходят за её конец (3 * x + 16 <= 3 * width)
+
+// 5 пикселей за итерацию; 16-й байт переносится как есть и
+// перезаписывается следующей итерацией или хвостом
+IMGLIB_TARGET("ssse3")
+void SwapRBSSSE3(const std::byte* src, std::byte* dst, int width) {
+    const __m128i mask = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 14, 13, 12, 15);
+    int x = 0;
+    for (; x + 6 <= width; x += 5) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 3 * x));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 3 * x), _mm_shuffle_epi8(v, mask));
+    }
+    SWAP_RB_SCALAR(src + 3 * x, dst + 3 * x, width - x);
+}
+
+// 4 пикселя из 3 байт в 4 байта с непрозрачной альфой
+template <SwizzleKernel Tail>
+IMGLIB_TARGET("ssse3")
+void ExpandSSSE3(const std::byte* src, std::byte* dst, int width, __m128i mask) {
+    const __m128i alpha = _mm_set1_epi32(int(0xFF000000u));
+    int x = 0;
+    for (; x + 6 <= width; x += 4) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 3 * x));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 4 * x),
+                         _mm_or_si128(_mm_shuffle_epi8(v, mask), alpha));
+    }
+    Tail(src + 3 * x, dst + 4 * x, width - x);
+}
+
+// 4 пикселя из 4 байт в 3 байта; последние 4 байта записи - мусор,
+// который перезаписывается следующей итерацией или хвостом
+template <SwizzleKernel Tail>
+IMGLIB_TARGET("ssse3")
+void CompactSSSE3(const std::byte* src, std::byte* dst, int width, __m128i mask) {
+    int x = 0;
+    for (; x + 6 <= width; x += 4) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 4 * x));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 3 * x), _mm_shuffle_epi8(v, mask));
+    }
+    Tail(src + 4 * x, dst + 3 * x, width - x);
+}
+
+IMGLIB_TARGET("ssse3")
+void RGBToRGBASSSE3(const std::byte* src, std::byte* dst, int width) {
+    const __m128i mask = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    ExpandSSSE3<RGB_TO_RGBA_SCALAR>(src, dst, width, mask);
+}
+
+IMGLIB_TARGET("ssse3")
+void BGRToRGBASSSE3(const std::byte* src, std::byte* dst, int width) {
+    const __m128i mask = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+    ExpandSSSE3<BGR_TO_RGBA_SCALAR>(src, dst, width, mask);
+}
+
+IMGLIB_TARGET("ssse3")
+void RGBAToRGBSSSE3(const std::byte* src, std::byte* dst, int width) {
+    const __m128i mask = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    CompactSSSE3<RGBA_TO_RGB_SCALAR>(src, dst, width, mask);
+}
+
+IMGLIB_TARGET("ssse3")
+void RGBAToBGRSSSE3(const std::byte* src, std::byte* dst, int width) {
+    const __m128i mask = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    CompactSSSE3<RGBA_TO_BGR_SCALAR>(src, dst, width, mask);
+}
+
+// 4 пикселя из 4 байт в 4 байта, перестановка не пересекает границ пикселей
+IMGLIB_TARGET("ssse3")
+void RGBAToBGRASSSE3(const std::byte* src, std::byte* dst, int width) {
+    const __m128i mask = _mm_setr_epi8(2, 1, 0, -1, 6, 5, 4, -1, 10, 9, 8, -1, 14, 13, 12, -1);
+    const __m128i alpha = _mm_set1_epi32(int(0xFF000000u));
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 4 * x));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 4 * x),
+                         _mm_or_si128(_mm_shuffle_epi8(v, mask), alpha));
+    }
+    RGBA_TO_BGRA_SCALAR(src + 4 * x, dst + 4 * x, width - x);
+}
+
+const SwizzleKernels SSSE3_KERNELS = {
+    SimdLevel::SSSE3,
+    SwapRBSSSE3,
+    RGBToRGBASSSE3,
+    BGRToRGBASSSE3,
+    RGBAToRGBSSSE3,
+    RGBAToBGRSSSE3,
+    RGBAToBGRASSSE3,
+};
+
+// AVX2 перемешивает байты только внутри 128-битных половин, поэтому
+// 8 пикселей по 3 байта загружаются двумя половинами: с 0-го и с 12-го байта.
+// 16 байт со смещения 12 от пикселя x не выходят за строку при x + 10 <= width
+template <SwizzleKernel Tail>
+IMGLIB_TARGET("avx2")
+void ExpandAVX2(const std::byte* src, std::byte* dst, int width, __m256i mask) {
+    const __m256i alpha = _mm256_set1_epi32(int(0xFF000000u));
+    int x = 0;
+    for (; x + 10 <= width; x += 8) {
+        const __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 3 * x));
+        const __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 3 * x + 12));
+        const __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 4 * x),
+                            _mm256_or_si256(_mm256_shuffle_epi8(v, mask), alpha));
+    }
+    Tail(src + 3 * x, dst + 4 * x, width - x);
+}
+
+// После перемешивания в каждой половине 12 полезных байт; permutevar8x32
+// склеивает их в 24 подряд, которые записываются точно, без выхода за строку
+template <SwizzleKernel Tail>
+IMGLIB_TARGET("avx2")
+void CompactAVX2(const std::byte* src, std::byte* dst, int width, __m256i mask) {
+    const __m256i pack = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 4 * x));
+        const __m256i packed = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(v, mask), pack);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 3 * x), _mm256_castsi256_si128(packed));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + 3 * x + 16), _mm256_extracti128_si256(packed, 1));
+    }
+    Tail(src + 4 * x, dst + 3 * x, width - x);
+}
+
+IMGLIB_TARGET("avx2")
+void RGBToRGBAAVX2(const std::byte* src, std::byte* dst, int width) {
+    const __m256i mask = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+                                          0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    ExpandAVX2<RGB_TO_RGBA_SCALAR>(src, dst, width, mask);
+}
+
+IMGLIB_TARGET("avx2")
+void BGRToRGBAAVX2(const std::byte* src, std::byte* dst, int width) {
+    const __m256i mask = _mm256_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1,
+                                          2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+    ExpandAVX2<BGR_TO_RGBA_SCALAR>(src, dst, width, mask);
+}
+
+IMGLIB_TARGET("avx2")
+void RGBAToRGBAVX2(const std::byte* src, std::byte* dst, int width) {
+    const __m256i mask = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                          0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    CompactAVX2<RGBA_TO_RGB_SCALAR>(src, dst, width, mask);
+}
+
+IMGLIB_TARGET("avx2")
+void RGBAToBGRAVX2(const std::byte* src, std::byte* dst, int width) {
+    const __m256i mask = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                          2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    CompactAVX2<RGBA_TO_BGR_SCALAR>(src, dst, width, mask);
+}
+
+IMGLIB_TARGET("avx2")
+void RGBAToBGRAAVX2(const std::byte* src, std::byte* dst, int width) {
+    const __m256i mask = _mm256_setr_epi8(2, 1, 0, -1, 6, 5, 4, -1, 10, 9, 8, -1, 14, 13, 12, -1,
+                                          2, 1, 0, -1, 6, 5, 4, -1, 10, 9, 8, -1, 14, 13, 12, -1);
+    const __m256i alpha = _mm256_set1_epi32(int(0xFF000000u));
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 4 * x));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 4 * x),
+                            _mm256_or_si256(_mm256_shuffle_epi8(v, mask), alpha));
+    }
+    RGBA_TO_BGRA_SCALAR(src + 4 * x, dst + 4 * x, width - x);
+}
+
+// перестановка R и B внутри 3-байтовых пикселей не выигрывает от AVX2
+// из-за границы половин, поэтому остаётся ядро SSSE3
+const SwizzleKernels AVX2_KERNELS = {
+    SimdLevel::AVX2,
+    SwapRBSSSE3,
+    RGBToRGBAAVX2,
+    BGRToRGBAAVX2,
+    RGBAToRGBAVX2,
+    RGBAToBGRAVX2,
+    RGBAToBGRAAVX2,
+};
+
+bool CpuSupports(SimdLevel level) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_cpu_init();
+    switch (level) {
+        case SimdLevel::SSSE3:
+            return __builtin_cpu_supports("ssse3");
+        case SimdLevel::AVX2:
+            return __builtin_cpu_supports("avx2");
+        default:
+            return level == SimdLevel::SCALAR;
+    }
+#else
+    int info[4];
+    __cpuid(info, 1);
+    const bool ssse3 = (info[2] & (1 << 9)) != 0;
+    // AVX2 требует ещё и поддержки сохранения YMM-регистров со стороны ОС
+    const bool os_avx = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 0x6) == 0x6;
+    __cpuidex(info, 7, 0);
+    const bool avx2 = os_avx && (info[1] & (1 << 5)) != 0;
+
+    switch (level) {
+        case SimdLevel::SSSE3:
+            return ssse3;
+        case SimdLevel::AVX2:
+            return avx2;
+        default:
+            return level == SimdLevel::SCALAR;
+    }
+#endif
+}
+
+#elif defined(IMGLIB_SIMD_NEON)
+
+// NEON умеет раскладывать чередующиеся каналы при загрузке (vld3/vld4)
+// и собирать их обратно при записи (vst3/vst4), по 16 пикселей за раз
+
+void SwapRBNEON(const std::byte* src, std::byte* dst, int width) {
+    const auto* in = reinterpret_cast<const uint8_t*>(src);
+    auto* out = reinterpret_cast<uint8_t*>(dst);
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        const uint8x16x3_t v = vld3q_u8(in + 3 * x);
+        vst3q_u8(out + 3 * x, uint8x16x3_t{{v.val[2], v.val[1], v.val[0]}});
+    }
+    SWAP_RB_SCALAR(src + 3 * x, dst + 3 * x, width - x);
+}
+
+void RGBToRGBANEON(const std::byte* src, std::byte* dst, int width) {
+    const auto* in = reinterpret_cast<const uint8_t*>(src);
+    auto* out = reinterpret_cast<uint8_t*>(dst);
+    const uint8x16_t alpha = vdupq_n_u8(255);
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        const uint8x16x3_t v = vld3q_u8(in + 3 * x);
+        vst4q_u8(out + 4 * x, uint8x16x4_t{{v.val[0], v.val[1], v.val[2], alpha}});
+    }
+    RGB_TO_RGBA_SCALAR(src + 3 * x, dst + 4 * x, width - x);
+}
+
+void BGRToRGBANEON(const std::byte* src, std::byte* dst, int width) {
+    const auto* in = reinterpret_cast<const uint8_t*>(src);
+    auto* out = reinterpret_cast<uint8_t*>(dst);
+    const uint8x16_t alpha = vdupq_n_u8(255);
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        const uint8x16x3_t v = vld3q_u8(in + 3 * x);
+        vst4q_u8(out + 4 * x, uint8x16x4_t{{v.val[2], v.val[1], v.val[0], alpha}});
+    }
+    BGR_TO_RGBA_SCALAR(src + 3 * x, dst + 4 * x, width - x);
+}
+
+void RGBAToRGBNEON(const std::byte* src, std::byte* dst, int width) {
+    const auto* in = reinterpret_cast<const uint8_t*>(src);
+    auto* out = reinterpret_cast<uint8_t*>(dst);
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        const uint8x16x4_t v = vld4q_u8(in + 4 * x);
+        vst3q_u8(out + 3 * x, uint8x16x3_t{{v.val[0], v.val[1], v.val[2]}});
+    }
+    RGBA_TO_RGB_SCALAR(src + 4 * x, dst + 3 * x, width - x);
+}
+
+void RGBAToBGRNEON(const std::byte* src, std::byte* dst, int width) {
+    const auto* in = reinterpret_cast<const uint8_t*>(src);
+    auto* out = reinterpret_cast<uint8_t*>(dst);
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        const uint8x16x4_t v = vld4q_u8(in + 4 * x);
+        vst3q_u8(out + 3 * x, uint8x16x3_t{{v.val[2], v.val[1], v.val[0]}});
+    }
+    RGBA_TO_BGR_SCALAR(src + 4 * x, dst + 3 * x, width - x);
+}
+
+void RGBAToBGRANEON(const std::byte* src, std::byte* dst, int width) {
+    const auto* in = reinterpret_cast<const uint8_t*>(src);
+    auto* out = reinterpret_cast<uint8_t*>(dst);
+    const uint8x16_t alpha = vdupq_n_u8(255);
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        const uint8x16x4_t v = vld4q_u8(in + 4 * x);
+        vst4q_u8(out + 4 * x, uint8x16x4_t{{v.val[2], v.val[1], v.val[0], alpha}});
+    }
+    RGBA_TO_BGRA_SCALAR(src + 4 * x, dst + 4 * x, width - x);
+}
+
+const SwizzleKernels NEON_KERNELS = {
+    SimdLevel::NEON,
+    SwapRBNEON,
+    RGBToRGBANEON,
+    BGRToRGBANEON,
+    RGBAToRGBNEON,
+    RGBAToBGRNEON,
+    RGBAToBGRANEON,
+};
+
+// NEON обязателен для AArch64, проверять его во время работы не нужно
+bool CpuSupports(SimdLevel level) {
+    return level == SimdLevel::SCALAR || level == SimdLevel::NEON;
+}
+
+#else
+
+bool CpuSupports(SimdLevel level) {
+    return level == SimdLevel::SCALAR;
+}
+
+#endif
+
+}  // namespace
+
+SimdLevel GetSupportedSimdLevel() {
+    static const SimdLevel level = [] {
+        for (SimdLevel candidate : {SimdLevel::AVX2, SimdLevel::SSSE3, SimdLevel::NEON}) {
+            if (CpuSupports(candidate)) {
+                return candidate;
+            }
+        }
+        return SimdLevel::SCALAR;
+    }();
+    return level;
+}
+
+const SwizzleKernels& GetSwizzleKernels() {
+    static const SwizzleKernels& kernels = GetSwizzleKernels(GetSupportedSimdLevel());
+    return kernels;
+}
+
+const SwizzleKernels& GetSwizzleKernels(SimdLevel level) {
+    if (!CpuSupports(level)) {
+        return SCALAR_KERNELS;
+    }
+
+    switch (level) {
+#if defined(IMGLIB_SIMD_X86)
+        case SimdLevel::SSSE3:
+            return SSSE3_KERNELS;
+        case SimdLevel::AVX2:
+            return AVX2_KERNELS;
+#elif defined(IMGLIB_SIMD_NEON)
+        case SimdLevel::NEON:
+            return NEON_KERNELS;
+#endif
+        default:
+            return SCALAR_KERNELS;
+    }
+}
+
+const char* GetSimdLevelName(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::SSSE3:
+            return "ssse3";
+        case SimdLevel::AVX2:
+            return "avx2";
+        case SimdLevel::NEON:
+            return "neon";
+        default:
+            return "scalar";
+    }
+}
+
+}  // namespace img_lib
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+
+namespace img_lib {
+
+// Ядро перестановки каналов: переводит width пикселей из src в dst.
+// Буферы не должны перекрываться
+using SwizzleKernel = void (*)(const std::byte* src, std::byte* dst, int width);
+
+// набор инструкций, под который собраны ядра
+enum class SimdLevel {
+    SCALAR,
+    SSSE3,
+    AVX2,
+    NEON,
+};
+
+// Ядра для всех пар упакованных форматов. При переходе к 4-байтовому
+// формату альфа-канал заполняется значением 255, при переходе от него отбрасывается
+struct SwizzleKernels {
+    SimdLevel level;
+    SwizzleKernel swap_rb;       // RGB24 <-> BGR24
+    SwizzleKernel rgb_to_rgba;
+    SwizzleKernel bgr_to_rgba;
+    SwizzleKernel rgba_to_rgb;
+    SwizzleKernel rgba_to_bgr;
+    SwizzleKernel rgba_to_bgra;  // RGBA32 <-> BGRA32
+};
+
+// лучший набор инструкций, доступный на этом процессоре
+SimdLevel GetSupportedSimdLevel();
+
+// Ядра, выбранные по процессору при первом вызове.
+// Сборка с -DIMGLIB_SIMD=OFF оставляет только скалярные ядра
+const SwizzleKernels& GetSwizzleKernels();
+
+// ядра заданного уровня; если он не поддерживается процессором
+// или сборкой, возвращаются скалярные. Нужно для тестов и замеров
+const SwizzleKernels& GetSwizzleKernels(SimdLevel level);
+
+const char* GetSimdLevelName(SimdLevel level);
+
+}  // namespace img_lib
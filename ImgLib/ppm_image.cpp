@@ -1,8 +1,16 @@
 #include "ppm_image.h"
+#include "mapped_file.h"
+#include "pixel_convert.h"
+#include "buffer_pool.h"
+#include "memory_buffer.h"
+#include "trace.h"
 
 #include <array>
+#include <cctype>
+#include <charconv>
 #include <fstream>
 #include <string_view>
+#include <string>
 
 using namespace std;
 
@@ -11,66 +19,302 @@ namespace img_lib {
 static const string_view PPM_SIG = "P6"sv;
 static const int PPM_MAX = 255;
 
-bool SavePPM(const Path& file, const Image& image) {
-    ofstream out(file, ios::binary);
+// не меньше стольких байт переставляется перед одной записью
+static const size_t PPM_WRITE_CHUNK_BYTES = size_t(1) << 20;
 
-    out << PPM_SIG << '\n' << image.GetWidth() << ' ' << image.GetHeight() << '\n' << PPM_MAX << '\n';
+// Разбирает заголовок "P6 <w> <h> 255\n" прямо из отображения или буфера,
+// по тем же правилам, что и потоковый PPMReader
+static optional<MappedPixels> ParseMappedPPM(ByteView file) {
+    IMGLIB_TRACE_SCOPE("ppm.header");
+    const char* pos = reinterpret_cast<const char*>(file.GetData());
+    const char* const end = pos + file.GetSize();
 
-    const int w = image.GetWidth();
-    const int h = image.GetHeight();
-    std::vector<char> buff(w * 3);
-
-    for (int y = 0; y < h; ++y) {
-        const Color* line = image.GetLine(y);
-        for (int x = 0; x < w; ++x) {
-            buff[x * 3 + 0] = static_cast<char>(line[x].r);
-            buff[x * 3 + 1] = static_cast<char>(line[x].g);
-            buff[x * 3 + 2] = static_cast<char>(line[x].b);
+    auto skip_spaces = [&] {
+        while (pos != end && isspace(static_cast<unsigned char>(*pos))) {
+            ++pos;
         }
-        out.write(buff.data(), w * 3);
+    };
+    auto read_int = [&](int& value) {
+        skip_spaces();
+        const auto [ptr, ec] = from_chars(pos, end, value);
+        pos = ptr;
+        return ec == errc{};
+    };
+
+    skip_spaces();
+    if (end - pos < 2 || string_view(pos, 2) != PPM_SIG) {
+        return nullopt;
+    }
+    pos += 2;
+
+    int w, h, color_max;
+    if (!read_int(w) || !read_int(h) || !read_int(color_max)
+        || color_max != PPM_MAX || w <= 0 || h <= 0) {
+        return nullopt;
+    }
+
+    // после заголовка ровно один перевод строки
+    if (pos == end || *pos != '\n') {
+        return nullopt;
+    }
+    ++pos;
+
+    const size_t row_size = size_t(w) * 3;
+    if (size_t(end - pos) < row_size * h) {
+        return nullopt; // файл обрезан
     }
 
-    return out.good();
+    MappedPixels pixels;
+    pixels.top_row = reinterpret_cast<const std::byte*>(pos);
+    pixels.stride = row_size;
+    pixels.size = {w, h};
+    pixels.format = PixelFormat::RGB24;
+    return pixels;
 }
 
-Image LoadPPM(const Path& file) {
-    // открываем поток с флагом ios::binary
-    // поскольку будем читать данные в двоичном формате
-    ifstream ifs(file, ios::binary);
-    std::string sign;
-    int w, h, color_max;
+namespace {
+
+class PPMReader : public ImageReader {
+public:
+    explicit PPMReader(const Path& file)
+        : ifs_(file, ios::binary) {
+    }
 
-    // читаем заголовок: он содержит формат, размеры изображения
-    // и максимальное значение цвета
-    ifs >> sign >> w >> h >> color_max;
+    // читает заголовок, после успешного вызова поток стоит на первом пикселе
+    bool Open() {
+        IMGLIB_TRACE_SCOPE("ppm.header");
+        std::string sign;
+        int color_max;
 
-    // мы поддерживаем изображения только формата P6
-    // с максимальным значением цвета 255
-    if (sign != PPM_SIG || color_max != PPM_MAX) {
-        return {};
+        // читаем заголовок: он содержит формат, размеры изображения
+        // и максимальное значение цвета
+        ifs_ >> sign >> size_.width >> size_.height >> color_max;
+
+        // мы поддерживаем изображения только формата P6
+        // с максимальным значением цвета 255
+        if (!ifs_ || sign != PPM_SIG || color_max != PPM_MAX
+            || size_.width <= 0 || size_.height <= 0) {
+            return false;
+        }
+
+        // пропускаем один байт - это конец строки
+        const char next = ifs_.get();
+        if (next != '\n') {
+            return false;
+        }
+
+        buff_.Resize(size_t(size_.width) * 3);
+        return true;
     }
 
-    // пропускаем один байт - это конец строки
-    const char next = ifs.get();
-    if (next != '\n') {
-        return {};
+    Size GetSize() const override {
+        return size_;
     }
 
-    Image result(w, h, Color::Black());
-    std::vector<char> buff(w * 3);
+    PixelFormat GetPixelFormat() const override {
+        return PixelFormat::RGB24;
+    }
 
-    for (int y = 0; y < h; ++y) {
-        Color* line = result.GetLine(y);
-        ifs.read(buff.data(), w * 3);
+    int ReadRows(Image& band) override {
+        IMGLIB_TRACE_SCOPE("ppm.read");
+        const int w = size_.width;
+        const int count = min(band.GetHeight(), size_.height - rows_read_);
+        // полоса в формате файла читается сразу на место, без буфера
+        const bool direct = band.GetFormat() == PixelFormat::RGB24;
 
-        for (int x = 0; x < w; ++x) {
-            line[x].r = static_cast<byte>(buff[x * 3 + 0]);
-            line[x].g = static_cast<byte>(buff[x * 3 + 1]);
-            line[x].b = static_cast<byte>(buff[x * 3 + 2]);
+        for (int y = 0; y < count; ++y) {
+            char* row = reinterpret_cast<char*>(direct ? band.GetRowData(y) : buff_.GetData());
+            ifs_.read(row, w * 3);
+            IMGLIB_TRACE_BYTES(BYTES_READ, uint64_t(ifs_.gcount()));
+            if (ifs_.gcount() != w * 3) {
+                return 0;
+            }
+
+            if (!direct) {
+                ConvertRow(reinterpret_cast<const std::byte*>(row), PixelFormat::RGB24,
+                           band.GetRowData(y), band.GetFormat(), w);
+            }
         }
+
+        rows_read_ += count;
+        return count;
+    }
+
+private:
+    ifstream ifs_;
+    Size size_ = {0, 0};
+    int rows_read_ = 0;
+    PooledBuffer buff_;
+};
+
+class PPMWriter : public ImageWriter {
+public:
+    // buf - файл или буфер в памяти, в который пишется изображение
+    PPMWriter(unique_ptr<streambuf> buf, Size size, const RasterOptions& raster)
+        : buf_(move(buf))
+        , out_(buf_.get())
+        , size_(size)
+        , raster_(raster)
+        , chunk_rows_(GetParallelChunkRows(size_t(size.width) * 3, PPM_WRITE_CHUNK_BYTES, raster)) {
+        WritePPMHeader(out_, size_);
     }
 
-    return result;
+    bool IsOpen() const {
+        return out_.good();
+    }
+
+    bool WriteRows(const ImageView& band, int count) override {
+        IMGLIB_TRACE_SCOPE("ppm.write");
+        const int w = size_.width;
+        if (count > size_.height - rows_written_) {
+            return false;
+        }
+
+        const size_t row_size = size_t(w) * 3;
+
+        if (band.GetFormat() == PixelFormat::RGB24) {
+            // строки в формате файла пишутся как есть, сплошная полоса - одной записью
+            if (band.GetStride() == ptrdiff_t(row_size)) {
+                out_.write(reinterpret_cast<const char*>(band.GetRowData(0)), row_size * count);
+            } else {
+                for (int y = 0; y < count; ++y) {
+                    out_.write(reinterpret_cast<const char*>(band.GetRowData(y)), row_size);
+                }
+            }
+        } else {
+            // куски переставляются несколькими потоками, но пишутся по порядку
+            for (int done = 0; done < count;) {
+                const int k = min(chunk_rows_, count - done);
+                chunk_.Resize(row_size * k);
+                ParallelForRows(k, row_size, raster_, [&](int begin, int end) {
+                    ConvertRows(band.GetRowData(done + begin), band.GetStride(), band.GetFormat(),
+                                chunk_.GetData() + row_size * begin, ptrdiff_t(row_size), PixelFormat::RGB24,
+                                w, end - begin);
+                });
+                out_.write(reinterpret_cast<const char*>(chunk_.GetData()), chunk_.GetSize());
+                done += k;
+            }
+        }
+
+        rows_written_ += count;
+        return out_.good();
+    }
+
+    bool Finish() override {
+        IMGLIB_TRACE_SCOPE("ppm.flush");
+        out_.flush();
+        return out_.good() && rows_written_ == size_.height;
+    }
+
+private:
+    unique_ptr<streambuf> buf_;
+    ostream out_;
+    Size size_;
+    RasterOptions raster_;
+    int chunk_rows_;
+    int rows_written_ = 0;
+    PooledBuffer chunk_;
+};
+
+}  // namespace
+
+void WritePPMHeader(ostream& out, Size size) {
+    // заголовок собирается в строке и пишется одним вызовом,
+    // без форматированного вывода в поток
+    const string header = string(PPM_SIG) + '\n' + to_string(size.width) + ' ' + to_string(size.height)
+        + '\n' + to_string(PPM_MAX) + '\n';
+    out.write(header.data(), header.size());
+}
+
+optional<ImageInfo> ProbePPM(const Path& file) {
+    PPMReader reader(file);
+    if (!reader.Open()) {
+        return nullopt;
+    }
+    return ImageInfo{FileFormat::PPM, reader.GetSize(), 3, 8};
+}
+
+optional<MappedImage> MapPPM(const Path& file) {
+    MappedFile mapped = MappedFile::Open(file);
+    if (!mapped) {
+        return nullopt;
+    }
+
+    auto pixels = ParseMappedPPM({mapped.GetData(), mapped.GetSize()});
+    if (!pixels) {
+        return nullopt;
+    }
+    return MappedImage{move(mapped), *pixels};
+}
+
+unique_ptr<ImageReader> OpenPPMReader(const Path& file, const RasterOptions& raster) {
+    // основной путь - чтение через отображение файла в память
+    if (MappedFile mapped = MappedFile::Open(file)) {
+        auto pixels = ParseMappedPPM({mapped.GetData(), mapped.GetSize()});
+        if (!pixels) {
+            return nullptr;
+        }
+        return MakeMappedReader({move(mapped), *pixels}, raster);
+    }
+
+    // файл не удалось отобразить (например, это канал) - читаем потоком
+    auto reader = make_unique<PPMReader>(file);
+    if (!reader->Open()) {
+        return nullptr;
+    }
+    return reader;
+}
+
+unique_ptr<ImageReader> OpenPPMReader(ByteView data, const RasterOptions& raster) {
+    auto pixels = ParseMappedPPM(data);
+    if (!pixels) {
+        return nullptr;
+    }
+    // пиксели остаются в памяти вызывающего, отображённого файла нет
+    return MakeMappedReader({MappedFile(), *pixels}, raster);
+}
+
+static unique_ptr<ImageWriter> CreatePPMWriter(unique_ptr<streambuf> buf, Size size,
+                                             const RasterOptions& raster) {
+    auto writer = make_unique<PPMWriter>(move(buf), size, raster);
+    if (!writer->IsOpen()) {
+        return nullptr;
+    }
+    return writer;
+}
+
+unique_ptr<ImageWriter> CreatePPMWriter(const Path& file, Size size, const FileWriteOptions& options,
+                                      const RasterOptions& raster) {
+    auto buf = OpenFileForWrite(file, options);
+    if (!buf) {
+        return nullptr;
+    }
+    return CreatePPMWriter(move(buf), size, raster);
+}
+
+unique_ptr<ImageWriter> CreatePPMWriter(ByteBuffer& out, Size size, const RasterOptions& raster) {
+    return CreatePPMWriter(make_unique<ByteBufferStreamBuf>(out), size, raster);
+}
+
+bool SavePPM(const Path& file, const ImageView& image, const FileWriteOptions& options,
+             const RasterOptions& raster) {
+    IMGLIB_TRACE_SCOPE("ppm.save");
+    return WriteWholeImage(CreatePPMWriter(file, {image.GetWidth(), image.GetHeight()}, options, raster), image);
+}
+
+bool SavePPM(ByteBuffer& out, const ImageView& image, const RasterOptions& raster) {
+    IMGLIB_TRACE_SCOPE("ppm.save");
+    return WriteWholeImage(CreatePPMWriter(out, {image.GetWidth(), image.GetHeight()}, raster), image);
+}
+
+Image LoadPPM(const Path& file, const RasterOptions& raster) {
+    IMGLIB_TRACE_SCOPE("ppm.load");
+    return ReadWholeImage(OpenPPMReader(file, raster));
+}
+
+Image LoadPPM(ByteView data, const RasterOptions& raster) {
+    IMGLIB_TRACE_SCOPE("ppm.load");
+    return ReadWholeImage(OpenPPMReader(data, raster));
 }
 
-}  // namespace img_lib
\ No newline at end of file
+}  // namespace img_lib
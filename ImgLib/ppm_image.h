@@ -1,12 +1,46 @@
 #pragma once
 #include "img_lib.h"
+#include "image_info.h"
+#include "image_stream.h"
+#include "mapped_file.h"
+#include "memory_buffer.h"
+#include "output_file.h"
+#include "parallel_rows.h"
 
 #include <filesystem>
+#include <memory>
+#include <optional>
+#include <ostream>
 
 namespace img_lib {
 using Path = std::filesystem::path;
 
-bool SavePPM(const Path& file, const Image& image);
-Image LoadPPM(const Path& file);
+// raster задаёт, на сколько потоков делить перестановку каналов и строк
+bool SavePPM(const Path& file, const ImageView& image, const FileWriteOptions& options = {},
+             const RasterOptions& raster = {});
+Image LoadPPM(const Path& file, const RasterOptions& raster = {});
+
+// построчное чтение и запись без полного кадра, nullptr - если файл
+// не удалось открыть или его заголовок не поддерживается
+std::unique_ptr<ImageReader> OpenPPMReader(const Path& file, const RasterOptions& raster = {});
+std::unique_ptr<ImageWriter> CreatePPMWriter(const Path& file, Size size,
+                                             const FileWriteOptions& options = {},
+                                             const RasterOptions& raster = {});
+
+// То же для файла в памяти. Результат записи заменяет содержимое out,
+// читатель ссылается на data и не должен её пережить
+bool SavePPM(ByteBuffer& out, const ImageView& image, const RasterOptions& raster = {});
+Image LoadPPM(ByteView data, const RasterOptions& raster = {});
+std::unique_ptr<ImageReader> OpenPPMReader(ByteView data, const RasterOptions& raster = {});
+std::unique_ptr<ImageWriter> CreatePPMWriter(ByteBuffer& out, Size size, const RasterOptions& raster = {});
+
+// читает только заголовок, nullopt - если файл не в формате PPM
+std::optional<ImageInfo> ProbePPM(const Path& file);
+
+// отображает файл в память и разбирает заголовок без копирования пикселей
+std::optional<MappedImage> MapPPM(const Path& file);
+
+// пишет заголовок файла для изображения size, строки RGB идут сразу за ним
+void WritePPMHeader(std::ostream& out, Size size);
 
 }  // namespace img_lib
\ No newline at end of file
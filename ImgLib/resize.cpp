@@ -0,0 +1,266 @@
+#include "resize.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+namespace img_lib {
+
+namespace {
+
+// веса хранятся в целых с 22 двоичными знаками после запятой: сумма
+// 8-битных значений с такими весами, включая отрицательные лепестки
+// Ланцоша, помещается в int32
+const int PRECISION_BITS = 22;
+const int32_t HALF = 1 << (PRECISION_BITS - 1);
+
+const double PI = 3.14159265358979323846;
+
+double Sinc(double x) {
+    if (x == 0.0) {
+        return 1.0;
+    }
+    x *= PI;
+    return sin(x) / x;
+}
+
+// радиус ядра в пикселях источника при масштабе 1
+double GetSupport(ResizeFilter filter) {
+    switch (filter) {
+        case ResizeFilter::BOX:
+            return 0.5;
+        case ResizeFilter::BILINEAR:
+            return 1.0;
+        case ResizeFilter::LANCZOS3:
+        default:
+            return 3.0;
+    }
+}
+
+double Kernel(ResizeFilter filter, double x) {
+    switch (filter) {
+        case ResizeFilter::BOX:
+            return x >= -0.5 && x < 0.5 ? 1.0 : 0.0;
+        case ResizeFilter::BILINEAR:
+            return max(0.0, 1.0 - abs(x));
+        case ResizeFilter::LANCZOS3:
+        default:
+            return abs(x) < 3.0 ? Sinc(x) * Sinc(x / 3.0) : 0.0;
+    }
+}
+
+// Веса одной оси: пиксель результата i складывается из count[i]
+// пикселей источника, начиная с first[i], с весами weights[i * taps + k]
+struct AxisWeights {
+    int taps = 0;
+    vector<int> first;
+    vector<int> count;
+    vector<int32_t> weights;
+};
+
+AxisWeights ComputeWeights(int in_size, int out_size, ResizeFilter filter) {
+    const double scale = double(in_size) / out_size;
+    // при уменьшении ядро растягивается, чтобы накрыть все пиксели источника
+    const double filter_scale = max(scale, 1.0);
+    const double support = GetSupport(filter) * filter_scale;
+
+    AxisWeights axis;
+    axis.taps = int(ceil(support)) * 2 + 1;
+    axis.first.resize(out_size);
+    axis.count.resize(out_size);
+    axis.weights.assign(size_t(out_size) * axis.taps, 0);
+
+    vector<double> w(axis.taps);
+    for (int i = 0; i < out_size; ++i) {
+        const double center = (i + 0.5) * scale;
+        const int first = max(int(center - support + 0.5), 0);
+        const int last = min(int(center + support + 0.5), in_size);
+        const int count = min(last - first, axis.taps);
+
+        double total = 0.0;
+        for (int k = 0; k < count; ++k) {
+            w[k] = Kernel(filter, (first + k - center + 0.5) / filter_scale);
+            total += w[k];
+        }
+
+        int32_t* dst = axis.weights.data() + size_t(i) * axis.taps;
+        for (int k = 0; k < count; ++k) {
+            const double normalized = total != 0.0 ? w[k] / total : 0.0;
+            dst[k] = int32_t(lround(normalized * (1 << PRECISION_BITS)));
+        }
+        axis.first[i] = first;
+        axis.count[i] = count;
+    }
+    return axis;
+}
+
+// пиксель результата i получает веса пикселя n - 1 - i
+void MirrorWeights(AxisWeights& axis) {
+    reverse(axis.first.begin(), axis.first.end());
+    reverse(axis.count.begin(), axis.count.end());
+    const size_t n = axis.first.size();
+    for (size_t i = 0; i < n / 2; ++i) {
+        swap_ranges(axis.weights.begin() + i * axis.taps, axis.weights.begin() + (i + 1) * axis.taps,
+                    axis.weights.begin() + (n - 1 - i) * axis.taps);
+    }
+}
+
+inline std::byte Clamp8(int32_t acc) {
+    return std::byte(clamp(acc >> PRECISION_BITS, 0, 255));
+}
+
+// Проход по строкам: меняет ширину, число строк остаётся прежним
+template <int CHANNELS>
+void ResizeRows(const ImageView& src, const AxisWeights& axis, Image& dst, const RasterOptions& raster) {
+    const int out_w = dst.GetWidth();
+    ParallelForRows(dst.GetHeight(), size_t(src.GetWidth()) * CHANNELS, raster, [&](int begin, int end) {
+        for (int y = begin; y < end; ++y) {
+            const std::byte* in = src.GetRowData(y);
+            std::byte* out = dst.GetRowData(y);
+
+            for (int x = 0; x < out_w; ++x) {
+                const std::byte* px = in + size_t(axis.first[x]) * CHANNELS;
+                const int32_t* w = axis.weights.data() + size_t(x) * axis.taps;
+
+                // каналы пикселя копятся вместе, компилятор держит их в одном регистре
+                int32_t acc[CHANNELS];
+                for (int c = 0; c < CHANNELS; ++c) {
+                    acc[c] = HALF;
+                }
+                for (int k = 0; k < axis.count[x]; ++k) {
+                    for (int c = 0; c < CHANNELS; ++c) {
+                        acc[c] += int32_t(px[k * CHANNELS + c]) * w[k];
+                    }
+                }
+                for (int c = 0; c < CHANNELS; ++c) {
+                    out[x * CHANNELS + c] = Clamp8(acc[c]);
+                }
+            }
+        }
+    });
+}
+
+// Проход по столбцам: меняет высоту. Строка результата - взвешенная сумма
+// целых строк источника. Строка считается блоками: суммы блока остаются
+// в кэше первого уровня, а внутренний цикл идёт по байтам подряд
+// и векторизуется компилятором
+void ResizeColumns(const ImageView& src, const AxisWeights& axis, Image& dst, const RasterOptions& raster) {
+    const size_t row_bytes = size_t(src.GetWidth()) * GetBytesPerPixel(src.GetFormat());
+    const size_t BLOCK = 512;
+
+    ParallelForRows(dst.GetHeight(), row_bytes * axis.taps, raster, [&](int begin, int end) {
+        int32_t acc[BLOCK];
+        for (int y = begin; y < end; ++y) {
+            const int32_t* w = axis.weights.data() + size_t(y) * axis.taps;
+            const int first = axis.first[y];
+            std::byte* out = dst.GetRowData(y);
+
+            for (size_t x0 = 0; x0 < row_bytes; x0 += BLOCK) {
+                const size_t n = min(BLOCK, row_bytes - x0);
+                fill(acc, acc + n, HALF);
+
+                for (int k = 0; k < axis.count[y]; ++k) {
+                    const auto* in = reinterpret_cast<const uint8_t*>(src.GetRowData(first + k)) + x0;
+                    const int32_t weight = w[k];
+                    for (size_t i = 0; i < n; ++i) {
+                        acc[i] += int32_t(in[i]) * weight;
+                    }
+                }
+
+                for (size_t i = 0; i < n; ++i) {
+                    out[x0 + i] = Clamp8(acc[i]);
+                }
+            }
+        }
+    });
+}
+
+}  // namespace
+
+Size GetResizeTarget(Size source, Size target) {
+    if (target.width <= 0 && target.height <= 0) {
+        return source;
+    }
+    if (target.width <= 0) {
+        target.width = max(1, int(lround(double(source.width) * target.height / source.height)));
+    } else if (target.height <= 0) {
+        target.height = max(1, int(lround(double(source.height) * target.width / source.width)));
+    }
+    return target;
+}
+
+Image Resize(const ImageView& image, Size size, const ResizeOptions& options) {
+    IMGLIB_TRACE_SCOPE("resize");
+    if (!image || size.width <= 0 || size.height <= 0) {
+        return {};
+    }
+
+    const PixelFormat format = image.GetFormat();
+    const bool resize_rows = size.width != image.GetWidth() || options.mirror;
+    const bool resize_columns = size.height != image.GetHeight();
+
+    auto rows_pass = [&](const ImageView& src) {
+        IMGLIB_TRACE_SCOPE("resize.rows");
+        // при той же ширине окно фильтра BOX накрывает ровно один пиксель:
+        // проход только отражает строки
+        const ResizeFilter filter = size.width != src.GetWidth() ? options.filter : ResizeFilter::BOX;
+        AxisWeights weights = ComputeWeights(src.GetWidth(), size.width, filter);
+        if (options.mirror) {
+            MirrorWeights(weights);
+        }
+        Image dst(size.width, src.GetHeight(), format, FOR_OVERWRITE);
+        if (GetBytesPerPixel(format) == 4) {
+            ResizeRows<4>(src, weights, dst, options.raster);
+        } else {
+            ResizeRows<3>(src, weights, dst, options.raster);
+        }
+        return dst;
+    };
+    auto columns_pass = [&](const ImageView& src, const AxisWeights& weights) {
+        IMGLIB_TRACE_SCOPE("resize.columns");
+        Image dst(src.GetWidth(), size.height, format, FOR_OVERWRITE);
+        ResizeColumns(src, weights, dst, options.raster);
+        return dst;
+    };
+
+    if (!resize_columns) {
+        if (resize_rows) {
+            return rows_pass(image);
+        }
+        // размер не меняется - просто копия
+        Image result(size.width, size.height, format, FOR_OVERWRITE);
+        const size_t row_bytes = size_t(size.width) * GetBytesPerPixel(format);
+        for (int y = 0; y < size.height; ++y) {
+            memcpy(result.GetRowData(y), image.GetRowData(y), row_bytes);
+        }
+        return result;
+    }
+
+    AxisWeights columns = ComputeWeights(image.GetHeight(), size.height, options.filter);
+    if (!resize_rows) {
+        return columns_pass(image, columns);
+    }
+
+    // Проход по столбцам векторизуется, а по строкам - нет, поэтому при
+    // уменьшении высоты сначала уменьшается число строк, и медленному
+    // проходу достаётся меньше работы
+    if (size.height < image.GetHeight()) {
+        return rows_pass(columns_pass(image, columns));
+    }
+
+    // при увеличении высоты проход по строкам считается до него и только
+    // для строк, которые понадобятся проходу по столбцам
+    const int first_row = columns.first.front();
+    const int rows = columns.first.back() + columns.count.back() - first_row;
+    for (int& first : columns.first) {
+        first -= first_row;
+    }
+    return columns_pass(rows_pass(image.Crop(0, first_row, image.GetWidth(), rows)), columns);
+}
+
+}  // namespace img_lib
@@ -0,0 +1,35 @@
+#pragma once
+#include "img_lib.h"
+#include "parallel_rows.h"
+
+namespace img_lib {
+
+// Фильтр передискретизации, от самого быстрого к самому точному
+enum class ResizeFilter {
+    BOX,       // среднее по накрытым пикселям, при увеличении - ближайший пиксель
+    BILINEAR,  // треугольное ядро радиусом в один пиксель
+    LANCZOS3,  // sinc с окном в три лепестка: самый резкий, но в 3 раза медленнее
+};
+
+struct ResizeOptions {
+    ResizeFilter filter = ResizeFilter::LANCZOS3;
+    RasterOptions raster;  // строки каждого прохода делятся между потоками
+
+    // отразить результат слева направо в том же проходе по строкам
+    bool mirror = false;
+};
+
+// Размер результата для запроса target: нулевая сторона вычисляется
+// по другой с сохранением пропорций source, но не меньше одного пикселя
+Size GetResizeTarget(Size source, Size target);
+
+// Масштабирует изображение до size двумя проходами: по строкам и по столбцам;
+// проход по оси, размер вдоль которой не меняется, пропускается.
+// При уменьшении ядро растягивается на коэффициент уменьшения, так что
+// каждый пиксель результата усредняет все накрытые им пиксели источника.
+// Каналы считаются независимо в целых числах с фиксированной точкой,
+// результат в том же формате пикселей. Пустое изображение - если
+// image пустое или size не положителен
+Image Resize(const ImageView& image, Size size, const ResizeOptions& options = {});
+
+}  // namespace img_lib
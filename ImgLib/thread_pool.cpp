@@ -0,0 +1,72 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace img_lib {
+
+ThreadPool::ThreadPool(size_t threads) {
+    if (threads == 0) {
+        threads = max(1u, thread::hardware_concurrency());
+    }
+
+    workers_.reserve(threads);
+    for (size_t i = 0; i < threads; ++i) {
+        workers_.emplace_back([this] { WorkerLoop(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard lock(mutex_);
+        stop_ = true;
+    }
+    task_ready_.notify_all();
+
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+void ThreadPool::Submit(Task task) {
+    {
+        lock_guard lock(mutex_);
+        tasks_.push_back(move(task));
+    }
+    task_ready_.notify_one();
+}
+
+void ThreadPool::Wait() {
+    unique_lock lock(mutex_);
+    all_done_.wait(lock, [this] { return tasks_.empty() && active_ == 0; });
+}
+
+void ThreadPool::WorkerLoop() {
+    while (true) {
+        Task task;
+        {
+            unique_lock lock(mutex_);
+            task_ready_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+            // при остановке сначала дорабатываем оставшиеся задачи
+            if (tasks_.empty()) {
+                return;
+            }
+            task = move(tasks_.front());
+            tasks_.pop_front();
+            ++active_;
+        }
+
+        task();
+
+        {
+            lock_guard lock(mutex_);
+            --active_;
+            if (tasks_.empty() && active_ == 0) {
+                all_done_.notify_all();
+            }
+        }
+    }
+}
+
+}  // namespace img_lib
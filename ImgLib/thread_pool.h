@@ -0,0 +1,48 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace img_lib {
+
+// Простой пул потоков с общей очередью задач.
+// Задачи выполняются в порядке добавления, Wait() блокирует
+// вызывающий поток до завершения всех добавленных задач
+class ThreadPool {
+public:
+    using Task = std::function<void()>;
+
+    // threads == 0 означает "по числу аппаратных потоков"
+    explicit ThreadPool(size_t threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void Submit(Task task);
+    void Wait();
+
+    size_t GetThreadCount() const {
+        return workers_.size();
+    }
+
+private:
+    void WorkerLoop();
+
+    std::vector<std::thread> workers_;
+    std::deque<Task> tasks_;
+
+    std::mutex mutex_;
+    std::condition_variable task_ready_;
+    std::condition_variable all_done_;
+
+    size_t active_ = 0;
+    bool stop_ = false;
+};
+
+}  // namespace img_lib
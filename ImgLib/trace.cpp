@@ -0,0 +1,169 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#ifdef _WIN32
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+    #include <psapi.h>
+#else
+    #include <sys/resource.h>
+#endif
+
+using namespace std;
+using namespace std::chrono;
+
+namespace img_lib {
+
+namespace {
+
+struct TraceEvent {
+    string_view name;
+    uint32_t thread;
+    steady_clock::time_point start;
+    nanoseconds duration;
+};
+
+struct TraceState {
+    mutex guard;
+    bool record_events = false;
+    steady_clock::time_point origin = steady_clock::now();
+    vector<TraceStageStats> stages;
+    vector<TraceEvent> events;
+    atomic<uint64_t> bytes_read{0};
+    atomic<uint64_t> bytes_written{0};
+    atomic<uint32_t> next_thread{1};
+};
+
+TraceState& GetState() {
+    static TraceState state;
+    return state;
+}
+
+// короткий номер потока для трассы: в JSON он нагляднее системного
+uint32_t GetTraceThread() {
+    thread_local const uint32_t id = GetState().next_thread.fetch_add(1);
+    return id;
+}
+
+// строка JSON без экранирования: имена участков - литералы без кавычек
+void WriteJSONString(ostream& out, string_view text) {
+    out << '"' << text << '"';
+}
+
+}  // namespace
+
+namespace detail {
+
+atomic<bool> tracing_enabled{false};
+
+void AddTraceCounter(TraceCounter counter, uint64_t value) {
+    TraceState& state = GetState();
+    auto& total = counter == TraceCounter::BYTES_READ ? state.bytes_read : state.bytes_written;
+    total.fetch_add(value, memory_order_relaxed);
+}
+
+void TraceScope::Finish() {
+    const auto end = steady_clock::now();
+    const auto duration = duration_cast<nanoseconds>(end - start_);
+    const uint32_t thread = GetTraceThread();
+
+    TraceState& state = GetState();
+    lock_guard lock(state.guard);
+
+    // имён мало, линейный поиск быстрее любого словаря
+    auto it = find_if(state.stages.begin(), state.stages.end(),
+                      [this](const TraceStageStats& stage) { return stage.name == name_; });
+    if (it == state.stages.end()) {
+        it = state.stages.insert(state.stages.end(), {name_, 0, nanoseconds(0)});
+    }
+    ++it->calls;
+    it->total += duration;
+
+    if (state.record_events) {
+        state.events.push_back({name_, thread, start_, duration});
+    }
+}
+
+}  // namespace detail
+
+bool IsTracingCompiled() {
+#ifdef IMGLIB_NO_TRACING
+    return false;
+#else
+    return true;
+#endif
+}
+
+void EnableTracing(bool record_events) {
+    TraceState& state = GetState();
+    {
+        lock_guard lock(state.guard);
+        state.record_events = record_events;
+        state.origin = steady_clock::now();
+    }
+    detail::tracing_enabled.store(true, memory_order_relaxed);
+}
+
+TraceStats GetTraceStats() {
+    TraceState& state = GetState();
+    TraceStats stats;
+    {
+        lock_guard lock(state.guard);
+        stats.stages = state.stages;
+    }
+    stats.bytes_read = state.bytes_read.load(memory_order_relaxed);
+    stats.bytes_written = state.bytes_written.load(memory_order_relaxed);
+    return stats;
+}
+
+void WriteChromeTrace(ostream& out) {
+    TraceState& state = GetState();
+    lock_guard lock(state.guard);
+
+    // "X" - законченное событие с длительностью, время в микросекундах.
+    // По умолчанию поток выводит 6 значащих цифр, и после первой секунды
+    // время округлялось бы до десятков микросекунд и выше. Поток свой,
+    // чтобы не менять формат у out
+    ostringstream json;
+    json << fixed << setprecision(3) << "{\"traceEvents\":[";
+    bool first = true;
+    for (const TraceEvent& event : state.events) {
+        json << (first ? "\n" : ",\n") << "{\"name\":";
+        WriteJSONString(json, event.name);
+        json << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.thread
+             << ",\"ts\":" << duration<double, micro>(event.start - state.origin).count()
+             << ",\"dur\":" << duration<double, micro>(event.duration).count() << '}';
+        first = false;
+    }
+    json << "\n]}\n";
+    out << json.str();
+}
+
+uint64_t GetPeakRSS() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!K32GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return 0;
+    }
+    return counters.PeakWorkingSetSize;
+#else
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+    #ifdef __APPLE__
+    return uint64_t(usage.ru_maxrss);  // в байтах
+    #else
+    return uint64_t(usage.ru_maxrss) * 1024;  // в КиБ
+    #endif
+#endif
+}
+
+}  // namespace img_lib
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+namespace img_lib {
+
+// Замеры стадий конвертации. Участки кода размечаются макросом
+// IMGLIB_TRACE_SCOPE("имя"), объём файлового ввода-вывода - IMGLIB_TRACE_BYTES.
+// Пока трассировка не включена вызовом EnableTracing, участок стоит одного
+// чтения флага, а сборка с -DIMGLIB_TRACING=OFF убирает разметку совсем.
+// Участки задаются крупно (заголовок, полоса строк, файл целиком), поэтому
+// и включённая трассировка почти не влияет на время работы
+
+enum class TraceCounter {
+    BYTES_READ,
+    BYTES_WRITTEN,
+};
+
+// Суммарное время участков с одним именем. Вложенные участки входят
+// и во время объемлющих, а в многопоточном режиме сумма может быть больше
+// общего времени работы
+struct TraceStageStats {
+    std::string_view name;
+    uint64_t calls = 0;
+    std::chrono::nanoseconds total{0};
+};
+
+struct TraceStats {
+    std::vector<TraceStageStats> stages;  // в порядке первого появления
+    uint64_t bytes_read = 0;
+    uint64_t bytes_written = 0;
+};
+
+// false - если разметка убрана при сборке и замеров не будет
+bool IsTracingCompiled();
+
+// Включает сбор статистики. С record_events дополнительно запоминается
+// каждый участок для WriteChromeTrace - это память на каждый вызов
+void EnableTracing(bool record_events = false);
+
+TraceStats GetTraceStats();
+
+// Записывает запомненные участки в формате Chrome trace event (JSON),
+// который открывают Perfetto и chrome://tracing
+void WriteChromeTrace(std::ostream& out);
+
+// пиковый объём физической памяти процесса в байтах, 0 - если неизвестен
+uint64_t GetPeakRSS();
+
+namespace detail {
+
+extern std::atomic<bool> tracing_enabled;
+
+void AddTraceCounter(TraceCounter counter, uint64_t value);
+
+// Отмечает участок от создания до разрушения. name должен жить
+// до конца программы, обычно это строковый литерал
+class TraceScope {
+public:
+    explicit TraceScope(std::string_view name)
+        : name_(name) {
+        if (tracing_enabled.load(std::memory_order_relaxed)) {
+            active_ = true;
+            start_ = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~TraceScope() {
+        if (active_) {
+            Finish();
+        }
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    void Finish();
+
+    std::string_view name_;
+    bool active_ = false;
+    std::chrono::steady_clock::time_point start_;
+};
+
+inline void TraceBytes(TraceCounter counter, uint64_t value) {
+    if (tracing_enabled.load(std::memory_order_relaxed)) {
+        AddTraceCounter(counter, value);
+    }
+}
+
+}  // namespace detail
+
+}  // namespace img_lib
+
+#ifndef IMGLIB_NO_TRACING
+    #define IMGLIB_TRACE_CONCAT_IMPL(a, b) a##b
+    #define IMGLIB_TRACE_CONCAT(a, b) IMGLIB_TRACE_CONCAT_IMPL(a, b)
+    #define IMGLIB_TRACE_SCOPE(name) \
+        ::img_lib::detail::TraceScope IMGLIB_TRACE_CONCAT(imglib_trace_scope_, __LINE__)(name)
+    #define IMGLIB_TRACE_BYTES(counter, value) \
+        ::img_lib::detail::TraceBytes(::img_lib::TraceCounter::counter, (value))
+#else
+    #define IMGLIB_TRACE_SCOPE(name) ((void)0)
+    #define IMGLIB_TRACE_BYTES(counter, value) ((void)0)
+#endif